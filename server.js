@@ -5,6 +5,8 @@ const fs = require('fs');
 const axios = require('axios');
 const { v4: uuidv4 } = require('uuid');
 const compression = require('compression');
+const { spawn } = require('child_process');
+const readline = require('readline');
 
 // Upload a single file to GitHub repository with retry logic
 async function uploadFileToGitHub(token, owner, repoName, filePath, content, maxRetries = 3) {
@@ -162,9 +164,240 @@ app.use(express.static('.'));
 // In-memory storage for compilation jobs (in production, use Redis/Database)
 const compilationJobs = new Map();
 
+// Engine worker pool: N engine processes are started once with their hash
+// allocated, and analysis requests are queued and dispatched to the next
+// idle one over its stdin/stdout pipe, so that requests do not pay for the
+// process spawn, the table init and the hash allocation.
+const ENGINE_PATH = process.env.ENGINE_PATH ||
+    path.join(__dirname, process.platform === 'win32' ? 'stockfish-betza-windows.exe' : 'stockfish-betza');
+const ENGINE_POOL_SIZE = parseInt(process.env.ENGINE_POOL_SIZE || '2', 10);
+const ENGINE_HASH_MB = parseInt(process.env.ENGINE_HASH_MB || '64', 10);
+const MAX_DEPTH = 30;
+const MAX_MOVETIME_MS = 20000;
+const LATENCY_SAMPLES = 1000;
+
+class EngineWorker {
+    constructor(id, pool) {
+        this.id = id;
+        this.pool = pool;
+        this.ready = false;
+        this.request = null;
+        this.start();
+    }
+
+    start() {
+        this.ready = false;
+        this.process = spawn(ENGINE_PATH, [], { stdio: ['pipe', 'pipe', 'ignore'] });
+        this.process.on('error', (error) => {
+            console.error(`❌ Engine ${this.id} failed to start: ${error.message}`);
+        });
+        this.process.on('exit', (code) => this.onExit(code));
+
+        readline.createInterface({ input: this.process.stdout }).on('line', (line) => this.onLine(line));
+
+        this.send('uci');
+        this.send(`setoption name Hash value ${ENGINE_HASH_MB}`);
+        this.send('setoption name Threads value 1');
+        this.send('isready');
+    }
+
+    send(command) {
+        if (this.process.stdin.writable) {
+            this.process.stdin.write(command + '\n');
+        }
+    }
+
+    onLine(line) {
+        if (!this.ready) {
+            if (line === 'readyok') {
+                this.ready = true;
+                this.pool.dispatch();
+            }
+            return;
+        }
+
+        const request = this.request;
+        if (!request) return;
+
+        if (line.startsWith('info ')) {
+            request.lastInfo = line;
+            request.onInfo(line);
+        } else if (line.startsWith('bestmove')) {
+            const [, bestmove, , ponder] = line.split(' ');
+            this.request = null;
+            this.pool.complete(request, { bestmove, ponder: ponder || null, info: request.lastInfo });
+            this.pool.dispatch();
+        }
+    }
+
+    onExit(code) {
+        console.error(`❌ Engine ${this.id} exited with code ${code}`);
+
+        if (this.request) {
+            this.pool.complete(this.request, null, new Error('Engine exited during analysis'));
+            this.request = null;
+        }
+
+        // Restart unless the pool is shutting down, after a delay in case the
+        // binary is missing or crashes at startup
+        if (!this.pool.closing) {
+            setTimeout(() => this.start(), 5000);
+        }
+    }
+
+    analyse(request) {
+        this.request = request;
+        request.startedAt = Date.now();
+
+        const moves = request.moves.length ? ` moves ${request.moves.join(' ')}` : '';
+        this.send(`position fen ${request.fen}${moves}`);
+        this.send(`go ${request.limits}`);
+    }
+}
+
+class EnginePool {
+    constructor(size) {
+        this.queue = [];
+        this.closing = false;
+        this.completed = 0;
+        this.failed = 0;
+        this.waitTimes = [];
+        this.totalTimes = [];
+        this.workers = [];
+
+        if (!fs.existsSync(ENGINE_PATH)) {
+            console.log(`⚠️ Engine not found at ${ENGINE_PATH}, analysis API disabled`);
+            return;
+        }
+
+        for (let i = 0; i < size; i++) {
+            this.workers.push(new EngineWorker(i, this));
+        }
+    }
+
+    // Queue an analysis, resolved with the best move once the search is done
+    analyse(fen, moves, limits, onInfo) {
+        return new Promise((resolve, reject) => {
+            this.queue.push({ fen, moves, limits, onInfo, resolve, reject, queuedAt: Date.now(), lastInfo: null });
+            this.dispatch();
+        });
+    }
+
+    dispatch() {
+        for (const worker of this.workers) {
+            if (!this.queue.length) return;
+            if (worker.ready && !worker.request) {
+                worker.analyse(this.queue.shift());
+            }
+        }
+    }
+
+    complete(request, result, error) {
+        const now = Date.now();
+        record(this.waitTimes, request.startedAt - request.queuedAt);
+        record(this.totalTimes, now - request.queuedAt);
+
+        if (error) {
+            this.failed++;
+            request.reject(error);
+        } else {
+            this.completed++;
+            request.resolve(result);
+        }
+    }
+
+    stats() {
+        return {
+            enginePath: ENGINE_PATH,
+            workers: this.workers.length,
+            ready: this.workers.filter(w => w.ready).length,
+            busy: this.workers.filter(w => w.request).length,
+            queueDepth: this.queue.length,
+            completed: this.completed,
+            failed: this.failed,
+            queueWaitMs: percentiles(this.waitTimes),
+            latencyMs: percentiles(this.totalTimes)
+        };
+    }
+
+    close() {
+        this.closing = true;
+        for (const worker of this.workers) {
+            worker.send('quit');
+        }
+    }
+}
+
+// Keep the last LATENCY_SAMPLES values of a metric
+function record(samples, value) {
+    samples.push(value);
+    if (samples.length > LATENCY_SAMPLES) samples.shift();
+}
+
+function percentiles(samples) {
+    if (!samples.length) return null;
+    const sorted = [...samples].sort((a, b) => a - b);
+    const at = (p) => sorted[Math.min(sorted.length - 1, Math.floor(p * sorted.length))];
+    return { p50: at(0.5), p90: at(0.9), p99: at(0.99), max: sorted[sorted.length - 1] };
+}
+
+const enginePool = new EnginePool(ENGINE_POOL_SIZE);
+
 // API Routes
 app.get('/api/health', (req, res) => {
-    res.json({ status: 'healthy', timestamp: new Date().toISOString() });
+    res.json({ status: 'healthy', timestamp: new Date().toISOString(), engines: enginePool.stats() });
+});
+
+// Analyse a position on a pooled engine. With "stream": true the engine info
+// lines are sent as they come, one JSON object per line, before the result.
+app.post('/api/analyse', async (req, res) => {
+    const { fen, moves = [], depth, movetime, nodes, stream } = req.body;
+
+    if (!fen || typeof fen !== 'string' || /[\r\n]/.test(fen)) {
+        return res.status(400).json({ error: 'A single line FEN is required' });
+    }
+
+    if (!Array.isArray(moves) || moves.some(m => typeof m !== 'string' || !/^[a-z0-9@]+$/i.test(m))) {
+        return res.status(400).json({ error: 'Moves must be an array of moves in UCI notation' });
+    }
+
+    if (!enginePool.workers.length) {
+        return res.status(503).json({ error: 'No engine available' });
+    }
+
+    // Without a limit search to a moderate depth, and keep every search well
+    // below the request timeout
+    let limits = `movetime ${Math.min(parseInt(movetime, 10) || MAX_MOVETIME_MS, MAX_MOVETIME_MS)}`;
+    if (depth) limits = `depth ${Math.min(parseInt(depth, 10) || 1, MAX_DEPTH)} ${limits}`;
+    if (nodes) limits = `nodes ${parseInt(nodes, 10) || 1} ${limits}`;
+    if (!depth && !movetime && !nodes) limits = `depth 12 ${limits}`;
+
+    if (stream) {
+        res.set({ 'Content-Type': 'application/x-ndjson', 'Cache-Control': 'no-cache' });
+    }
+
+    const onInfo = (line) => {
+        if (stream) {
+            res.write(JSON.stringify({ info: line }) + '\n');
+            if (res.flush) res.flush(); // Push through the compression middleware
+        }
+    };
+
+    try {
+        const result = await enginePool.analyse(fen, moves, limits, onInfo);
+        if (stream) {
+            res.end(JSON.stringify(result) + '\n');
+        } else {
+            res.json(result);
+        }
+    } catch (error) {
+        console.error('Analysis error:', error.message);
+        if (stream) {
+            res.end(JSON.stringify({ error: error.message }) + '\n');
+        } else {
+            res.status(500).json({ error: 'Analysis failed' });
+        }
+    }
 });
 
 // Download Betza Integration Package
@@ -473,9 +706,18 @@ const server = app.listen(PORT, '0.0.0.0', () => {
     console.log(`📦 Package download: http://localhost:${PORT}/api/download-package`);
     console.log(`🔧 Repository setup: POST http://localhost:${PORT}/api/setup-repository`);
     console.log(`📊 API health check: http://localhost:${PORT}/api/health`);
+    console.log(`♟️ Position analysis: POST http://localhost:${PORT}/api/analyse`);
 });
 
 // Set server timeout
 server.timeout = 30000;
 
+// Stop the pooled engines with the server
+for (const signal of ['SIGINT', 'SIGTERM']) {
+    process.on(signal, () => {
+        enginePool.close();
+        server.close(() => process.exit(0));
+    });
+}
+
 module.exports = app;
\ No newline at end of file
@@ -0,0 +1,396 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2018 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "batch.h"
+#include "movegen.h"
+#include "search.h"
+#include "thread.h"
+#include "tt.h"
+#include "uci.h"
+
+namespace {
+
+  enum Job { ANALYSIS, SELF_PLAY };
+
+  Job CurrentJob;
+  std::vector<std::string> Fens;
+  std::atomic<size_t> NextPosition, Searched;
+  std::atomic<uint64_t> TotalNodes;
+  bool Chess960;
+
+  // Self-play parameters, see Batch::gensfen()
+  size_t Games;
+  int RandomPlies, MaxPlies;
+  uint64_t Seed;
+
+  std::ofstream Output;
+  std::mutex OutputMutex;
+
+  // epd_score() formats a score from the side to move point of view with the
+  // EPD opcodes for a centipawn evaluation or a direct mate in moves.
+  std::string epd_score(Value v) {
+
+    std::stringstream ss;
+
+    if (abs(v) < VALUE_MATE - MAX_PLY)
+        ss << "ce " << v * 100 / PawnValueEg;
+    else
+        ss << "dm " << (v > 0 ? VALUE_MATE - v + 1 : -VALUE_MATE - v) / 2;
+
+    return ss.str();
+  }
+
+  // start_job() sets the limits shared by both jobs and wakes up the main
+  // thread, which runs the job in the background like a 'go'.
+  void start_job(Job job, int depth, int64_t nodes) {
+
+    Search::LimitsType limits;
+    limits.startTime = now();
+    limits.depth = depth;
+    limits.nodes = nodes;
+    limits.batch = 1;
+
+    CurrentJob = job;
+    Search::Limits = limits;
+    Chess960 = Options["UCI_Chess960"];
+    Threads.stop = Threads.ponder = Threads.stopOnPonderhit = false;
+
+    Threads.main()->start_searching();
+  }
+
+  // search_root() searches the root position of the thread alone, as set up
+  // by the caller, and returns the score of the best move.
+  Value search_root(Thread* th) {
+
+    th->rootMoves.clear();
+    for (const auto& m : MoveList<LEGAL>(th->rootPos))
+        th->rootMoves.emplace_back(m);
+
+    th->rootDepth = th->completedDepth = DEPTH_ZERO;
+    th->nmpMinPly = 0;
+    th->nodes = 0;
+
+    if (th->rootMoves.empty())
+        return th->rootPos.checkers() ? -VALUE_MATE : VALUE_DRAW;
+
+    th->Thread::search();
+    TotalNodes += th->nodes;
+
+    return th->rootMoves[0].score;
+  }
+
+  // search_positions() searches the positions of the input file one by one,
+  // writing the result of each one as soon as it is searched.
+  void search_positions(Thread* th) {
+
+    Position& pos = th->rootPos;
+    StateInfo st;
+    size_t idx;
+
+    while (!Threads.stop && (idx = NextPosition++) < Fens.size())
+    {
+        pos.set(Fens[idx], Chess960, &st, th);
+
+        Value v = search_root(th);
+
+        // An aborted search leaves no result to write
+        if (Threads.stop)
+            break;
+
+        std::stringstream ss;
+        ss << Fens[idx]
+           << " acd " << th->completedDepth / ONE_PLY
+           << "; acn " << th->nodes
+           << "; " << epd_score(v) << ";";
+
+        if (!th->rootMoves.empty())
+        {
+            ss << " bm " << UCI::move(th->rootMoves[0].pv[0], pos) << "; pv";
+            for (Move m : th->rootMoves[0].pv)
+                ss << " " << UCI::move(m, pos);
+            ss << ";";
+        }
+
+        ss << " id \"" << idx + 1 << "\";\n";
+
+        std::lock_guard<std::mutex> lk(OutputMutex);
+        Output << ss.str();
+        ++Searched;
+    }
+  }
+
+  // random_setup() returns the start position of a self-play game in XBoard
+  // format, as XBoard::StartFEN, with two random gating piece types placed on
+  // random gates. A king gate excludes the rook gates, as in PLACEMENTS.
+  std::string random_setup(PRNG& rng) {
+
+    const int types = FORTRESS - CANNON + 1;
+    PieceType pt[2];
+    pt[0] = PieceType(CANNON + rng.rand<unsigned>() % types);
+    pt[1] = PieceType(CANNON + (pt[0] - CANNON + 1 + rng.rand<unsigned>() % (types - 1)) % types);
+
+    std::string rows[COLOR_NB];
+
+    for (Color c = WHITE; c <= BLACK; ++c)
+    {
+        int f[2];
+        do {
+            f[0] = rng.rand<unsigned>() % 8;
+            f[1] = rng.rand<unsigned>() % 8;
+        } while (   f[0] == f[1]
+                 || ((f[0] == FILE_E || f[1] == FILE_E) && (f[0] % 7 == 0 || f[1] % 7 == 0)));
+
+        rows[c] = "********";
+        for (int i = 0; i < 2; ++i)
+            rows[c][f[i]] = PieceToChar[make_piece(c, pt[i])];
+    }
+
+    return rows[BLACK] + "/rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR/"
+         + rows[WHITE] + " w KQBCDFGkqbcdfg - 0 1";
+  }
+
+  template<typename T>
+  void write(std::string& buf, T v) { buf.append(reinterpret_cast<const char*>(&v), sizeof(T)); }
+
+  // play_games() plays self-play games one by one, each from a random setup
+  // followed by random moves, and writes each game once it is over.
+  void play_games(Thread* th) {
+
+    Position& pos = th->rootPos;
+    size_t game;
+
+    while (!Threads.stop && (game = NextPosition++) < Games)
+    {
+        PRNG rng(Seed ^ (game + 1) * 0x9E3779B97F4A7C15ULL);
+        StateList states;
+
+        pos.set(random_setup(rng), false, &states.back(), th);
+
+        for (int i = 0; i < RandomPlies; ++i)
+        {
+            MoveList<LEGAL> moves(pos);
+            if (!moves.size())
+                break;
+
+            states.emplace_back();
+            pos.do_move(*(moves.begin() + rng.rand<unsigned>() % moves.size()), states.back());
+        }
+
+        const std::string fen = pos.fen();
+        const Color startColor = pos.side_to_move();
+        std::vector<std::pair<Move, Value>> plies;
+        int result = 0; // From the point of view of the side to move at the start
+
+        while (true)
+        {
+            if (pos.is_draw(0) || int(plies.size()) >= MaxPlies)
+                break;
+
+            Value v = search_root(th);
+
+            if (Threads.stop)
+                break;
+
+            if (th->rootMoves.empty() || abs(v) >= VALUE_MATE_IN_MAX_PLY)
+            {
+                if (v != VALUE_DRAW)
+                    result = (v > 0) == (pos.side_to_move() == startColor) ? 1 : -1;
+                break;
+            }
+
+            Move m = th->rootMoves[0].pv[0];
+            plies.emplace_back(m, v);
+            states.emplace_back();
+            pos.do_move(m, states.back());
+        }
+
+        // An aborted game leaves no result to write
+        if (Threads.stop)
+            break;
+
+        std::string buf;
+        write(buf, uint16_t(fen.size()));
+        buf += fen;
+        write(buf, uint16_t(plies.size()));
+        write(buf, int8_t(result));
+
+        for (const auto& p : plies)
+        {
+            write(buf, uint32_t(p.first));
+            write(buf, int16_t(p.second));
+        }
+
+        std::lock_guard<std::mutex> lk(OutputMutex);
+        Output.write(buf.data(), buf.size());
+        ++Searched;
+    }
+  }
+
+} // namespace
+
+
+/// The 'batch' command takes an input file of FEN or EPD positions, an output
+/// file and the search depth. Each line of the output is the input position
+/// followed by EPD opcodes with the result, in the order the positions finish:
+///
+/// batch book.epd book.out -> search every position of book.epd to depth 10
+/// batch book.epd book.out 14 -> the same to depth 14
+
+void Batch::analyse(std::istream& is) {
+
+  std::string input, output, token;
+  int depth = 10;
+
+  is >> input >> output;
+  if (is >> token)
+      depth = std::stoi(token);
+
+  Threads.main()->wait_for_search_finished();
+
+  std::ifstream file(input);
+
+  if (!file.is_open())
+  {
+      sync_cout << "info string Unable to open file " << input << sync_endl;
+      return;
+  }
+
+  Fens.clear();
+  std::string fen;
+
+  while (getline(file, fen))
+      if (!fen.empty())
+      {
+          // EPD lines carry opcodes after the four position fields
+          if (fen.find(';') != std::string::npos)
+          {
+              std::istringstream ss(fen);
+              std::string field;
+              fen.clear();
+              for (int i = 0; i < 4 && ss >> field; ++i)
+                  fen += (i ? " " : "") + field;
+          }
+          Fens.push_back(fen);
+      }
+
+  Output.open(output);
+
+  if (!Output.is_open())
+  {
+      sync_cout << "info string Unable to open file " << output << sync_endl;
+      return;
+  }
+
+  start_job(ANALYSIS, depth, 0);
+}
+
+
+/// The 'gensfen' command plays self-play games, one per thread at a time, and
+/// writes them to a binary file. Its parameters are given as name and value
+/// pairs, all optional but the output file:
+///
+/// gensfen output games.bin -> 1000 games at depth 8
+/// gensfen output games.bin games 100000 depth 0 nodes 5000 random 10 maxply 300 seed 7
+///
+/// The nodes limit is checked at the end of each iteration only. The file is
+/// a sequence of games, each stored, in the native byte order, as:
+///
+/// uint16_t       length of the start FEN, after the random moves
+/// char[length]   start FEN
+/// uint16_t       number of plies
+/// int8_t         result: 1, 0 or -1 for a win, draw or loss of the side to
+///                move in the start FEN
+/// plies times:   uint32_t move played, int16_t score before the move from the
+///                point of view of the side to move, in internal Value units
+
+void Batch::gensfen(std::istream& is) {
+
+  std::string token, output;
+  int depth = 8;
+  int64_t nodes = 0;
+
+  Games = 1000, RandomPlies = 8, MaxPlies = 400, Seed = uint64_t(now());
+
+  while (is >> token)
+      if (token == "output")      is >> output;
+      else if (token == "games")  is >> Games;
+      else if (token == "depth")  is >> depth;
+      else if (token == "nodes")  is >> nodes;
+      else if (token == "random") is >> RandomPlies;
+      else if (token == "maxply") is >> MaxPlies;
+      else if (token == "seed")   is >> Seed;
+
+  Threads.main()->wait_for_search_finished();
+
+  Output.open(output, std::ios::binary);
+
+  if (!Output.is_open())
+  {
+      sync_cout << "info string Unable to open file " << output << sync_endl;
+      return;
+  }
+
+  start_job(SELF_PLAY, depth, nodes);
+}
+
+
+void Batch::run(MainThread* mainThread) {
+
+  NextPosition = Searched = 0;
+  TotalNodes = 0;
+  TT.new_search();
+
+  for (Thread* th : Threads)
+      if (th != mainThread)
+          th->start_batch();
+
+  search(mainThread);
+
+  for (Thread* th : Threads)
+      if (th != mainThread)
+          th->wait_for_search_finished();
+
+  Output.close();
+
+  const TimePoint elapsed = now() - Search::Limits.startTime + 1;
+  const char* unit = CurrentJob == ANALYSIS ? " positions" : " games";
+
+  sync_cout << "info string batch " << Searched << " of "
+            << (CurrentJob == ANALYSIS ? Fens.size() : Games) << unit
+            << ", " << elapsed << " ms, " << Searched * 1000 / elapsed
+            << unit << "/s, " << TotalNodes << " nodes" << sync_endl;
+}
+
+
+void Batch::search(Thread* th) {
+
+  if (CurrentJob == ANALYSIS)
+      search_positions(th);
+  else
+      play_games(th);
+}
@@ -0,0 +1,49 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2018 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BATCH_H_INCLUDED
+#define BATCH_H_INCLUDED
+
+#include <istream>
+
+class Thread;
+struct MainThread;
+
+namespace Batch {
+
+/// Batch::analyse() and Batch::gensfen() are called when the engine receives
+/// the 'batch' and 'gensfen' commands. They wake up the main thread, which runs
+/// the job in the background like a 'go', so that 'stop' aborts it.
+void analyse(std::istream& is);
+void gensfen(std::istream& is);
+
+/// Batch::run() is called by the main thread instead of the search. Positions
+/// to analyse, or games to play, are handed out to all the threads of the pool
+/// one by one, and each thread searches its own position alone.
+void run(MainThread* mainThread);
+
+/// Batch::search() is the worker entry point, called by every thread that
+/// takes part in a batch. It keeps picking unclaimed positions or games until
+/// none is left, writing the result of each one as soon as it is done.
+void search(Thread* th);
+
+} // namespace Batch
+
+#endif // #ifndef BATCH_H_INCLUDED
@@ -18,12 +18,18 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <chrono>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <istream>
+#include <sstream>
 #include <vector>
 
+#include "movegen.h"
 #include "position.h"
+#include "thread.h"
+#include "uci.h"
 
 using namespace std;
 
@@ -90,18 +96,21 @@ const vector<string> Defaults = {
 } // namespace
 
 /// setup_bench() builds a list of UCI commands to be run by bench. There
-/// are five parameters: TT size in MB, number of search threads that
+/// are six parameters: TT size in MB, number of search threads that
 /// should be used, the limit value spent for each position, a file name
-/// where to look for positions in FEN format and the type of the limit:
-/// depth, perft, nodes and movetime (in millisecs).
+/// where to look for positions in FEN or EPD format, the type of the limit:
+/// depth, perft, nodes and movetime (in millisecs), and the output format,
+/// 'text' or 'json'. With 'json' a single line JSON document with the results
+/// for every position is written to stdout once the bench is done.
 ///
 /// bench -> search default positions up to depth 13
 /// bench 64 1 15 -> search default positions up to depth 15 (TT = 64MB)
 /// bench 64 4 5000 current movetime -> search current position with 4 threads for 5 sec
 /// bench 64 1 100000 default nodes -> search default positions for 100K nodes each
 /// bench 16 1 5 default perft -> run a perft 5 on default positions
+/// bench 256 8 20 suite.epd depth json -> search suite.epd with 8 threads, JSON results
 
-vector<string> setup_bench(const Position& current, istream& is) {
+vector<string> setup_bench(const Position& current, istream& is, string& format) {
 
   vector<string> fens, list;
   string go, token;
@@ -112,6 +121,7 @@ vector<string> setup_bench(const Position& current, istream& is) {
   string limit     = (is >> token) ? token : "13";
   string fenFile   = (is >> token) ? token : "default";
   string limitType = (is >> token) ? token : "depth";
+  format            = (is >> token) ? token : "text";
 
   go = "go " + limitType + " " + limit;
 
@@ -134,7 +144,18 @@ vector<string> setup_bench(const Position& current, istream& is) {
 
       while (getline(file, fen))
           if (!fen.empty())
+          {
+              // EPD lines carry opcodes after the four position fields
+              if (fen.find(';') != string::npos)
+              {
+                  istringstream ss(fen);
+                  string field;
+                  fen.clear();
+                  for (int i = 0; i < 4 && ss >> field; ++i)
+                      fen += (i ? " " : "") + field;
+              }
               fens.push_back(fen);
+          }
 
       file.close();
   }
@@ -154,3 +175,160 @@ vector<string> setup_bench(const Position& current, istream& is) {
 
   return list;
 }
+
+
+namespace {
+
+  // Move classes timed separately by key_bench(), chosen after the different
+  // key update paths of do_move().
+  enum KeyBenchClass {
+    KB_NORMAL, KB_CAPTURE, KB_GATING, KB_CAPTURE_GATE, KB_CASTLING, KB_CASTLING_GATE,
+    KB_PROMOTION, KB_SETUP, KB_CLASS_NB
+  };
+
+  const char* KeyBenchNames[KB_CLASS_NB] = {
+    "normal", "capture", "gating", "capture-of-gate", "castling", "castling-with-gate",
+    "promotion", "setup"
+  };
+
+  KeyBenchClass classify(const Position& pos, Move m) {
+
+    const MoveType mt = type_of(m);
+
+    if (mt == SET_GATING_TYPE || mt == PUT_GATING_PIECE)
+        return KB_SETUP;
+
+    const Square from = from_sq(m), to = to_sq(m);
+
+    if (mt == CASTLING)
+        return (pos.gates() & from) || (pos.gates() & to) ? KB_CASTLING_GATE : KB_CASTLING;
+
+    if (mt == PROMOTION)
+        return KB_PROMOTION;
+
+    if (pos.capture(m) && (pos.gates() & to))
+        return KB_CAPTURE_GATE;
+
+    if (pos.gates() & from)
+        return KB_GATING;
+
+    return pos.capture(m) ? KB_CAPTURE : KB_NORMAL;
+  }
+
+  struct KeyBenchStats {
+    uint64_t moves, mismatches, keyAfterMisses;
+    int64_t doUndoNs, keyAfterNs;
+  };
+
+} // namespace
+
+
+/// key_bench() times do_move()/undo_move() and key_after() per move class over
+/// the positions met along pseudo random games started from the bench
+/// positions, and checks that the incrementally updated keys agree with the
+/// ones computed from scratch. The parameters are the number of repetitions
+/// per position, the number of plies per game and a file name of FENs:
+///
+/// keybench -> 200 repetitions, 60 plies per game from the default positions
+/// keybench 1000 100 current -> 1000 repetitions, 100 plies from the current position
+
+void key_bench(const Position& current, istream& is) {
+
+  typedef std::chrono::steady_clock Clock;
+
+  string token;
+  const int reps    = (is >> token) ? stoi(token) : 200;
+  const int plies   = (is >> token) ? stoi(token) : 60;
+  const string file = (is >> token) ? token : "default";
+  vector<string> fens;
+
+  if (file == "default")
+  {
+      for (const string& fen : Defaults)
+          if (fen.find("setoption") == string::npos)
+              fens.push_back(fen.substr(0, fen.find(" moves ")));
+  }
+  else if (file == "current")
+      fens.push_back(current.fen());
+  else
+  {
+      string fen;
+      ifstream f(file);
+
+      while (getline(f, fen))
+          if (!fen.empty())
+              fens.push_back(fen);
+  }
+
+  KeyBenchStats stats[KB_CLASS_NB] = {};
+  PRNG rng(1070372);
+  volatile Key sink = 0; // Keep key_after() from being optimized away
+
+  for (const string& fen : fens)
+  {
+      StateList states;
+      Position pos;
+      pos.set(fen, current.is_chess960(), &states.back(), Threads.main());
+
+      for (int ply = 0; ply < plies; ++ply)
+      {
+          MoveList<LEGAL> moves(pos);
+          if (!moves.size())
+              break;
+
+          StateInfo st;
+
+          for (const auto& m : moves)
+          {
+              KeyBenchStats& s = stats[classify(pos, m)];
+
+              pos.do_move(m, st);
+              const Key actual = pos.key();
+              s.mismatches += !pos.keys_ok();
+              pos.undo_move(m);
+
+              s.keyAfterMisses += pos.key_after(m) != actual;
+
+              auto start = Clock::now();
+              for (int r = 0; r < reps; ++r)
+              {
+                  pos.do_move(m, st);
+                  pos.undo_move(m);
+              }
+              auto mid = Clock::now();
+              for (int r = 0; r < reps; ++r)
+                  sink = sink ^ pos.key_after(m);
+              auto end = Clock::now();
+
+              s.moves++;
+              s.doUndoNs += std::chrono::duration_cast<std::chrono::nanoseconds>(mid - start).count();
+              s.keyAfterNs += std::chrono::duration_cast<std::chrono::nanoseconds>(end - mid).count();
+          }
+
+          const Move m = *(moves.begin() + rng.rand<uint64_t>() % moves.size());
+          states.emplace_back();
+          pos.do_move(m, states.back());
+      }
+  }
+
+  cerr << "\n" << setw(20) << "move class" << setw(10) << "moves"
+       << setw(14) << "do+undo ns" << setw(14) << "key_after ns"
+       << setw(14) << "key_after ok" << setw(12) << "key errors" << "\n";
+
+  uint64_t errors = 0;
+
+  for (int c = 0; c < KB_CLASS_NB; ++c)
+  {
+      const KeyBenchStats& s = stats[c];
+      const double ops = double(std::max(s.moves, uint64_t(1))) * reps;
+
+      errors += s.mismatches;
+      cerr << setw(20) << KeyBenchNames[c] << setw(10) << s.moves << fixed << setprecision(1)
+           << setw(14) << s.doUndoNs / ops << setw(14) << s.keyAfterNs / ops
+           << setw(13) << 100.0 * (s.moves - s.keyAfterMisses) / std::max(s.moves, uint64_t(1)) << '%'
+           << setw(12) << s.mismatches << "\n";
+  }
+
+  cerr << (errors ? "\nIncremental keys DO NOT match set_state()" : "\nAll incremental keys match set_state()")
+       << endl;
+}
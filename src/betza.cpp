@@ -4,197 +4,451 @@
   Implementation of minimal Betza notation support
 */
 
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
 #include "betza.h"
 #include "bitboard.h"
+#include "misc.h"
+#include "position.h"
 
 BetzaManager betzaManager; // Global instance
 
+namespace {
+
+  // Basic atoms given by their canonical offset (x >= y). Compound atoms are
+  // split into their components, and riders get range 0 (unlimited).
+  struct Atom {
+    char letter;
+    int x, y;
+    int range;
+  };
+
+  const Atom Atoms[] = {
+    { 'W', 1, 0, 1 }, { 'F', 1, 1, 1 }, { 'D', 2, 0, 1 }, { 'N', 2, 1, 1 },
+    { 'A', 2, 2, 1 }, { 'H', 3, 0, 1 }, { 'C', 3, 1, 1 }, { 'L', 3, 1, 1 },
+    { 'Z', 3, 2, 1 }, { 'G', 3, 3, 1 },
+    { 'K', 1, 0, 1 }, { 'K', 1, 1, 1 },
+    { 'R', 1, 0, 0 }, { 'B', 1, 1, 0 },
+    { 'Q', 1, 0, 0 }, { 'Q', 1, 1, 0 }
+  };
+
+  // parse_directions() splits the directional modifiers of an atom into
+  // tokens. Two letters on different axes (like "fr" or "fs") restrict to
+  // their intersection, a doubled letter (like "ff") selects the narrow moves
+  // of an oblique atom, and separate tokens are combined.
+  std::vector<std::string> parse_directions(const std::string& dirs) {
+
+    auto combinable = [](char a, char b) {
+        return   (a == b && strchr("fblr", a))
+              || (strchr("fb", a) && strchr("lrs", b))
+              || (strchr("lr", a) && strchr("fbv", b))
+              || (strchr("sv", a) && strchr(a == 's' ? "fb" : "lr", b));
+    };
+
+    std::vector<std::string> tokens;
+
+    for (size_t i = 0; i < dirs.size(); ++i)
+        if (i + 1 < dirs.size() && combinable(dirs[i], dirs[i + 1]))
+        {
+            tokens.push_back(dirs.substr(i, 2));
+            ++i;
+        }
+        else
+            tokens.push_back(dirs.substr(i, 1));
+
+    return tokens;
+  }
+
+  bool matches(char d, int x, int y) {
+    switch (d)
+    {
+    case 'f': return y > 0;
+    case 'b': return y < 0;
+    case 'l': return x < 0;
+    case 'r': return x > 0;
+    case 'v': return x == 0 || abs(y) > abs(x);
+    case 's': return y == 0 || abs(x) > abs(y);
+    default : return false;
+    }
+  }
+
+  bool matches(const std::string& token, int x, int y) {
+
+    if (token.size() == 1)
+        return matches(token[0], x, y);
+
+    if (token[0] == token[1])
+        return matches(token[0], x, y) && matches(token[0] == 'f' || token[0] == 'b' ? 'v' : 's', x, y);
+
+    return matches(token[0], x, y) && matches(token[1], x, y);
+  }
+
+  // blockers() returns the squares a lame or jumping step from 's' needs to be
+  // respectively empty or occupied. Straight steps pass all the squares in
+  // between, oblique steps pass the orthogonal neighbour on their long side.
+  Bitboard blockers(Square s, int df, int dr) {
+
+    Bitboard b = 0;
+    int adf = abs(df), adr = abs(dr);
+    int sf = (df > 0) - (df < 0), sr = (dr > 0) - (dr < 0);
+
+    if (!adf || !adr || adf == adr)
+        for (int k = 1; k < std::max(adf, adr); ++k)
+            b |= make_square(File(file_of(s) + k * sf), Rank(rank_of(s) + k * sr));
+    else
+        b |= adf > adr ? make_square(File(file_of(s) + sf), rank_of(s))
+                       : make_square(file_of(s), Rank(rank_of(s) + sr));
+
+    return b;
+  }
+
+  // is_fast() tells whether a step can be looked up in the precomputed tables
+  bool is_fast(const BetzaStep& st) {
+
+    if (st.range == 1)
+        return !(st.modes & (BETZA_LAME | BETZA_JUMP)) || (abs(st.fileOffset) <= 1 && abs(st.rankOffset) <= 1);
+
+    return abs(st.fileOffset) <= 1 && abs(st.rankOffset) <= 1 && !(st.modes & BETZA_JUMP);
+  }
+
+  std::map<std::string, std::shared_ptr<const BetzaPattern>> PatternCache;
+  std::mutex PatternMutex;
+
+} // namespace
+
+
 void BetzaManager::init() {
-    customPieces.clear();
-    
+    auto t = std::make_shared<BetzaTables>();
+
     // Add some common Betza pieces as examples
-    addCustomPiece(CUSTOM_PIECE_1, "N", "Knight-like");
-    addCustomPiece(CUSTOM_PIECE_2, "K", "King-like"); 
-    addCustomPiece(CUSTOM_PIECE_3, "R", "Rook-like");
-    addCustomPiece(CUSTOM_PIECE_4, "B", "Bishop-like");
-    addCustomPiece(CUSTOM_PIECE_5, "Q", "Queen-like");
-    addCustomPiece(CUSTOM_PIECE_6, "mWcF", "Pawn-like");
-    addCustomPiece(CUSTOM_PIECE_7, "WF", "Wazir-Ferz");
-    addCustomPiece(CUSTOM_PIECE_8, "RN", "Amazon-like");
-    addCustomPiece(CUSTOM_PIECE_9, "HW", "Three-Leaper-Wazir");
+    add(*t, CUSTOM_PIECE_1, "N", "Knight-like");
+    add(*t, CUSTOM_PIECE_2, "K", "King-like");
+    add(*t, CUSTOM_PIECE_3, "R", "Rook-like");
+    add(*t, CUSTOM_PIECE_4, "B", "Bishop-like");
+    add(*t, CUSTOM_PIECE_5, "Q", "Queen-like");
+    add(*t, CUSTOM_PIECE_6, "mfWcfF", "Pawn-like");
+    add(*t, CUSTOM_PIECE_7, "WF", "Wazir-Ferz");
+    add(*t, CUSTOM_PIECE_8, "RN", "Amazon-like");
+    add(*t, CUSTOM_PIECE_9, "HW", "Three-Leaper-Wazir");
+
+    publish(t);
 }
 
-void BetzaManager::addCustomPiece(PieceType pt, const std::string& notation, const std::string& name) {
-    if (!is_custom(pt)) return;
-    
-    BetzaPiece piece;
-    piece.name = name.empty() ? ("Custom" + std::to_string(pt - CUSTOM_PIECES + 1)) : name;
-    
-    // Simple pattern parsing - just handle basic atoms for now
-    if (notation == "N") {
-        BetzaPattern pattern;
-        pattern.notation = "N";
-        pattern.offsets = {{2,1}, {2,-1}, {-2,1}, {-2,-1}, {1,2}, {1,-2}, {-1,2}, {-1,-2}};
-        pattern.isRider = false;
-        pattern.captureOnly = false;
-        pattern.quietOnly = false;
-        piece.patterns.push_back(pattern);
-    }
-    else if (notation == "K") {
-        BetzaPattern pattern;
-        pattern.notation = "K";
-        pattern.offsets = {{1,0}, {-1,0}, {0,1}, {0,-1}, {1,1}, {1,-1}, {-1,1}, {-1,-1}};
-        pattern.isRider = false;
-        pattern.captureOnly = false;
-        pattern.quietOnly = false;
-        piece.patterns.push_back(pattern);
-    }
-    else if (notation == "R") {
-        BetzaPattern pattern;
-        pattern.notation = "R";
-        pattern.offsets = {{1,0}, {-1,0}, {0,1}, {0,-1}};
-        pattern.isRider = true;
-        pattern.captureOnly = false;
-        pattern.quietOnly = false;
-        piece.patterns.push_back(pattern);
-    }
-    else if (notation == "B") {
-        BetzaPattern pattern;
-        pattern.notation = "B";
-        pattern.offsets = {{1,1}, {1,-1}, {-1,1}, {-1,-1}};
-        pattern.isRider = true;
-        pattern.captureOnly = false;
-        pattern.quietOnly = false;
-        piece.patterns.push_back(pattern);
-    }
-    else if (notation == "Q") {
-        BetzaPattern pattern;
-        pattern.notation = "Q";
-        pattern.offsets = {{1,0}, {-1,0}, {0,1}, {0,-1}, {1,1}, {1,-1}, {-1,1}, {-1,-1}};
-        pattern.isRider = true;
-        pattern.captureOnly = false;
-        pattern.quietOnly = false;
-        piece.patterns.push_back(pattern);
+// load() replaces the custom pieces with the ones defined in a file, or with
+// the built-in ones for an empty name or "<empty>". Each line gives the number
+// of a custom piece (1 to 16), its Betza notation and an optional name, and
+// '#' starts a comment. On error the current pieces are kept. It must be
+// called between searches.
+bool BetzaManager::load(const std::string& fileName) {
+
+    if (fileName.empty() || fileName == "<empty>")
+    {
+        init();
+        return true;
     }
-    else if (notation == "WF") {
-        BetzaPattern pattern;
-        pattern.notation = "WF";
-        pattern.offsets = {{1,0}, {-1,0}, {0,1}, {0,-1}, {1,1}, {1,-1}, {-1,1}, {-1,-1}};
-        pattern.isRider = false;
-        pattern.captureOnly = false;
-        pattern.quietOnly = false;
-        piece.patterns.push_back(pattern);
+
+    std::ifstream file(fileName);
+    if (!file.is_open())
+    {
+        sync_cout << "info string Could not open Betza file " << fileName << sync_endl;
+        return false;
     }
-    else if (notation == "mWcF") {
-        // Move like wazir, capture like ferz (pawn-like)
-        BetzaPattern movePattern;
-        movePattern.notation = "mW";
-        movePattern.offsets = {{0,1}};
-        movePattern.isRider = false;
-        movePattern.captureOnly = false;
-        movePattern.quietOnly = true;
-        piece.patterns.push_back(movePattern);
-        
-        BetzaPattern capturePattern;
-        capturePattern.notation = "cF";
-        capturePattern.offsets = {{1,1}, {-1,1}};
-        capturePattern.isRider = false;
-        capturePattern.captureOnly = true;
-        capturePattern.quietOnly = false;
-        piece.patterns.push_back(capturePattern);
+
+    auto t = std::make_shared<BetzaTables>();
+    std::string line;
+
+    for (int lineNo = 1; std::getline(file, line); ++lineNo)
+    {
+        std::istringstream ss(line.substr(0, line.find('#')));
+        std::string notation, name, word;
+        int n;
+
+        if (!(ss >> word))
+            continue;
+
+        n = std::atoi(word.c_str());
+        ss >> notation;
+        while (ss >> word)
+            name += (name.empty() ? "" : " ") + word;
+
+        if (   n < 1 || n > CUSTOM_PIECES_NB
+            || !add(*t, PieceType(CUSTOM_PIECES + n - 1), notation, name))
+        {
+            sync_cout << "info string Invalid Betza piece at " << fileName << ":" << lineNo << sync_endl;
+            return false;
+        }
     }
-    else if (notation == "RN") {
-        // Rook + Knight (Amazon-like)
-        BetzaPattern rookPattern;
-        rookPattern.notation = "R";
-        rookPattern.offsets = {{1,0}, {-1,0}, {0,1}, {0,-1}};
-        rookPattern.isRider = true;
-        rookPattern.captureOnly = false;
-        rookPattern.quietOnly = false;
-        piece.patterns.push_back(rookPattern);
-        
-        BetzaPattern knightPattern;
-        knightPattern.notation = "N";
-        knightPattern.offsets = {{2,1}, {2,-1}, {-2,1}, {-2,-1}, {1,2}, {1,-2}, {-1,2}, {-1,-2}};
-        knightPattern.isRider = false;
-        knightPattern.captureOnly = false;
-        knightPattern.quietOnly = false;
-        piece.patterns.push_back(knightPattern);
+
+    publish(t);
+
+    sync_cout << "info string Betza pieces loaded from " << fileName
+              << ", " << t->pieces.size() << " custom pieces" << sync_endl;
+    return true;
+}
+
+// publish() makes a new set of pieces the current one. The attack tables of
+// the built-in lookups are updated, and the piece types whose definition
+// changed get new hash keys, so that hash entries stored under the old rules
+// are not found any more while the ones of other positions are kept.
+void BetzaManager::publish(std::shared_ptr<BetzaTables> next) {
+
+    next->version = tables ? tables->version + 1 : 0;
+
+    for (PieceType pt = CUSTOM_PIECES; pt < CUSTOM_PIECES + CUSTOM_PIECES_NB; ++pt)
+    {
+        const BetzaAttacks& a = next->attacks[pt - CUSTOM_PIECES];
+
+        for (Color c = WHITE; c <= BLACK; ++c)
+            for (Square s = SQ_A1; s <= SQ_H8; ++s)
+            {
+                LeaperAttacks[c][pt][s] = a.leaper[c][1][s];
+                PseudoAttacks[c][pt][s] = a.leaper[c][1][s] | a.rider[c][1][s];
+            }
+
+        // At startup the keys are drawn later by Position::init()
+        if (!tables)
+            continue;
+
+        const auto& before = tables->pieces;
+        const auto& after = next->pieces;
+
+        if (   before.count(pt) != after.count(pt)
+            || (after.count(pt) && before.at(pt).pattern != after.at(pt).pattern))
+            Position::rekey(pt, (next->version << 8 | pt) * 0x9E3779B97F4A7C15ULL);
     }
-    else if (notation == "HW") {
-        // H (three-leaper) + W (wazir)
-        BetzaPattern hPattern;
-        hPattern.notation = "H";
-        hPattern.offsets = {{3,0}, {-3,0}, {0,3}, {0,-3}};
-        hPattern.isRider = false;
-        hPattern.captureOnly = false;
-        hPattern.quietOnly = false;
-        piece.patterns.push_back(hPattern);
-        
-        BetzaPattern wPattern;
-        wPattern.notation = "W";
-        wPattern.offsets = {{1,0}, {-1,0}, {0,1}, {0,-1}};
-        wPattern.isRider = false;
-        wPattern.captureOnly = false;
-        wPattern.quietOnly = false;
-        piece.patterns.push_back(wPattern);
+
+    const bool reload = bool(tables);
+    tables = next;
+
+    // The cuckoo table holds the moves and keys of the custom pieces too
+    if (reload)
+        Position::init_cuckoo();
+}
+
+// parsePattern() compiles a Betza notation string into its flat step list.
+// Every atom may be preceded by modifiers: 'm' (move only), 'c' (capture
+// only), 'n' (lame), 'j' (jumping) and the directions 'f', 'b', 'l', 'r', 'v'
+// and 's'. A doubled atom turns a leaper into a rider, a trailing number
+// limits the range. Results are cached, returns nullptr on a syntax error.
+std::shared_ptr<const BetzaPattern> BetzaManager::parsePattern(const std::string& notation) {
+
+    std::lock_guard<std::mutex> lk(PatternMutex);
+
+    auto it = PatternCache.find(notation);
+    if (it != PatternCache.end())
+        return it->second;
+
+    auto pattern = std::make_shared<BetzaPattern>();
+    pattern->notation = notation;
+    pattern->stepCount = 0;
+
+    for (size_t i = 0; i < notation.size(); )
+    {
+        std::string dirs;
+        uint8_t modes = 0, flags = 0;
+
+        for ( ; i < notation.size() && islower(notation[i]); ++i)
+            switch (notation[i])
+            {
+            case 'm': modes |= BETZA_MOVE;    break;
+            case 'c': modes |= BETZA_CAPTURE; break;
+            case 'n': flags |= BETZA_LAME;    break;
+            case 'j': flags |= BETZA_JUMP;    break;
+            case 'f': case 'b': case 'l': case 'r': case 'v': case 's':
+                dirs += notation[i];
+                break;
+            default:
+                return nullptr;
+            }
+
+        if (i == notation.size())
+            return nullptr;
+
+        char letter = notation[i++];
+        bool rider = false;
+        int range = -1;
+
+        if (i < notation.size() && notation[i] == letter)
+        {
+            rider = true;
+            ++i;
+        }
+
+        if (i < notation.size() && isdigit(notation[i]))
+        {
+            range = 0;
+            for ( ; i < notation.size() && isdigit(notation[i]); ++i)
+                range = std::min(10 * range + notation[i] - '0', 7);
+        }
+
+        modes = (modes ? modes : BETZA_MOVE | BETZA_CAPTURE) | flags;
+        std::vector<std::string> tokens = parse_directions(dirs);
+        bool found = false;
+
+        for (const Atom& atom : Atoms)
+        {
+            if (atom.letter != letter)
+                continue;
+
+            found = true;
+            int r = range >= 0 ? range : rider ? 0 : atom.range;
+
+            const int sym[][2] = { { atom.x,  atom.y }, { atom.x, -atom.y }, { -atom.x,  atom.y }, { -atom.x, -atom.y },
+                                   { atom.y,  atom.x }, { atom.y, -atom.x }, { -atom.y,  atom.x }, { -atom.y, -atom.x } };
+
+            for (const auto& o : sym)
+            {
+                bool selected = tokens.empty();
+                for (const auto& token : tokens)
+                    selected |= matches(token, o[0], o[1]);
+
+                if (!selected)
+                    continue;
+
+                // Symmetric atoms produce every offset more than once
+                BetzaStep* st = pattern->steps;
+                BetzaStep* end = st + pattern->stepCount;
+                while (   st < end
+                       && !(   st->fileOffset == o[0] && st->rankOffset == o[1] && st->range == r
+                            && (st->modes & ~(BETZA_MOVE | BETZA_CAPTURE)) == flags))
+                    ++st;
+
+                if (st < end)
+                    st->modes |= modes;
+                else if (pattern->stepCount < MAX_BETZA_STEPS)
+                    pattern->steps[pattern->stepCount++] = { int8_t(o[0]), int8_t(o[1]), uint8_t(r), modes };
+                else
+                    return nullptr;
+            }
+        }
+
+        if (!found)
+            return nullptr;
     }
-    
-    customPieces[pt] = piece;
+
+    return PatternCache[notation] = pattern;
+}
+
+// addCustomPiece() publishes a copy of the current pieces with one piece
+// added or replaced. Like load(), it must be called between searches.
+bool BetzaManager::addCustomPiece(PieceType pt, const std::string& notation, const std::string& name) {
+    auto t = std::make_shared<BetzaTables>(*tables);
+
+    if (!add(*t, pt, notation, name))
+        return false;
+
+    publish(t);
+    return true;
 }
 
-Bitboard BetzaManager::getAttacks(PieceType pt, Square from, Bitboard occupied, bool capturesOnly) const {
-    auto it = customPieces.find(pt);
-    if (it == customPieces.end()) return 0;
+bool BetzaManager::add(BetzaTables& t, PieceType pt, const std::string& notation, const std::string& name) {
+    if (!is_custom(pt)) return false;
     
-    Bitboard attacks = 0;
-    const BetzaPiece& piece = it->second;
+    std::shared_ptr<const BetzaPattern> pattern = parsePattern(notation);
+    if (!pattern) return false;
+
+    BetzaPiece piece;
+    piece.name = name.empty() ? ("Custom" + std::to_string(pt - CUSTOM_PIECES + 1)) : name;
+    piece.pattern = pattern;
     
-    for (const auto& pattern : piece.patterns) {
-        if (capturesOnly && pattern.quietOnly) continue;
-        if (!capturesOnly && pattern.captureOnly) continue;
-        
-        for (const auto& offset : pattern.offsets) {
-            int fileOffset = offset.first;
-            int rankOffset = offset.second;
-            
-            if (pattern.isRider) {
-                // Sliding piece
-                Square to = from;
-                while (true) {
-                    int newSquare = to + fileOffset + 8 * rankOffset;
-                    if (newSquare < SQ_A1 || newSquare > SQ_H8) break;
-                    to = Square(newSquare);
-                    
-                    // Check if we wrapped around the board
-                    if (abs(file_of(to) - file_of(Square(newSquare - fileOffset - 8 * rankOffset))) != abs(fileOffset)) break;
-                    
-                    attacks |= SquareBB[to];
-                    
-                    if (occupied & SquareBB[to]) break; // Blocked
-                }
-            } else {
-                // Leaping piece
-                int newSquare = from + fileOffset + 8 * rankOffset;
-                if (newSquare >= SQ_A1 && newSquare <= SQ_H8) {
-                    Square to = Square(newSquare);
-                    if (abs(file_of(to) - file_of(from)) == abs(fileOffset) &&
-                        abs(rank_of(to) - rank_of(from)) == abs(rankOffset)) {
-                        attacks |= SquareBB[to];
-                    }
+    t.pieces[pt] = piece;
+    compile(t, pt, *pattern);
+    return true;
+}
+
+// compile() turns the steps of a pattern into the attack tables of a piece.
+// Offsets are given from white's point of view and are mirrored for black,
+// like the step tables of the built-in pieces in Bitboards::init().
+void BetzaManager::compile(BetzaTables& t, PieceType pt, const BetzaPattern& pattern) {
+    BetzaAttacks& a = t.attacks[pt - CUSTOM_PIECES];
+    std::memset(&a, 0, sizeof(a));
+    t.slowTypes &= ~(1ULL << pt);
+
+    for (int i = 0; i < pattern.stepCount; ++i)
+    {
+        const BetzaStep& st = pattern.steps[i];
+
+        if (!is_fast(st))
+        {
+            a.slow[a.slowCount++] = st;
+            continue;
+        }
+
+        for (Color c = WHITE; c <= BLACK; ++c)
+            for (Square s = SQ_A1; s <= SQ_H8; ++s)
+            {
+                int df = c == WHITE ? st.fileOffset : -st.fileOffset;
+                int dr = c == WHITE ? st.rankOffset : -st.rankOffset;
+                int range = st.range ? st.range : 7;
+
+                Bitboard b = 0;
+                for (int k = 0, f = file_of(s) + df, r = rank_of(s) + dr;
+                     k < range && f >= FILE_A && f <= FILE_H && r >= RANK_1 && r <= RANK_8;
+                     ++k, f += df, r += dr)
+                    b |= make_square(File(f), Rank(r));
+
+                for (int capturesOnly = 0; capturesOnly < 2; ++capturesOnly)
+                {
+                    if (!(st.modes & (capturesOnly ? BETZA_CAPTURE : BETZA_MOVE)))
+                        continue;
+
+                    if (st.range == 1)
+                        a.leaper[c][capturesOnly][s] |= b;
+                    else
+                        a.rider[c][capturesOnly][s] |= b;
                 }
             }
+    }
+
+    if (a.slowCount)
+        t.slowTypes |= 1ULL << pt;
+}
+
+// slowAttacks() walks the steps that depend on more than the first blocker
+// of a ray: lame and jumping leaps and oblique riders like the nightrider.
+Bitboard BetzaManager::slowAttacks(const BetzaAttacks& a, Color c, Square from, Bitboard occupied, bool capturesOnly) {
+
+    Bitboard attack = 0;
+
+    for (int i = 0; i < a.slowCount; ++i)
+    {
+        const BetzaStep& st = a.slow[i];
+
+        if (!(st.modes & (capturesOnly ? BETZA_CAPTURE : BETZA_MOVE)))
+            continue;
+
+        int df = c == WHITE ? st.fileOffset : -st.fileOffset;
+        int dr = c == WHITE ? st.rankOffset : -st.rankOffset;
+        int range = st.range ? st.range : 7;
+        Square s = from;
+
+        for (int k = 0, f = file_of(s) + df, r = rank_of(s) + dr;
+             k < range && f >= FILE_A && f <= FILE_H && r >= RANK_1 && r <= RANK_8;
+             ++k, f += df, r += dr)
+        {
+            Bitboard b = blockers(s, df, dr);
+
+            if (   ((st.modes & BETZA_LAME) && (occupied & b))
+                || ((st.modes & BETZA_JUMP) && !(occupied & b)))
+                break;
+
+            s = make_square(File(f), Rank(r));
+            attack |= s;
+
+            if (occupied & s)
+                break;
         }
     }
-    
-    return attacks;
+
+    return attack;
 }
 
 bool BetzaManager::isCustomPiece(PieceType pt) const {
-    return customPieces.find(pt) != customPieces.end();
+    return tables->pieces.count(pt);
 }
-
-// Global helper function
-Bitboard attacks_from_betza(Color c, PieceType pt, Square from, Bitboard occupied) {
-    return betzaManager.getAttacks(pt, from, occupied);
-}
\ No newline at end of file
@@ -7,43 +7,109 @@
 #ifndef BETZA_H_INCLUDED
 #define BETZA_H_INCLUDED
 
-#include <string>
+#include <cstdint>
 #include <map>
-#include <vector>
+#include <memory>
+#include <string>
+#include "bitboard.h"
 #include "types.h"
 
-// Simple Betza move pattern structure
+const int MAX_BETZA_STEPS = 64;
+
+// Move modes of a step, the lame and jump flags require the squares between
+// origin and target to be respectively empty or occupied.
+enum BetzaMode : uint8_t {
+    BETZA_MOVE = 1, BETZA_CAPTURE = 2, BETZA_LAME = 4, BETZA_JUMP = 8
+};
+
+// A single leap or ride, given from white's point of view
+struct BetzaStep {
+    int8_t fileOffset, rankOffset;
+    uint8_t range; // 1 for leapers, 0 for unlimited riders
+    uint8_t modes;
+};
+
+// Compiled form of a Betza notation string. It is immutable once parsed and
+// shared between all pieces (and engine instances) using the same notation.
 struct BetzaPattern {
     std::string notation;
-    std::vector<std::pair<int, int>> offsets; // (file_offset, rank_offset) pairs
-    bool isRider;  // true for sliding pieces, false for leapers
-    bool captureOnly;
-    bool quietOnly;
+    int stepCount;
+    BetzaStep steps[MAX_BETZA_STEPS];
 };
 
 // Betza piece definition
 struct BetzaPiece {
     std::string name;
-    std::vector<BetzaPattern> patterns;
+    std::shared_ptr<const BetzaPattern> pattern;
+};
+
+// Attack tables of a custom piece, built once by addCustomPiece(). Leaper
+// targets are stored directly, rider parts as empty board rays which are
+// intersected with the bishop and rook magics at lookup time, the same way
+// PseudoAttacks handles the built-in compound sliders. The capture tables
+// are also copied to PseudoAttacks and LeaperAttacks, so that attacks_bb()
+// works for custom pieces too. Lame, jumping and oblique riding steps can't
+// be tabulated and are walked at lookup time.
+struct BetzaAttacks {
+    Bitboard leaper[COLOR_NB][2][SQUARE_NB]; // [color][capturesOnly][from]
+    Bitboard rider[COLOR_NB][2][SQUARE_NB];
+    int slowCount;
+    BetzaStep slow[MAX_BETZA_STEPS];
+};
+
+// The custom pieces of a variant and their attack tables. A set is immutable
+// once published: load() builds a new one aside and swaps it in between two
+// searches, so that the searches read the current set without locking.
+struct BetzaTables {
+    std::map<PieceType, BetzaPiece> pieces;
+    BetzaAttacks attacks[CUSTOM_PIECES_NB];
+    uint64_t slowTypes; // Piece types with steps not covered by the tables
+    uint64_t version;   // Incremented by every published set
 };
 
 // Betza notation manager
 class BetzaManager {
 public:
     void init();
-    void addCustomPiece(PieceType pt, const std::string& notation, const std::string& name = "");
-    Bitboard getAttacks(PieceType pt, Square from, Bitboard occupied, bool capturesOnly = false) const;
+    bool load(const std::string& fileName);
+    bool addCustomPiece(PieceType pt, const std::string& notation, const std::string& name = "");
+    Bitboard getAttacks(Color c, PieceType pt, Square from, Bitboard occupied, bool capturesOnly = false) const;
     bool isCustomPiece(PieceType pt) const;
+    uint64_t slowPieceTypes() const { return tables->slowTypes; }
+    uint64_t version() const { return tables->version; }
+
+    static std::shared_ptr<const BetzaPattern> parsePattern(const std::string& notation);
     
 private:
-    std::map<PieceType, BetzaPiece> customPieces;
-    BetzaPattern parsePattern(const std::string& pattern);
-    std::vector<std::pair<int, int>> getAtomOffsets(char atom);
+    std::shared_ptr<const BetzaTables> tables;
+    void publish(std::shared_ptr<BetzaTables> next);
+    static bool add(BetzaTables& t, PieceType pt, const std::string& notation, const std::string& name);
+    static void compile(BetzaTables& t, PieceType pt, const BetzaPattern& pattern);
+    static Bitboard slowAttacks(const BetzaAttacks& a, Color c, Square from, Bitboard occupied, bool capturesOnly);
 };
 
 extern BetzaManager betzaManager;
 
-// Helper function for move generation
-Bitboard attacks_from_betza(Color c, PieceType pt, Square from, Bitboard occupied = 0);
+inline Bitboard BetzaManager::getAttacks(Color c, PieceType pt, Square from, Bitboard occupied, bool capturesOnly) const {
+    if (!is_custom(pt)) return 0;
+
+    const BetzaAttacks& a = tables->attacks[pt - CUSTOM_PIECES];
+    Bitboard b = a.leaper[c][capturesOnly][from];
+
+    if (a.rider[c][capturesOnly][from])
+        b |= a.rider[c][capturesOnly][from] & (attacks_bb<BISHOP>(from, occupied) | attacks_bb<ROOK>(from, occupied));
+
+    if (a.slowCount)
+        b |= slowAttacks(a, c, from, occupied, capturesOnly);
+
+    return b;
+}
+
+// Helper function for move generation. By default it returns the squares a
+// piece attacks, i.e. can capture on, pass capturesOnly = false to get the
+// targets of its non-capturing moves instead.
+inline Bitboard attacks_from_betza(Color c, PieceType pt, Square from, Bitboard occupied, bool capturesOnly = true) {
+    return betzaManager.getAttacks(c, pt, from, occupied, capturesOnly);
+}
 
-#endif // #ifndef BETZA_H_INCLUDED
\ No newline at end of file
+#endif // #ifndef BETZA_H_INCLUDED
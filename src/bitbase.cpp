@@ -20,12 +20,28 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
 #include <numeric>
 #include <vector>
 
 #include "bitboard.h"
+#include "misc.h"
 #include "types.h"
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
 namespace {
 
   // There are 24 possible pawn squares: the first 4 files and ranks from 2 to 7
@@ -34,6 +50,11 @@ namespace {
   // Each uint32_t stores results of 32 positions, one per bit
   uint32_t KPKBitbase[MAX_INDEX / 32];
 
+  // The KPK bitbase is computed on the first probe, as most games never get
+  // there and the retrograde analysis is the most expensive part of startup.
+  std::once_flag KPKInit;
+  void init_kpk();
+
   // A KPK bitbase index is an integer in [0, IndexMax] range
   //
   // Information is mapped in a way that minimizes the number of iterations:
@@ -70,6 +91,158 @@ namespace {
     Result result;
   };
 
+  // The fairy bitbases hold K and a piece of one of the Musketeer types against
+  // a lone king, for all placements and both sides to move, one bit per
+  // position. They are generated with the "bitbases" command and mapped from
+  // the files found in the BitbasePath directory.
+  constexpr PieceType FirstFairy = CANNON, LastFairy = FORTRESS;
+  constexpr unsigned KXK_INDEX = 2*64*64*64; // stm * xsq * bksq * wksq = 524288
+  constexpr size_t HeaderSize = 16;
+
+  // A KXK bitbase index is laid out as the KPK one, with the square of the
+  // piece in place of the pawn file and rank.
+  unsigned index(Color us, Square bksq, Square wksq, Square xsq, PieceType) {
+    return wksq | (bksq << 6) | (xsq << 12) | (us << 18);
+  }
+
+  struct KXKPosition {
+    KXKPosition() = default;
+    KXKPosition(PieceType pt, unsigned idx);
+    operator Result() const { return result; }
+    Result classify(const std::vector<KXKPosition>& db)
+    { return us == WHITE ? classify<WHITE>(db) : classify<BLACK>(db); }
+
+    template<Color Us> Result classify(const std::vector<KXKPosition>& db);
+
+    PieceType pt;
+    Color us;
+    Square ksq[COLOR_NB], xsq;
+    Result result;
+  };
+
+  struct FairyBitbase {
+    const uint8_t* data = nullptr; // Past the header
+    void* baseAddress = nullptr;
+    uint64_t mapping = 0;
+  };
+
+  FairyBitbase FairyBitbases[PIECE_TYPE_NB];
+
+  // A file starts with a header that identifies the bitbase and the moves of
+  // the piece it was generated for, so that a file left over from a different
+  // piece definition is not used.
+  void make_header(PieceType pt, uint8_t* header) {
+
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a of the attack tables
+    for (Square s = SQ_A1; s <= SQ_H8; ++s)
+        for (Bitboard b : { PseudoAttacks[WHITE][pt][s], LeaperAttacks[WHITE][pt][s] })
+            hash = (hash ^ b) * 1099511628211ULL;
+
+    std::memcpy(header, "MBB1", 4);
+    header[4] = uint8_t(pt);
+    header[5] = header[6] = header[7] = 0;
+
+    for (int i = 0; i < 8; ++i)
+        header[8 + i] = uint8_t(hash >> (8 * i));
+  }
+
+  std::string file_name(const std::string& dir, PieceType pt) {
+    return dir + "/K" + PieceToChar[pt] + "K.mbb";
+  }
+
+  void unmap(FairyBitbase& bb) {
+
+    if (bb.baseAddress)
+    {
+#ifndef _WIN32
+        munmap(bb.baseAddress, bb.mapping);
+#else
+        UnmapViewOfFile(bb.baseAddress);
+        CloseHandle((HANDLE)bb.mapping);
+#endif
+    }
+    bb = FairyBitbase();
+  }
+
+  // Memory map a bitbase file and check its header and size. Returns false,
+  // leaving the bitbase unmapped, if the file is missing or does not match.
+  bool map(const std::string& fname, PieceType pt, FairyBitbase& bb) {
+
+    const size_t size = HeaderSize + KXK_INDEX / 8;
+
+#ifndef _WIN32
+    struct stat statbuf;
+    int fd = ::open(fname.c_str(), O_RDONLY);
+
+    if (fd == -1)
+        return false;
+
+    fstat(fd, &statbuf);
+    void* mem = size_t(statbuf.st_size) == size ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0)
+                                                : MAP_FAILED;
+    ::close(fd);
+
+    if (mem == MAP_FAILED)
+        return false;
+
+    bb.baseAddress = mem, bb.mapping = size;
+#else
+    HANDLE fd = CreateFile(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (fd == INVALID_HANDLE_VALUE)
+        return false;
+
+    DWORD sizeHigh, sizeLow = GetFileSize(fd, &sizeHigh);
+    HANDLE mmap = !sizeHigh && sizeLow == size ? CreateFileMapping(fd, nullptr, PAGE_READONLY, 0, 0, nullptr)
+                                               : nullptr;
+    CloseHandle(fd);
+
+    if (!mmap)
+        return false;
+
+    bb.mapping = (uint64_t)mmap;
+    if (!(bb.baseAddress = MapViewOfFile(mmap, FILE_MAP_READ, 0, 0, 0)))
+    {
+        CloseHandle(mmap);
+        return bb = FairyBitbase(), false;
+    }
+#endif
+
+    uint8_t header[HeaderSize];
+    make_header(pt, header);
+
+    if (std::memcmp(bb.baseAddress, header, HeaderSize))
+    {
+        sync_cout << "info string Bitbase " << fname << " does not match the "
+                  << PieceToChar[pt] << " piece, ignored" << sync_endl;
+        unmap(bb);
+        return false;
+    }
+
+    bb.data = (const uint8_t*)bb.baseAddress + HeaderSize;
+    return true;
+  }
+
+  // Classify all the positions of a KXK bitbase, bit-packed into 'bits'
+  void generate_kxk(PieceType pt, std::vector<uint8_t>& bits) {
+
+    std::vector<KXKPosition> db(KXK_INDEX);
+    unsigned idx, repeat = 1;
+
+    for (idx = 0; idx < KXK_INDEX; ++idx)
+        db[idx] = KXKPosition(pt, idx);
+
+    while (repeat)
+        for (repeat = idx = 0; idx < KXK_INDEX; ++idx)
+            repeat |= (db[idx] == UNKNOWN && db[idx].classify(db) != UNKNOWN);
+
+    bits.assign(KXK_INDEX / 8, 0);
+    for (idx = 0; idx < KXK_INDEX; ++idx)
+        if (db[idx] == WIN)
+            bits[idx / 8] |= 1 << (idx & 7);
+  }
+
 } // namespace
 
 
@@ -77,35 +250,103 @@ bool Bitbases::probe(Square wksq, Square wpsq, Square bksq, Color us) {
 
   assert(file_of(wpsq) <= FILE_D);
 
+  std::call_once(KPKInit, init_kpk);
+
   unsigned idx = index(us, bksq, wksq, wpsq);
   return KPKBitbase[idx / 32] & (1 << (idx & 0x1F));
 }
 
 
-void Bitbases::init() {
+/// Bitbases::probe() for a K and fairy piece against K ending tells whether the
+/// position is a win for the white side with the piece. It must only be called
+/// when available() returns true for the piece type.
 
-  std::vector<KPKPosition> db(MAX_INDEX);
-  unsigned idx, repeat = 1;
+bool Bitbases::probe(PieceType pt, Square wksq, Square xsq, Square bksq, Color us) {
 
-  // Initialize db with known win / draw positions
-  for (idx = 0; idx < MAX_INDEX; ++idx)
-      db[idx] = KPKPosition(idx);
+  assert(available(pt));
 
-  // Iterate through the positions until none of the unknown positions can be
-  // changed to either wins or draws (15 cycles needed).
-  while (repeat)
-      for (repeat = idx = 0; idx < MAX_INDEX; ++idx)
-          repeat |= (db[idx] == UNKNOWN && db[idx].classify(db) != UNKNOWN);
+  unsigned idx = index(us, bksq, wksq, xsq, pt);
+  return FairyBitbases[pt].data[idx / 8] & (1 << (idx & 7));
+}
 
-  // Map 32 results into one KPKBitbase[] entry
-  for (idx = 0; idx < MAX_INDEX; ++idx)
-      if (db[idx] == WIN)
-          KPKBitbase[idx / 32] |= 1 << (idx & 0x1F);
+bool Bitbases::available(PieceType pt) {
+  return FairyBitbases[pt].data;
+}
+
+
+/// Bitbases::load() maps the fairy bitbases found in the given directory, it is
+/// called at startup and whenever the "BitbasePath" option changes.
+
+void Bitbases::load(const std::string& dir) {
+
+  int found = 0;
+
+  for (PieceType pt = FirstFairy; pt <= LastFairy; ++pt)
+  {
+      unmap(FairyBitbases[pt]);
+
+      if (!dir.empty() && dir != "<empty>")
+          found += map(file_name(dir, pt), pt, FairyBitbases[pt]);
+  }
+
+  if (found)
+      sync_cout << "info string Found " << found << " bitbases" << sync_endl;
+}
+
+
+/// Bitbases::generate() classifies the K and fairy piece against K endings of
+/// all the Musketeer piece types with the same iterative method as KPK, and
+/// writes them into the given directory. Slow, so it runs only on request.
+
+void Bitbases::generate(const std::string& dir) {
+
+  for (PieceType pt = FirstFairy; pt <= LastFairy; ++pt)
+  {
+      TimePoint start = now();
+      std::vector<uint8_t> bits;
+      uint8_t header[HeaderSize];
+
+      generate_kxk(pt, bits);
+      make_header(pt, header);
+
+      std::string fname = file_name(dir, pt);
+      std::ofstream file(fname, std::ios::binary);
+      file.write((const char*)header, HeaderSize);
+      file.write((const char*)bits.data(), bits.size());
+
+      size_t wins = 0;
+      for (uint8_t b : bits)
+          wins += popcount(b);
+
+      sync_cout << "info string " << fname << (file ? " written, " : " could not be written, ")
+                << wins << " wins, " << now() - start << " ms" << sync_endl;
+  }
 }
 
 
 namespace {
 
+  void init_kpk() {
+
+    std::vector<KPKPosition> db(MAX_INDEX);
+    unsigned idx, repeat = 1;
+
+    // Initialize db with known win / draw positions
+    for (idx = 0; idx < MAX_INDEX; ++idx)
+        db[idx] = KPKPosition(idx);
+
+    // Iterate through the positions until none of the unknown positions can be
+    // changed to either wins or draws (15 cycles needed).
+    while (repeat)
+        for (repeat = idx = 0; idx < MAX_INDEX; ++idx)
+            repeat |= (db[idx] == UNKNOWN && db[idx].classify(db) != UNKNOWN);
+
+    // Map 32 results into one KPKBitbase[] entry
+    for (idx = 0; idx < MAX_INDEX; ++idx)
+        if (db[idx] == WIN)
+            KPKBitbase[idx / 32] |= 1 << (idx & 0x1F);
+  }
+
   KPKPosition::KPKPosition(unsigned idx) {
 
     ksq[WHITE] = Square((idx >>  0) & 0x3F);
@@ -177,4 +418,74 @@ namespace {
     return result = r & Good  ? Good  : r & UNKNOWN ? UNKNOWN : Bad;
   }
 
+
+  KXKPosition::KXKPosition(PieceType p, unsigned idx) : pt(p) {
+
+    ksq[WHITE] = Square((idx >>  0) & 0x3F);
+    ksq[BLACK] = Square((idx >>  6) & 0x3F);
+    xsq        = Square((idx >> 12) & 0x3F);
+    us         = Color ((idx >> 18) & 0x01);
+
+    Bitboard occupied = SquareBB[ksq[WHITE]] | ksq[BLACK] | xsq;
+    Bitboard attacked = PseudoAttacks[WHITE][KING][ksq[WHITE]] | attacks_bb(WHITE, pt, xsq, occupied);
+
+    // Check if two pieces are on the same square or if a king can be captured
+    if (   distance(ksq[WHITE], ksq[BLACK]) <= 1
+        || ksq[WHITE] == xsq
+        || ksq[BLACK] == xsq
+        || (us == WHITE && (attacked & ksq[BLACK])))
+        result = INVALID;
+
+    // Mate or stalemate if the black king has no move. The piece, being the
+    // only slider, never blocks its own attacks on the squares behind the king.
+    else if (   us == BLACK
+             && !(PseudoAttacks[BLACK][KING][ksq[BLACK]] & ~(  PseudoAttacks[WHITE][KING][ksq[WHITE]]
+                                                            | attacks_bb(WHITE, pt, xsq, occupied ^ ksq[BLACK]))))
+        result = attacked & ksq[BLACK] ? WIN : DRAW;
+
+    // Position will be classified later
+    else
+        result = UNKNOWN;
+  }
+
+  template<Color Us>
+  Result KXKPosition::classify(const std::vector<KXKPosition>& db) {
+
+    // The same rules as for KPKPosition::classify() apply. If the black king
+    // captures the piece the position is a draw.
+
+    constexpr Color  Them = (Us == WHITE ? BLACK : WHITE);
+    constexpr Result Good = (Us == WHITE ? WIN   : DRAW);
+    constexpr Result Bad  = (Us == WHITE ? DRAW  : WIN);
+
+    Result r = INVALID;
+    Bitboard occupied = SquareBB[ksq[WHITE]] | ksq[BLACK] | xsq;
+    Bitboard b = PseudoAttacks[Us][KING][ksq[Us]];
+
+    if (Us == WHITE)
+    {
+        b &= ~SquareBB[xsq];
+        while (b)
+            r |= db[index(Them, ksq[Them], pop_lsb(&b), xsq, pt)];
+
+        b = attacks_bb(WHITE, pt, xsq, occupied) & ~occupied;
+        while (b)
+            r |= db[index(Them, ksq[Them], ksq[Us], pop_lsb(&b), pt)];
+    }
+    else
+    {
+        // Squares attacked by white are excluded, the king never moves into check
+        b &= ~(  PseudoAttacks[WHITE][KING][ksq[WHITE]]
+               | attacks_bb(WHITE, pt, xsq, occupied ^ ksq[BLACK]));
+
+        if (b & xsq)
+            return result = DRAW;
+
+        while (b)
+            r |= db[index(Them, pop_lsb(&b), ksq[Them], xsq, pt)];
+    }
+
+    return result = r & Good  ? Good  : r & UNKNOWN ? UNKNOWN : Bad;
+  }
+
 } // namespace
@@ -37,8 +37,8 @@ Bitboard DistanceRingBB[SQUARE_NB][8];
 Bitboard ForwardFileBB[COLOR_NB][SQUARE_NB];
 Bitboard PassedPawnMask[COLOR_NB][SQUARE_NB];
 Bitboard PawnAttackSpan[COLOR_NB][SQUARE_NB];
-Bitboard PseudoAttacks[COLOR_NB][PIECE_TYPE_NB][SQUARE_NB];
-Bitboard LeaperAttacks[COLOR_NB][PIECE_TYPE_NB][SQUARE_NB];
+Bitboard PseudoAttacks[COLOR_NB][PIECE_TYPE_USED][SQUARE_NB];
+Bitboard LeaperAttacks[COLOR_NB][PIECE_TYPE_USED][SQUARE_NB];
 
 Magic RookMagics[SQUARE_NB];
 Magic BishopMagics[SQUARE_NB];
@@ -48,7 +48,49 @@ namespace {
   Bitboard RookTable[0x19000];  // To store rook attacks
   Bitboard BishopTable[0x1480]; // To store bishop attacks
 
-  void init_magics(Bitboard table[], Magic magics[], Direction directions[]);
+  // Magic numbers found by init_magics() for 64 bit builds with seeds[1].
+  // Using them directly saves the search at startup, and they are checked
+  // against the reference attacks in debug builds. Squares of a rank share
+  // a seed, so the same number can turn up for neighbouring squares.
+  constexpr Bitboard RookMagicNumbers[SQUARE_NB] = {
+    0x0A80004000801220ULL, 0x8040004010002008ULL, 0x2080200010008008ULL, 0x1100100008210004ULL,
+    0xC200209084020008ULL, 0x2100010004000208ULL, 0x0400081000822421ULL, 0x0200010422048844ULL,
+    0x0800800080400024ULL, 0x0001402000401000ULL, 0x3000801000802001ULL, 0x4400800800100083ULL,
+    0x0904802402480080ULL, 0x4040800400020080ULL, 0x0018808042000100ULL, 0x4040800080004100ULL,
+    0x0040048001458024ULL, 0x00A0004000205000ULL, 0x3100808010002000ULL, 0x4825010010000820ULL,
+    0x5004808008000401ULL, 0x2024818004000A00ULL, 0x0005808002000100ULL, 0x2100060004806104ULL,
+    0x0080400880008421ULL, 0x4062220600410280ULL, 0x010A004A00108022ULL, 0x0000100080080080ULL,
+    0x0021000500080010ULL, 0x0044000202001008ULL, 0x0000100400080102ULL, 0xC020128200040545ULL,
+    0x0080002000400040ULL, 0x0000804000802004ULL, 0x0000120022004080ULL, 0x010A386103001001ULL,
+    0x9010080080800400ULL, 0x8440020080800400ULL, 0x0004228824001001ULL, 0x000000490A000084ULL,
+    0x0080002000504000ULL, 0x200020005000C000ULL, 0x0012088020420010ULL, 0x0010010080080800ULL,
+    0x0085001008010004ULL, 0x0002000204008080ULL, 0x0040413002040008ULL, 0x0000304081020004ULL,
+    0x0080204000800080ULL, 0x3008804000290100ULL, 0x1010100080200080ULL, 0x2008100208028080ULL,
+    0x5000850800910100ULL, 0x8402019004680200ULL, 0x0120911028020400ULL, 0x0000008044010200ULL,
+    0x0020850200244012ULL, 0x0020850200244012ULL, 0x0000102001040841ULL, 0x140900040A100021ULL,
+    0x000200282410A102ULL, 0x000200282410A102ULL, 0x000200282410A102ULL, 0x4048240043802106ULL
+  };
+
+  constexpr Bitboard BishopMagicNumbers[SQUARE_NB] = {
+    0x40106000A1160020ULL, 0x0020010250810120ULL, 0x2010010220280081ULL, 0x002806004050C040ULL,
+    0x0002021018000000ULL, 0x2001112010000400ULL, 0x0881010120218080ULL, 0x1030820110010500ULL,
+    0x0000120222042400ULL, 0x2000020404040044ULL, 0x8000480094208000ULL, 0x0003422A02000001ULL,
+    0x000A220210100040ULL, 0x8004820202226000ULL, 0x0018234854100800ULL, 0x0100004042101040ULL,
+    0x0004001004082820ULL, 0x0010000810010048ULL, 0x1014004208081300ULL, 0x2080818802044202ULL,
+    0x0040880C00A00100ULL, 0x0080400200522010ULL, 0x0001000188180B04ULL, 0x0080249202020204ULL,
+    0x1004400004100410ULL, 0x00013100A0022206ULL, 0x2148500001040080ULL, 0x4241080011004300ULL,
+    0x4020848004002000ULL, 0x10101380D1004100ULL, 0x0008004422020284ULL, 0x01010A1041008080ULL,
+    0x0808080400082121ULL, 0x0808080400082121ULL, 0x0091128200100C00ULL, 0x0202200802010104ULL,
+    0x8C0A020200440085ULL, 0x01A0008080B10040ULL, 0x0889520080122800ULL, 0x100902022202010AULL,
+    0x04081A0816002000ULL, 0x0000681208005000ULL, 0x8170840041008802ULL, 0x0A00004200810805ULL,
+    0x0830404408210100ULL, 0x2602208106006102ULL, 0x1048300680802628ULL, 0x2602208106006102ULL,
+    0x0602010120110040ULL, 0x0941010801043000ULL, 0x000040440A210428ULL, 0x0008240020880021ULL,
+    0x0400002012048200ULL, 0x00AC102001210220ULL, 0x0220021002009900ULL, 0x84440C080A013080ULL,
+    0x0001008044200440ULL, 0x0004C04410841000ULL, 0x2000500104011130ULL, 0x1A0C010011C20229ULL,
+    0x0044800112202200ULL, 0x0434804908100424ULL, 0x0300404822C08200ULL, 0x48081010008A2A80ULL
+  };
+
+  void init_magics(Bitboard table[], Magic magics[], Direction directions[], const Bitboard known[]);
 
   // popcount16() counts the non-zero bits using SWAR-Popcount algorithm
 
@@ -141,8 +183,8 @@ void Bitboards::init() {
   Direction RookDirections[5] = { NORTH,  EAST,  SOUTH,  WEST };
   Direction BishopDirections[5] = { NORTH_EAST, SOUTH_EAST, SOUTH_WEST, NORTH_WEST };
 
-  init_magics(RookTable, RookMagics, RookDirections);
-  init_magics(BishopTable, BishopMagics, BishopDirections);
+  init_magics(RookTable, RookMagics, RookDirections, RookMagicNumbers);
+  init_magics(BishopTable, BishopMagics, BishopDirections, BishopMagicNumbers);
 
   int steps[][17] = {
     {}, // NO_PIECE_TYPE
@@ -210,24 +252,29 @@ void Bitboards::init() {
 
   for (Color c = WHITE; c <= BLACK; ++c)
       for (PieceType pt = PAWN; pt <= KING; ++pt)
+      {
+          // Custom pieces are compiled from their Betza notation, and the king
+          // uses the row right after the last built-in piece in the tables.
+          if (is_custom(pt))
+              continue;
+
+          int idx = pt == KING ? FORTRESS + 1 : pt;
+
           for (Square s = SQ_A1; s <= SQ_H8; ++s)
           {
-              // Only process standard pieces that have entries in the arrays
-              if (pt >= NO_PIECE_TYPE && pt <= KING && pt < 17)
+              for (int i = 0; i < 16 && steps[idx][i]; ++i)
               {
-                  for (int i = 0; i < 16 && steps[pt][i]; ++i)
-                  {
-                      Square to = s + Direction(c == WHITE ? steps[pt][i] : -steps[pt][i]);
+                  Square to = s + Direction(c == WHITE ? steps[idx][i] : -steps[idx][i]);
 
-                      if (is_ok(to) && distance(s, to) < 4)
-                      {
-                          PseudoAttacks[c][pt][s] |= to;
-                          LeaperAttacks[c][pt][s] |= to;
-                      }
+                  if (is_ok(to) && distance(s, to) < 4)
+                  {
+                      PseudoAttacks[c][pt][s] |= to;
+                      LeaperAttacks[c][pt][s] |= to;
                   }
-                  PseudoAttacks[c][pt][s] |= sliding_attack(slider[pt], s, 0, slider_dist[pt]);
               }
+              PseudoAttacks[c][pt][s] |= sliding_attack(slider[idx], s, 0, slider_dist[idx]);
           }
+      }
 
   for (Square s1 = SQ_A1; s1 <= SQ_H8; ++s1)
   {
@@ -249,9 +296,10 @@ namespace {
   // init_magics() computes all rook and bishop attacks at startup. Magic
   // bitboards are used to look up attacks of sliding pieces. As a reference see
   // chessprogramming.wikispaces.com/Magic+Bitboards. In particular, here we
-  // use the so called "fancy" approach.
+  // use the so called "fancy" approach. The search for the magics is only
+  // needed by 32 bit builds, 64 bit builds use the known ones.
 
-  void init_magics(Bitboard table[], Magic magics[], Direction directions[]) {
+  void init_magics(Bitboard table[], Magic magics[], Direction directions[], const Bitboard known[]) {
 
     // Optimal PRNG seeds to pick the correct magics in the shortest time
     int seeds[][RANK_NB] = { { 8977, 44560, 54343, 38998,  5731, 95205, 104912, 17020 },
@@ -288,11 +336,18 @@ namespace {
             if (HasPext)
                 m.attacks[pext(b, m.mask)] = reference[size];
 
+            else if (Is64Bit)
+            {
+                m.magic = known[s];
+                assert(!m.attacks[m.index(b)] || m.attacks[m.index(b)] == reference[size]);
+                m.attacks[m.index(b)] = reference[size];
+            }
+
             size++;
             b = (b - m.mask) & m.mask;
         } while (b);
 
-        if (HasPext)
+        if (HasPext || Is64Bit)
             continue;
 
         PRNG rng(seeds[Is64Bit][rank_of(s)]);
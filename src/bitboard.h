@@ -27,8 +27,11 @@
 
 namespace Bitbases {
 
-void init();
 bool probe(Square wksq, Square wpsq, Square bksq, Color us);
+bool probe(PieceType pt, Square wksq, Square xsq, Square bksq, Color us);
+bool available(PieceType pt);
+void load(const std::string& dir);
+void generate(const std::string& dir);
 
 }
 
@@ -73,8 +76,8 @@ extern Bitboard DistanceRingBB[SQUARE_NB][8];
 extern Bitboard ForwardFileBB[COLOR_NB][SQUARE_NB];
 extern Bitboard PassedPawnMask[COLOR_NB][SQUARE_NB];
 extern Bitboard PawnAttackSpan[COLOR_NB][SQUARE_NB];
-extern Bitboard PseudoAttacks[COLOR_NB][PIECE_TYPE_NB][SQUARE_NB];
-extern Bitboard LeaperAttacks[COLOR_NB][PIECE_TYPE_NB][SQUARE_NB];
+extern Bitboard PseudoAttacks[COLOR_NB][PIECE_TYPE_USED][SQUARE_NB];
+extern Bitboard LeaperAttacks[COLOR_NB][PIECE_TYPE_USED][SQUARE_NB];
 
 
 /// Magic holds all magic bitboards relevant data for a single square
@@ -276,6 +279,36 @@ inline Bitboard attacks_bb(Color c, PieceType pt, Square s, Bitboard occupied) {
   return LeaperAttacks[c][pt][s] | (PseudoAttacks[c][pt][s] & (attacks_bb<BISHOP>(s, occupied) | attacks_bb<ROOK>(s, occupied)));
 }
 
+/// attacks_bb() for a piece type known at compile time only probes the slider
+/// tables the piece really needs, e.g. a chancellor skips the bishop lookup
+/// and leapers don't touch the magics at all. Custom pieces have to use the
+/// generic version above.
+
+template<PieceType Pt>
+inline Bitboard attacks_bb(Color c, Square s, Bitboard occupied) {
+
+  static_assert(Pt < CUSTOM_PIECES || Pt == KING, "Only built-in piece types");
+
+  constexpr bool Diagonal   =   Pt == BISHOP || Pt == QUEEN  || Pt == LEOPARD || Pt == ARCHBISHOP
+                             || Pt == SPIDER || Pt == DRAGON || Pt == FORTRESS;
+  constexpr bool Orthogonal = Pt == ROOK || Pt == QUEEN || Pt == CHANCELLOR || Pt == DRAGON;
+  constexpr bool Limited    = Pt == LEOPARD || Pt == SPIDER || Pt == FORTRESS; // Short range sliders
+  constexpr bool Leaper     = Pt != BISHOP && Pt != ROOK && Pt != QUEEN;
+
+  Bitboard b = 0;
+
+  if (Diagonal)
+      b |= attacks_bb<BISHOP>(s, occupied);
+  if (Orthogonal)
+      b |= attacks_bb<ROOK>(s, occupied);
+  if (Limited)
+      b &= PseudoAttacks[c][Pt][s];
+  if (Leaper)
+      b |= LeaperAttacks[c][Pt][s];
+
+  return b;
+}
+
 /// popcount() counts the number of non-zero bits in a bitboard
 
 inline int popcount(Bitboard b) {
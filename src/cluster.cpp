@@ -0,0 +1,721 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2018 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef USE_CLUSTER
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include "cluster.h"
+#include "thread.h"
+#include "tt.h"
+#include "uci.h"
+
+namespace {
+
+  enum MessageType : uint32_t {
+    COMMAND,  // Root to worker: a UCI command line
+    GO,       // Root to worker: search id and the 'go' command line
+    TT_BATCH, // Both ways: a batch of Entry
+    STATS,    // Worker to root: StatsMessage, sent while searching
+    RESULT    // Worker to root: ResultMessage, sent once the search is over
+  };
+
+  struct Header {
+    uint32_t type;
+    uint32_t size; // Payload bytes following the header
+  };
+
+  // Entry is a transposition table write as sent to the other nodes
+  struct Entry {
+    Key key;
+    uint16_t move;
+    int16_t value;
+    int16_t eval;
+    int8_t depth;
+    uint8_t bound;
+  };
+
+  struct StatsMessage {
+    uint32_t id;
+    uint32_t padding;
+    uint64_t nodes;
+    uint64_t tbHits;
+  };
+
+  struct ResultMessage {
+    uint32_t id;
+    int32_t move;
+    int32_t score;
+    int32_t depth;
+    uint64_t nodes;
+    uint64_t tbHits;
+  };
+
+  constexpr int MinSaveDepth = 10;         // Shallower writes stay on their node
+  constexpr size_t BatchSize = 128;        // Entries per TT_BATCH message
+  constexpr size_t MaxQueuedBatches = 64;  // The oldest batches are dropped beyond
+  constexpr int StatsPeriod = 50;          // Milliseconds between two STATS
+  constexpr int ResultTimeout = 2000;      // Milliseconds to wait for the results
+  constexpr size_t MaxCommandSize = 65536; // Bytes of a COMMAND or GO payload
+
+  // The options a root may set on a worker, in lower case. The others, notably
+  // the ones naming files or shared memory, keep the value of the worker.
+  const std::set<std::string> SearchOptions = {
+    "contempt", "analysis contempt", "threads", "abdada", "hash", "hash format",
+    "clear hash", "pawn hash", "material hash", "eval cache", "ponder", "multipv",
+    "multipv mode", "skill level", "move overhead", "minimum thinking time",
+    "slow mover", "adaptive time", "nodestime", "uci_variant", "uci_chess960",
+    "uci_analysemode", "syzygyprobedepth", "syzygy50moverule", "syzygyprobelimit"
+  };
+
+  // forwarded() tells whether a command of the root runs on the workers. A
+  // worker accepts a connection from any peer that can reach it, so it runs
+  // only the commands that set up and drive a search.
+  bool forwarded(const std::string& cmd) {
+
+    std::istringstream is(cmd);
+    std::string token, name;
+    is >> token;
+
+    if (   token == "position" || token == "ucinewgame" || token == "go"
+        || token == "stop"     || token == "ponderhit")
+        return true;
+
+    if (token != "setoption" || !(is >> token) || token != "name")
+        return false;
+
+    while (is >> token && token != "value")
+        name += (name.empty() ? "" : " ") + token;
+
+    std::transform(name.begin(), name.end(), name.begin(), [](char c) { return char(std::tolower(c)); });
+    return SearchOptions.count(name);
+  }
+
+  // split_address() splits a [host:]port address, the host of an IPv6 address
+  // being within brackets. An address without host leaves 'host' empty.
+  void split_address(const std::string& address, std::string& host, std::string& port) {
+
+    size_t colon = address.rfind(':');
+    host = colon == std::string::npos ? "" : address.substr(0, colon);
+    port = address.substr(colon + 1);
+
+    if (host.size() > 1 && host.front() == '[' && host.back() == ']')
+        host = host.substr(1, host.size() - 2);
+  }
+
+  std::string frame(MessageType type, const void* data, size_t size) {
+
+    Header h = { type, uint32_t(size) };
+    std::string msg(reinterpret_cast<const char*>(&h), sizeof(h));
+    msg.append(static_cast<const char*>(data), size);
+    return msg;
+  }
+
+  bool send_all(int fd, const char* p, size_t n) {
+
+    for (ssize_t r; n; p += r, n -= r)
+        if ((r = ::send(fd, p, n, MSG_NOSIGNAL)) <= 0)
+            return false;
+    return true;
+  }
+
+  bool recv_all(int fd, char* p, size_t n) {
+
+    for (ssize_t r; n; p += r, n -= r)
+        if ((r = ::recv(fd, p, n, 0)) <= 0)
+            return false;
+    return true;
+  }
+
+  void handle(struct Link* link, uint32_t type, const std::string& payload);
+
+  // Link is the connection to another node. The reader thread handles the
+  // incoming messages, the writer thread sends the queued ones: the control
+  // messages before the TT batches, so that a 'stop' never waits behind them.
+  struct Link {
+
+    explicit Link(int s) : fd(s), open(true), nodes(0), tbHits(0), hasResult(false) {
+
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+      reader = std::thread(&Link::read_loop, this);
+      writer = std::thread(&Link::write_loop, this);
+    }
+
+   ~Link() {
+      close();
+      reader.join();
+      writer.join();
+      ::close(fd);
+    }
+
+    void close() {
+      std::lock_guard<std::mutex> lk(mutex);
+      open = false;
+      shutdown(fd, SHUT_RDWR);
+      cv.notify_all();
+    }
+
+    void send(const std::string& msg, bool isControl) {
+      std::lock_guard<std::mutex> lk(mutex);
+      if (isControl)
+          control.push_back(msg);
+      else
+      {
+          if (data.size() >= MaxQueuedBatches)
+              data.pop_front();
+          data.push_back(msg);
+      }
+      cv.notify_one();
+    }
+
+    void wait_closed() {
+      std::unique_lock<std::mutex> lk(mutex);
+      cv.wait(lk, [&]{ return !open; });
+    }
+
+    void read_loop();
+    void write_loop();
+
+    int fd;
+    std::atomic<bool> open;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::string> control, data;
+    std::atomic<uint64_t> nodes, tbHits; // Last counts reported by a worker
+    bool hasResult;                      // Protected by ResultMutex
+    Cluster::Result result;
+    std::thread reader, writer;
+  };
+
+  bool Worker;
+  std::vector<std::shared_ptr<Link>> Links;
+  std::atomic<int> LinkCount;
+  std::mutex LinksMutex;
+
+  std::atomic<uint32_t> SearchId;
+  std::atomic<bool> Searching; // On a worker, between GO and report()
+  std::atomic<bool> Distributed;// On the root, between start_search() and stop_search()
+
+  std::mutex ResultMutex;
+  std::condition_variable ResultCv;
+
+  std::deque<std::string> Commands; // Commands received by a worker
+  std::mutex CommandMutex;
+  std::condition_variable CommandCv;
+
+  std::vector<Entry> Pending; // TT writes of this node not sent yet
+  std::mutex PendingMutex;
+
+  void push_command(const std::string& cmd) {
+
+    std::lock_guard<std::mutex> lk(CommandMutex);
+    Commands.push_back(cmd);
+    CommandCv.notify_one();
+  }
+
+  // send_to() queues a message for all the other nodes but one
+  void send_to(const std::string& msg, bool isControl, const Link* except = nullptr) {
+
+    std::lock_guard<std::mutex> lk(LinksMutex);
+    for (auto& link : Links)
+        if (link.get() != except)
+            link->send(msg, isControl);
+  }
+
+  // max_payload() is the size limit of each message type. A peer that sends a
+  // larger frame, or one of an unknown type, is cut off before anything is
+  // allocated for it.
+
+  size_t max_payload(uint32_t type) {
+
+    return type == COMMAND || type == GO ? MaxCommandSize
+         : type == TT_BATCH ? BatchSize * sizeof(Entry)
+         : type == STATS    ? sizeof(StatsMessage)
+         : type == RESULT   ? sizeof(ResultMessage) : 0;
+  }
+
+  void Link::read_loop() {
+
+    Header h;
+    std::string payload;
+
+    while (   recv_all(fd, reinterpret_cast<char*>(&h), sizeof(h))
+           && h.size <= max_payload(h.type))
+    {
+        payload.resize(h.size);
+        if (h.size && !recv_all(fd, &payload[0], h.size))
+            break;
+
+        handle(this, h.type, payload);
+    }
+
+    close();
+
+    // A worker that lost its root stops searching and waits for the next one
+    if (Worker)
+    {
+        Threads.stop = true;
+        push_command("stop");
+    }
+
+    ResultCv.notify_all();
+  }
+
+  void Link::write_loop() {
+
+    auto lastStats = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lk(mutex);
+
+    while (open)
+    {
+        if (control.empty() && data.empty())
+            cv.wait_for(lk, std::chrono::milliseconds(StatsPeriod));
+
+        auto now = std::chrono::steady_clock::now();
+
+        if (   Worker && Searching
+            && now - lastStats >= std::chrono::milliseconds(StatsPeriod))
+        {
+            StatsMessage s = { SearchId, 0, Threads.nodes_searched(), Threads.tb_hits() };
+            control.push_back(frame(STATS, &s, sizeof(s)));
+            lastStats = now;
+        }
+
+        std::deque<std::string>& queue = !control.empty() ? control : data;
+        if (queue.empty() || !open)
+            continue;
+
+        std::string msg = std::move(queue.front());
+        queue.pop_front();
+
+        lk.unlock();
+        bool sent = send_all(fd, msg.data(), msg.size());
+        lk.lock();
+
+        if (!sent)
+        {
+            open = false;
+            shutdown(fd, SHUT_RDWR);
+            cv.notify_all();
+        }
+    }
+  }
+
+  void handle(Link* link, uint32_t type, const std::string& payload) {
+
+    switch (type) {
+
+    case COMMAND:
+        if (!forwarded(payload))
+            break;
+        // Stop at once, the UCI loop may be busy
+        if (payload == "stop")
+            Threads.stop = true;
+        push_command(payload);
+        break;
+
+    case GO:
+        if (payload.size() > sizeof(uint32_t) && forwarded(payload.substr(sizeof(uint32_t))))
+        {
+            uint32_t id;
+            std::memcpy(&id, payload.data(), sizeof(id));
+            SearchId = id;
+            Searching = true;
+            push_command(payload.substr(sizeof(id)));
+        }
+        break;
+
+    case TT_BATCH:
+        // Entries arriving between two searches are dropped: the table may
+        // be resized then.
+        if (Worker ? Searching.load() : Distributed.load())
+        {
+            Entry e;
+            bool found;
+
+            for (size_t i = 0; i + sizeof(Entry) <= payload.size(); i += sizeof(Entry))
+            {
+                std::memcpy(&e, payload.data() + i, sizeof(Entry));
+                TT.probe(e.key, found)->save(e.key, Value(e.value), Bound(e.bound),
+                                             Depth(e.depth * int(ONE_PLY)), Move(e.move),
+                                             Value(e.eval), TT.generation());
+            }
+
+            // The root relays the batches of a worker to the other ones
+            if (!Worker)
+                send_to(frame(TT_BATCH, payload.data(), payload.size()), false, link);
+        }
+        break;
+
+    case STATS:
+        if (payload.size() == sizeof(StatsMessage))
+        {
+            StatsMessage s;
+            std::memcpy(&s, payload.data(), sizeof(s));
+            if (s.id == SearchId)
+                link->nodes = s.nodes, link->tbHits = s.tbHits;
+        }
+        break;
+
+    case RESULT:
+        if (payload.size() == sizeof(ResultMessage))
+        {
+            ResultMessage r;
+            std::memcpy(&r, payload.data(), sizeof(r));
+            if (r.id == SearchId)
+            {
+                std::lock_guard<std::mutex> lk(ResultMutex);
+                link->nodes = r.nodes, link->tbHits = r.tbHits;
+                link->result = { Move(r.move), Value(r.score), r.depth };
+                link->hasResult = true;
+                ResultCv.notify_all();
+            }
+        }
+        break;
+    }
+  }
+
+  // open_socket() connects to a worker given as host:port, returns -1 on failure
+  int open_socket(const std::string& address) {
+
+    std::string host, port;
+    split_address(address, host, port);
+    if (host.empty())
+        return -1;
+
+    addrinfo hints = {}, *res;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res))
+        return -1;
+
+    int fd = -1;
+    for (addrinfo* ai = res; ai && fd < 0; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && ::connect(fd, ai->ai_addr, ai->ai_addrlen))
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    freeaddrinfo(res);
+    return fd;
+  }
+
+} // namespace
+
+
+/// Cluster::listen() turns the engine into a worker. It waits for a root on
+/// the given [host:]port address, on 127.0.0.1 when no host is given, and
+/// serves one root at a time. The UCI loop then reads its commands from the
+/// root instead of the standard input.
+
+void Cluster::listen(const std::string& address) {
+
+  std::string host, port;
+  split_address(address, host, port);
+
+  addrinfo hints = {}, *res;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+
+  int fd = -1;
+
+  if (!getaddrinfo(host.empty() ? "127.0.0.1" : host.c_str(), port.c_str(), &hints, &res))
+  {
+      for (addrinfo* ai = res; ai && fd < 0; ai = ai->ai_next)
+      {
+          int one = 1;
+          fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+          if (fd >= 0)
+              setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+          if (fd >= 0 && (bind(fd, ai->ai_addr, ai->ai_addrlen) || ::listen(fd, 1)))
+          {
+              ::close(fd);
+              fd = -1;
+          }
+      }
+      freeaddrinfo(res);
+  }
+
+  if (fd < 0)
+  {
+      sync_cout << "info string Unable to listen on " << address << sync_endl;
+      exit(EXIT_FAILURE);
+  }
+
+  Worker = true;
+  sync_cout << "info string Cluster worker listening on " << address << sync_endl;
+
+  std::thread([fd] {
+      while (true)
+      {
+          int s = accept(fd, nullptr, nullptr);
+          if (s < 0)
+              continue;
+
+          auto link = std::make_shared<Link>(s);
+          {
+              std::lock_guard<std::mutex> lk(LinksMutex);
+              Links.push_back(link);
+              LinkCount = 1;
+          }
+
+          link->wait_closed();
+
+          std::lock_guard<std::mutex> lk(LinksMutex);
+          Links.clear();
+          LinkCount = 0;
+      }
+  }).detach();
+}
+
+
+/// Cluster::connect() is called on the root when the ClusterHosts option is
+/// set, with a list of host:port separated by commas or spaces. It drops the
+/// current workers and connects to the new ones.
+
+void Cluster::connect(const std::string& hosts) {
+
+  std::vector<std::shared_ptr<Link>> old;
+  {
+      std::lock_guard<std::mutex> lk(LinksMutex);
+      old.swap(Links);
+      LinkCount = 0;
+  }
+  old.clear(); // Close the connections outside of the lock, see Link::read_loop()
+
+  std::string list = hosts, address;
+  std::replace(list.begin(), list.end(), ',', ' ');
+  std::istringstream is(list == "<empty>" ? "" : list);
+
+  std::vector<std::shared_ptr<Link>> links;
+
+  while (is >> address)
+  {
+      int fd = open_socket(address);
+      if (fd < 0)
+          sync_cout << "info string Unable to connect to " << address << sync_endl;
+      else
+          links.push_back(std::make_shared<Link>(fd));
+  }
+
+  std::lock_guard<std::mutex> lk(LinksMutex);
+  Links.swap(links);
+  LinkCount = int(Links.size());
+
+  if (LinkCount)
+      sync_cout << "info string Cluster of " << LinkCount + 1 << " nodes" << sync_endl;
+}
+
+
+bool Cluster::is_worker() {
+  return Worker;
+}
+
+
+/// Cluster::getline() reads the next command of the UCI loop: from the root on
+/// a worker, which waits for it, and from the given stream otherwise.
+
+bool Cluster::getline(std::istream& is, std::string& cmd) {
+
+  if (!Worker)
+      return bool(std::getline(is, cmd));
+
+  std::unique_lock<std::mutex> lk(CommandMutex);
+  CommandCv.wait(lk, []{ return !Commands.empty(); });
+
+  cmd = Commands.front();
+  Commands.pop_front();
+  return true;
+}
+
+
+/// Cluster::broadcast() forwards a UCI command of the root to the workers, if
+/// they accept it, see forwarded().
+
+void Cluster::broadcast(const std::string& cmd) {
+
+  if (Worker || !LinkCount || !forwarded(cmd))
+      return;
+
+  send_to(frame(COMMAND, cmd.data(), cmd.size()), true);
+}
+
+
+/// Cluster::start_search() is called by the root before the search starts. The
+/// workers search with the given 'go' command until stop_search() stops them,
+/// an empty command keeps the search on this node.
+
+void Cluster::start_search(const std::string& goCmd) {
+
+  if (Worker)
+      return;
+
+  std::lock_guard<std::mutex> lk(LinksMutex);
+  std::lock_guard<std::mutex> rlk(ResultMutex);
+
+  uint32_t id = ++SearchId;
+  Distributed = !goCmd.empty() && !Links.empty();
+
+  for (auto& link : Links)
+  {
+      link->nodes = link->tbHits = 0;
+      link->hasResult = false;
+
+      if (Distributed)
+      {
+          std::string payload(reinterpret_cast<const char*>(&id), sizeof(id));
+          payload += goCmd;
+          link->send(frame(GO, payload.data(), payload.size()), true);
+      }
+  }
+}
+
+
+/// Cluster::stop_search() is called by the root once its own threads are done.
+/// It stops the workers and waits for their results, a worker that doesn't
+/// answer in time is left out.
+
+void Cluster::stop_search(std::vector<Result>& results) {
+
+  if (Worker || !Distributed)
+      return;
+
+  const std::string stop = "stop";
+  send_to(frame(COMMAND, stop.data(), stop.size()), true);
+
+  // Don't hold LinksMutex while waiting, the readers relaying TT batches need it
+  std::vector<std::shared_ptr<Link>> links;
+  {
+      std::lock_guard<std::mutex> lk(LinksMutex);
+      links = Links;
+  }
+
+  std::unique_lock<std::mutex> lk(ResultMutex);
+
+  ResultCv.wait_for(lk, std::chrono::milliseconds(ResultTimeout), [&]{
+      return std::all_of(links.begin(), links.end(), [](const std::shared_ptr<Link>& link) {
+                         return link->hasResult || !link->open; });
+  });
+
+  for (auto& link : links)
+      if (link->hasResult)
+          results.push_back(link->result);
+
+  Distributed = false;
+}
+
+
+/// Cluster::report() is called by a worker at the end of each search, to send
+/// its best move to the root.
+
+void Cluster::report(const Result& result) {
+
+  if (!Worker || !Searching)
+      return;
+
+  Searching = false;
+
+  ResultMessage r = { SearchId, int32_t(result.move), int32_t(result.score), int32_t(result.depth),
+                      Threads.nodes_searched(), Threads.tb_hits() };
+
+  send_to(frame(RESULT, &r, sizeof(r)), true);
+}
+
+
+/// Cluster::save() shares a deep transposition table write with the other nodes.
+/// The writes are sent in batches, which are dropped when the network can't
+/// keep up.
+
+void Cluster::save(Key key, Value v, Bound b, Depth d, Move m, Value ev) {
+
+  if (!LinkCount || d < MinSaveDepth * ONE_PLY)
+      return;
+
+  std::string msg;
+  {
+      std::lock_guard<std::mutex> lk(PendingMutex);
+      Pending.push_back({ key, uint16_t(m), int16_t(v), int16_t(ev), int8_t(d / ONE_PLY), uint8_t(b) });
+
+      if (Pending.size() < BatchSize)
+          return;
+
+      msg = frame(TT_BATCH, Pending.data(), Pending.size() * sizeof(Entry));
+      Pending.clear();
+  }
+
+  send_to(msg, false);
+}
+
+
+/// Cluster::nodes_searched() and Cluster::tb_hits() return the counts of the
+/// workers in the current search, as last reported to the root.
+
+uint64_t Cluster::nodes_searched() {
+
+  if (Worker || !LinkCount)
+      return 0;
+
+  uint64_t sum = 0;
+  std::lock_guard<std::mutex> lk(LinksMutex);
+  for (auto& link : Links)
+      sum += link->nodes;
+  return sum;
+}
+
+uint64_t Cluster::tb_hits() {
+
+  if (Worker || !LinkCount)
+      return 0;
+
+  uint64_t sum = 0;
+  std::lock_guard<std::mutex> lk(LinksMutex);
+  for (auto& link : Links)
+      sum += link->tbHits;
+  return sum;
+}
+
+#endif // #ifdef USE_CLUSTER
@@ -0,0 +1,87 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2018 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CLUSTER_H_INCLUDED
+#define CLUSTER_H_INCLUDED
+
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+/// A cluster runs a distributed Lazy SMP search over several engine processes,
+/// usually on different hosts, connected with plain TCP. The root engine is
+/// driven by the GUI and connects to the workers listed in the ClusterHosts
+/// option, each one started with 'stockfish --cluster-worker [host:]port'. A
+/// worker listens on 127.0.0.1 unless a host is given. It has no
+/// authentication, so it must only be reachable from trusted hosts, and runs
+/// only the position, search and search option commands of the root: options
+/// naming files or shared memory keep their default on the workers.
+///
+/// Every node searches the same position with its own threads: the nodes
+/// exchange their deep transposition table writes in batches, the root adds
+/// up the node and tablebase hit counts and the nodes vote on the best move at
+/// the end. The messages are sent in native byte order, so all the hosts must
+/// share the same architecture.
+///
+/// Cluster support is built with 'make cluster=yes' on POSIX systems. Without
+/// it the functions below are stubs for a single node.
+
+namespace Cluster {
+
+/// Result is the best move found by a node, with its score and completed depth
+struct Result {
+  Move move;
+  Value score;
+  int depth;
+};
+
+#ifdef USE_CLUSTER
+
+void listen(const std::string& address);
+void connect(const std::string& hosts);
+bool is_worker();
+bool getline(std::istream& is, std::string& cmd);
+void broadcast(const std::string& cmd);
+void start_search(const std::string& goCmd);
+void stop_search(std::vector<Result>& results);
+void report(const Result& result);
+void save(Key key, Value v, Bound b, Depth d, Move m, Value ev);
+uint64_t nodes_searched();
+uint64_t tb_hits();
+
+#else
+
+inline bool is_worker() { return false; }
+inline bool getline(std::istream& is, std::string& cmd) { return bool(std::getline(is, cmd)); }
+inline void broadcast(const std::string&) {}
+inline void start_search(const std::string&) {}
+inline void stop_search(std::vector<Result>&) {}
+inline void report(const Result&) {}
+inline void save(Key, Value, Bound, Depth, Move, Value) {}
+inline uint64_t nodes_searched() { return 0; }
+inline uint64_t tb_hits() { return 0; }
+
+#endif
+
+} // namespace Cluster
+
+#endif // #ifndef CLUSTER_H_INCLUDED
@@ -99,6 +99,9 @@ Endgames::Endgames() {
   add<KQKP>("KQKP");
   add<KQKR>("KQKR");
 
+  for (PieceType pt = CANNON; pt <= FORTRESS; ++pt)
+      add<KFK>(string("K") + PieceToChar[pt] + "K");
+
   add<KNPK>("KNPK");
   add<KNPKB>("KNPKB");
   add<KRPKR>("KRPKR");
@@ -143,6 +146,40 @@ Value Endgame<KXK>::operator()(const Position& pos) const {
 }
 
 
+/// K and a fairy piece vs K. The fairy bitbase tells whether the position is won,
+/// and won positions are scored like KX vs K, driving the losing king to the
+/// edge. Without a bitbase for the piece, or while a gate still holds a piece
+/// and the material is not final, we fall back on the KX vs K evaluation.
+template<>
+Value Endgame<KFK>::operator()(const Position& pos) const {
+
+  assert(verify_material(pos, weakSide, VALUE_ZERO, 0));
+  assert(popcount(pos.pieces(strongSide)) == 2);
+
+  Bitboard piece = pos.pieces(strongSide) ^ pos.pieces(strongSide, KING);
+  PieceType pt = type_of(pos.piece_on(lsb(piece)));
+
+  if (pos.gates() || !Bitbases::available(pt))
+      return Endgame<KXK>(strongSide)(pos);
+
+  // Map the squares as if strongSide is white
+  Square winnerKSq = relative_square(strongSide, pos.square<KING>(strongSide));
+  Square loserKSq  = relative_square(strongSide, pos.square<KING>(weakSide));
+  Square psq       = relative_square(strongSide, lsb(piece));
+  Color  us        = strongSide == pos.side_to_move() ? WHITE : BLACK;
+
+  if (!Bitbases::probe(pt, winnerKSq, psq, loserKSq, us))
+      return VALUE_DRAW;
+
+  Value result =  VALUE_KNOWN_WIN
+                + pos.non_pawn_material(strongSide)
+                + PushToEdges[loserKSq]
+                + PushClose[distance(winnerKSq, loserKSq)];
+
+  return strongSide == pos.side_to_move() ? result : -result;
+}
+
+
 /// Mate with KBN vs K. This is similar to KX vs K, but we have to drive the
 /// defending king towards a corner square of the right color.
 template<>
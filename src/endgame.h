@@ -21,11 +21,12 @@
 #ifndef ENDGAME_H_INCLUDED
 #define ENDGAME_H_INCLUDED
 
-#include <map>
+#include <cassert>
 #include <memory>
 #include <string>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "position.h"
 #include "types.h"
@@ -38,6 +39,7 @@ enum EndgameCode {
   EVALUATION_FUNCTIONS,
   KNNK,  // KNN vs K
   KXK,   // Generic "mate lone king" eval
+  KFK,   // K and a fairy piece vs K, from the bitbases
   KBNK,  // KBN vs K
   KPK,   // KP vs K
   KRKP,  // KR vs KP
@@ -90,35 +92,74 @@ struct Endgame : public EndgameBase<T> {
 
 
 /// The Endgames class stores the pointers to endgame evaluation and scaling
-/// base objects in two std::map. We use polymorphism to invoke the actual
+/// base objects in two small open addressing hash tables indexed by material
+/// key. They are filled by the constructor and only read afterwards, so that
+/// a probe, done at every material hash miss, touches a few contiguous cache
+/// lines instead of walking a tree. We use polymorphism to invoke the actual
 /// endgame function by calling its virtual operator().
 
 class Endgames {
 
   template<typename T> using Ptr = std::unique_ptr<EndgameBase<T>>;
-  template<typename T> using Map = std::map<Key, Ptr<T>>;
+
+  // At least twice the number of functions of either type, to keep probes short
+  static constexpr size_t TableSize = 128;
+
+  template<typename T>
+  struct Table {
+    std::pair<Key, EndgameBase<T>*> entries[TableSize] = {};
+    std::vector<Ptr<T>> functions;
+  };
 
   template<typename T>
-  Map<T>& map() {
-    return std::get<std::is_same<T, ScaleFactor>::value>(maps);
+  Table<T>& table() {
+    return std::get<std::is_same<T, ScaleFactor>::value>(tables);
   }
 
-  template<EndgameCode E, typename T = eg_type<E>, typename P = Ptr<T>>
+  template<typename T>
+  const Table<T>& table() const {
+    return std::get<std::is_same<T, ScaleFactor>::value>(tables);
+  }
+
+  template<EndgameCode E, typename T = eg_type<E>>
   void add(const std::string& code) {
 
     StateInfo st;
-    map<T>()[Position().set(code, WHITE, &st).material_key()] = P(new Endgame<E>(WHITE));
-    map<T>()[Position().set(code, BLACK, &st).material_key()] = P(new Endgame<E>(BLACK));
+    Table<T>& t = table<T>();
+
+    for (Color c = WHITE; c <= BLACK; ++c)
+    {
+        Key key = Position().set(code, c, &st).material_key();
+        size_t i = key & (TableSize - 1);
+
+        assert(2 * t.functions.size() < TableSize);
+
+        while (t.entries[i].second)
+        {
+            assert(t.entries[i].first != key);
+            i = (i + 1) & (TableSize - 1);
+        }
+
+        t.functions.emplace_back(new Endgame<E>(c));
+        t.entries[i] = std::make_pair(key, t.functions.back().get());
+    }
   }
 
-  std::pair<Map<Value>, Map<ScaleFactor>> maps;
+  std::pair<Table<Value>, Table<ScaleFactor>> tables;
 
 public:
   Endgames();
 
   template<typename T>
-  EndgameBase<T>* probe(Key key) {
-    return map<T>().count(key) ? map<T>()[key].get() : nullptr;
+  EndgameBase<T>* probe(Key key) const {
+
+    const Table<T>& t = table<T>();
+
+    for (size_t i = key & (TableSize - 1); t.entries[i].second; i = (i + 1) & (TableSize - 1))
+        if (t.entries[i].first == key)
+            return t.entries[i].second;
+
+    return nullptr;
   }
 };
 
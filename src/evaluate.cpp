@@ -27,6 +27,7 @@
 #include "bitboard.h"
 #include "evaluate.h"
 #include "material.h"
+#include "nnue.h"
 #include "pawns.h"
 #include "thread.h"
 
@@ -89,7 +90,7 @@ namespace {
   constexpr Value SpaceThreshold = Value(12222);
 
   // KingAttackWeights[PieceType] contains king attack weights by piece type
-  constexpr int KingAttackWeights[PIECE_TYPE_NB] = { 0, 0, 77, 55, 44, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10 };
+  constexpr int KingAttackWeights[PIECE_TYPE_USED] = { 0, 0, 77, 55, 44, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10 };
 
   // Penalties for enemy's safe checks
   constexpr int QueenSafeCheck  = 780;
@@ -101,7 +102,7 @@ namespace {
 
   // MobilityBonus[PieceType-2][attacked] contains bonuses for middle and end game,
   // indexed by piece type and number of attacked squares in the mobility area.
-  constexpr Score MobilityBonus[PIECE_TYPE_NB - 2][35] = {
+  constexpr Score MobilityBonus[PIECE_TYPE_USED - 2][35] = {
     { S(-75,-76), S(-57,-54), S( -9,-28), S( -2,-10), S(  6,  5), S( 14, 12), // Knights
       S( 22, 26), S( 29, 29), S( 36, 29) },
     { S(-48,-59), S(-20,-23), S( 16, -3), S( 26, 13), S( 38, 24), S( 51, 42), // Bishops
@@ -182,11 +183,11 @@ namespace {
   // ThreatByMinor/ByRook[attacked PieceType] contains bonuses according to
   // which piece type attacks which one. Attacks on lesser pieces which are
   // pawn-defended are not considered.
-  constexpr Score ThreatByMinor[PIECE_TYPE_NB] = {
+  constexpr Score ThreatByMinor[PIECE_TYPE_USED] = {
     S(0, 0), S(0, 31), S(39, 42), S(57, 44), S(68, 112), S(47, 120)
   };
 
-  constexpr Score ThreatByRook[PIECE_TYPE_NB] = {
+  constexpr Score ThreatByRook[PIECE_TYPE_USED] = {
     S(0, 0), S(0, 24), S(38, 71), S(38, 61), S(0, 38), S(36, 38)
   };
 
@@ -209,7 +210,7 @@ namespace {
   constexpr int PassedDanger[RANK_NB] = { 0, 0, 0, 3, 6, 12, 21 };
 
   // KingProtector[PieceType-2] contains a penalty according to distance from king
-  constexpr Score KingProtector[PIECE_TYPE_NB - 2] = { S(3, 5), S(4, 3), S(3, 0), S(1, -1) };
+  constexpr Score KingProtector[PIECE_TYPE_USED - 2] = { S(3, 5), S(4, 3), S(3, 0), S(1, -1) };
 
   // Assorted bonuses and penalties
   constexpr Score BishopPawns        = S(  3,  5);
@@ -263,7 +264,7 @@ namespace {
     // attackedBy[color][piece type] is a bitboard representing all squares
     // attacked by a given color and piece type. Special "piece types" which
     // is also calculated is ALL_PIECES.
-    Bitboard attackedBy[COLOR_NB][PIECE_TYPE_NB];
+    Bitboard attackedBy[COLOR_NB][PIECE_TYPE_USED];
 
     // attackedBy2[color] are the squares attacked by 2 pieces of a given color,
     // possibly via x-ray or by one pawn and one piece. Diagonal x-ray through
@@ -355,6 +356,9 @@ namespace {
 
     attackedBy[Us][Pt] = 0;
 
+    if (!(pos.piece_types(Us) & (1ULL << Pt)))
+        return score;
+
     while ((s = *pl++) != SQ_NONE)
     {
         // Find attacked squares, including x-ray attacks for bishops and rooks
@@ -960,7 +964,60 @@ namespace {
 /// evaluation of the position from the point of view of the side to move.
 
 Value Eval::evaluate(const Position& pos) {
-  return Evaluation<NO_TRACE>(pos).value();
+
+  Thread* th = pos.this_thread();
+
+  // A loaded network takes over once the setup phase is over
+  if (NNUE::enabled() && pos.game_phase() == GAMEPHASE_PLAYING)
+      return NNUE::evaluate(pos) + Tempo;
+
+  if (!th->evalCache.enabled())
+      return Evaluation<NO_TRACE>(pos).value();
+
+  Key key = pos.key() ^ (uint64_t(uint32_t(th->contempt)) * 0x9E3779B97F4A7C15ULL);
+  Value v;
+
+  STAT_INC(th, evalProbes);
+
+  if (th->evalCache.probe(key, v))
+  {
+      STAT_INC(th, evalHits);
+      return v;
+  }
+
+  v = Evaluation<NO_TRACE>(pos).value();
+  th->evalCache.save(key, v);
+  return v;
+}
+
+
+/// Eval::Cache::resize() sets the size of the cache in megabytes, rounded down
+/// to a power of two number of entries. A size of zero disables the cache.
+
+void Eval::Cache::resize(size_t mbSize) {
+
+  size_t entries = mbSize * 1024 * 1024 / sizeof(uint64_t);
+
+  while (entries & (entries - 1))
+      entries &= entries - 1;
+
+  if (entries != table.size())
+  {
+      table.assign(entries, 0);
+      table.shrink_to_fit();
+      mask = entries ? entries - 1 : 0;
+      salt = 0;
+  }
+}
+
+
+/// Eval::Cache::clear() drops all the cached evaluations, by moving every key
+/// to a new slot. The table is zeroed only when the salt wraps around.
+
+void Eval::Cache::clear() {
+
+  if (!(salt = (salt + 1) & mask))
+      std::fill(table.begin(), table.end(), 0);
 }
 
 
@@ -1001,5 +1058,12 @@ std::string Eval::trace(const Position& pos) {
 
   ss << "\nTotal evaluation: " << to_cp(v) << " (white side)\n";
 
+  if (NNUE::enabled() && pos.game_phase() == GAMEPHASE_PLAYING)
+  {
+      v = NNUE::evaluate(pos) + Tempo;
+      v = pos.side_to_move() == WHITE ? v : -v;
+      ss << "NNUE evaluation:  " << to_cp(v) << " (white side)\n";
+  }
+
   return ss.str();
 }
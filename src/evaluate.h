@@ -23,6 +23,7 @@
 
 #include <atomic>
 #include <string>
+#include <vector>
 
 #include "types.h"
 
@@ -35,6 +36,35 @@ constexpr Value Tempo = Value(20); // Must be visible to search
 std::string trace(const Position& pos);
 
 Value evaluate(const Position& pos);
-}
+
+/// Eval::Cache is a per-thread hash of static evaluations, probed by evaluate()
+/// before running the full evaluation. Entries are a single 64 bit word which
+/// holds the upper half of the key and the value, so a probe is one load.
+/// The key mixes in the thread's dynamic contempt, which enters the score.
+/// Like HashTable, clear() only changes the salt that keys are xored with.
+
+class Cache {
+
+public:
+  void resize(size_t mbSize);
+  void clear();
+
+  bool enabled() const { return !table.empty(); }
+
+  bool probe(Key key, Value& v) const {
+    uint64_t e = table[(key ^ salt) & mask];
+    v = Value(int32_t(uint32_t(e)));
+    return (e >> 32) == (key >> 32) && e;
+  }
+
+  void save(Key key, Value v) { table[(key ^ salt) & mask] = (key >> 32 << 32) | uint32_t(v); }
+
+private:
+  std::vector<uint64_t> table;
+  size_t mask = 0;
+  size_t salt = 0;
+};
+
+} // namespace Eval
 
 #endif // #ifndef EVALUATE_H_INCLUDED
@@ -18,10 +18,15 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <chrono>
 #include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "bitboard.h"
 #include "betza.h"
+#include "cluster.h"
 #include "position.h"
 #include "search.h"
 #include "thread.h"
@@ -33,24 +38,76 @@ namespace PSQT {
   void init();
 }
 
+namespace {
+
+  // Startup runs the initialization steps in order. With --startup-stats as
+  // the first argument the time spent in each one is reported before the
+  // engine enters the UCI loop.
+  struct Startup {
+
+    template<typename F>
+    void run(const char* name, F init) {
+      auto start = std::chrono::steady_clock::now();
+      init();
+      steps.emplace_back(name, std::chrono::duration_cast<std::chrono::microseconds>
+                               (std::chrono::steady_clock::now() - start).count());
+    }
+
+    void report() const {
+      long long total = 0;
+      for (const auto& s : steps)
+      {
+          sync_cout << "info string startup " << s.first << " " << s.second << " us" << sync_endl;
+          total += s.second;
+      }
+      sync_cout << "info string startup total " << total << " us" << sync_endl;
+    }
+
+    std::vector<std::pair<const char*, long long>> steps;
+  };
+
+} // namespace
+
 int main(int argc, char* argv[]) {
 
   std::cout << engine_info() << std::endl;
 
-  UCI::init(Options);
-  PSQT::init();
-  Bitboards::init();
-  betzaManager.init();  // Initialize Betza notation support
-  Position::init();
-  Bitbases::init();
-  Search::init();
-  Pawns::init();
-  Tablebases::init(Options["SyzygyPath"]); // After Bitboards are set
-  Threads.set(Options["Threads"]);
-  Search::clear(); // After threads are up
+  bool startupStats = argc > 1 && std::string(argv[1]) == "--startup-stats";
+  if (startupStats)
+      argv[1] = argv[0], ++argv, --argc;
+
+#ifdef USE_CLUSTER
+  // With --cluster-worker [host:]port the engine serves a cluster root, see cluster.h
+  std::string clusterAddress;
+  if (argc > 2 && std::string(argv[1]) == "--cluster-worker")
+      clusterAddress = argv[2], argv[2] = argv[0], argv += 2, argc -= 2;
+#endif
+
+  Startup startup;
+  startup.run("UCI",         [] { UCI::init(Options); });
+  startup.run("PSQT",        [] { PSQT::init(); });
+  startup.run("Bitboards",   [] { Bitboards::init(); });
+  startup.run("Betza",       [] { betzaManager.init(); });
+  startup.run("Position",    [] { Position::init(); });
+  startup.run("Search",      [] { Search::init(); });
+  startup.run("Pawns",       [] { Pawns::init(); });
+  startup.run("Material",    [] { Material::init(); });
+  startup.run("Tablebases",  [] { Tablebases::init(Options["SyzygyPath"]); }); // After Bitboards are set
+  startup.run("Bitbases",    [] { Bitbases::load(Options["BitbasePath"]); });
+  startup.run("Threads",     [] { Threads.set(Options["Threads"]); });
+  startup.run("SearchClear", [] { Search::clear(); }); // After threads are up
+
+  if (startupStats)
+      startup.report();
+
+#ifdef USE_CLUSTER
+  if (!clusterAddress.empty())
+      Cluster::listen(clusterAddress);
+#endif
 
   UCI::loop(argc, argv);
 
   Threads.set(0);
+  flush_output();
   return 0;
 }
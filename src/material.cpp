@@ -31,7 +31,7 @@ namespace {
 
   // Polynomial material imbalance parameters
 
-  constexpr int QuadraticOurs[][PIECE_TYPE_NB] = {
+  constexpr int QuadraticOurs[][QUEEN + 1] = {
     //            OUR PIECES
     // pair pawn knight bishop rook queen
     {1667                               }, // Bishop pair
@@ -42,7 +42,7 @@ namespace {
     {-189,   24, 117,   133,  -134, -10 }  // Queen
   };
 
-  constexpr int QuadraticTheirs[][PIECE_TYPE_NB] = {
+  constexpr int QuadraticTheirs[][QUEEN + 1] = {
     //           THEIR PIECES
     // pair pawn knight bishop rook queen
     {   0                               }, // Bishop pair
@@ -85,7 +85,7 @@ namespace {
   /// imbalance() calculates the imbalance by comparing the piece count of each
   /// piece type for both colors.
   template<Color Us>
-  int imbalance(const int pieceCount[][PIECE_TYPE_NB]) {
+  int imbalance(const int pieceCount[][QUEEN + 1]) {
 
     constexpr Color Them = (Us == WHITE ? BLACK : WHITE);
 
@@ -109,10 +109,88 @@ namespace {
     return bonus;
   }
 
+  // The imbalance only depends on the counts of the orthodox pieces, so it is
+  // precomputed for all the counts an ordinary game reaches. ImbalanceTable is
+  // indexed by the signatures of both sides, see signature(). Counts beyond
+  // the table, after underpromotions or a second queen, use the polynomial.
+  constexpr int MaxCount[QUEEN + 1] = { 1, 8, 2, 2, 2, 1 };
+  constexpr int Signatures = 9 * 3 * 3 * 3 * 2;
+
+  int16_t ImbalanceTable[Signatures][Signatures];
+
+  int signature(const int pieceCount[QUEEN + 1]) {
+
+    int idx = 0;
+
+    for (int pt = PAWN; pt <= QUEEN; ++pt)
+    {
+        if (pieceCount[pt] > MaxCount[pt])
+            return -1;
+
+        idx = idx * (MaxCount[pt] + 1) + pieceCount[pt];
+    }
+    return idx;
+  }
+
 } // namespace
 
 namespace Material {
 
+/// Material::init() fills ImbalanceTable[]. The polynomial is split so that the
+/// inner loop is two dot products: the terms between our own pieces depend on
+/// one signature only, and for the terms against their pieces each signature
+/// gets its row sums of QuadraticTheirs in advance.
+
+void init() {
+
+  static int counts[Signatures][QUEEN + 1], ours[Signatures], theirs[Signatures][QUEEN + 1];
+
+  for (int s = 0; s < Signatures; ++s)
+  {
+      int* c = counts[s];
+
+      for (int pt = QUEEN, idx = s; pt >= PAWN; --pt)
+      {
+          c[pt] = idx % (MaxCount[pt] + 1);
+          idx /= MaxCount[pt] + 1;
+      }
+      c[NO_PIECE_TYPE] = c[BISHOP] > 1;
+
+      assert(signature(c) == s);
+
+      ours[s] = 0;
+
+      for (int pt1 = NO_PIECE_TYPE; pt1 <= QUEEN; ++pt1)
+      {
+          theirs[s][pt1] = 0;
+
+          for (int pt2 = NO_PIECE_TYPE; pt2 <= pt1; ++pt2)
+          {
+              ours[s]        += c[pt1] * QuadraticOurs[pt1][pt2] * c[pt2];
+              theirs[s][pt1] += QuadraticTheirs[pt1][pt2] * c[pt2];
+          }
+      }
+  }
+
+  for (int w = 0; w < Signatures; ++w)
+      for (int b = 0; b < Signatures; ++b)
+      {
+          int bonus = ours[w] - ours[b];
+
+          for (int pt = NO_PIECE_TYPE; pt <= QUEEN; ++pt)
+              bonus += counts[w][pt] * theirs[b][pt] - counts[b][pt] * theirs[w][pt];
+
+          ImbalanceTable[w][b] = int16_t(bonus / 16);
+
+#ifndef NDEBUG
+          int pieceCount[COLOR_NB][QUEEN + 1];
+          std::copy(counts[w], counts[w] + QUEEN + 1, pieceCount[WHITE]);
+          std::copy(counts[b], counts[b] + QUEEN + 1, pieceCount[BLACK]);
+          assert(bonus == imbalance<WHITE>(pieceCount) - imbalance<BLACK>(pieceCount));
+#endif
+      }
+}
+
 /// Material::probe() looks up the current position's material configuration in
 /// the material hash table. It returns a pointer to the Entry if the position
 /// is found. Otherwise a new Entry is computed and stored there, so we don't
@@ -123,8 +201,13 @@ Entry* probe(const Position& pos) {
   Key key = pos.material_key();
   Entry* e = pos.this_thread()->materialTable[key];
 
+  STAT_INC(pos.this_thread(), materialProbes);
+
   if (e->key == key)
+  {
+      STAT_INC(pos.this_thread(), materialHits);
       return e;
+  }
 
   std::memset(e, 0, sizeof(Entry));
   e->key = key;
@@ -209,13 +292,16 @@ Entry* probe(const Position& pos) {
   // Evaluate the material imbalance. We use PIECE_TYPE_NONE as a place holder
   // for the bishop pair "extended piece", which allows us to be more flexible
   // in defining bishop pair bonuses.
-  const int pieceCount[COLOR_NB][PIECE_TYPE_NB] = {
+  const int pieceCount[COLOR_NB][QUEEN + 1] = {
   { pos.count<BISHOP>(WHITE) > 1, pos.count<PAWN>(WHITE), pos.count<KNIGHT>(WHITE),
     pos.count<BISHOP>(WHITE)    , pos.count<ROOK>(WHITE), pos.count<QUEEN >(WHITE) },
   { pos.count<BISHOP>(BLACK) > 1, pos.count<PAWN>(BLACK), pos.count<KNIGHT>(BLACK),
     pos.count<BISHOP>(BLACK)    , pos.count<ROOK>(BLACK), pos.count<QUEEN >(BLACK) } };
 
-  e->value = int16_t((imbalance<WHITE>(pieceCount) - imbalance<BLACK>(pieceCount)) / 16);
+  int w = signature(pieceCount[WHITE]), b = signature(pieceCount[BLACK]);
+
+  e->value =  w >= 0 && b >= 0 ? ImbalanceTable[w][b]
+            : int16_t((imbalance<WHITE>(pieceCount) - imbalance<BLACK>(pieceCount)) / 16);
   return e;
 }
 
@@ -64,8 +64,9 @@ struct Entry {
   Phase gamePhase;
 };
 
-typedef HashTable<Entry, 8192> Table;
+typedef HashTable<Entry> Table;
 
+void init();
 Entry* probe(const Position& pos);
 
 } // namespace Material
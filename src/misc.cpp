@@ -29,6 +29,7 @@
 #endif
 
 #include <windows.h>
+#include <malloc.h> // For _aligned_malloc()
 // The needed Windows API for processor groups could be missed from old Windows
 // versions, so instead of calling them directly (forcing the linker to resolve
 // the calls at compile time), try to load them at runtime. To do this we need
@@ -41,10 +42,27 @@ typedef bool(*fun3_t)(HANDLE, CONST GROUP_AFFINITY*, PGROUP_AFFINITY);
 }
 #endif
 
+#ifndef _WIN32
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && !defined(__ANDROID__)
+#include <sched.h>
+#include <sys/syscall.h>
+#define USE_LINUX_NUMA
+#endif
+
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <thread>
 #include <vector>
 
 #include "misc.h"
@@ -58,6 +76,10 @@ namespace {
 /// DD-MM-YY and show in engine_info.
 const string Version = "";
 
+/// Held by the output thread while it writes to std::cout, and by Logger while
+/// it swaps the stream buffers.
+Mutex WriteMutex;
+
 /// Our fancy logging facility. The trick here is to replace cin.rdbuf() and
 /// cout.rdbuf() with two Tie objects that tie cin and cout to a file stream. We
 /// can toggle the logging of std::cout and std:cin at runtime whilst preserving
@@ -99,6 +121,9 @@ public:
 
     static Logger l;
 
+    flush_output();
+    std::lock_guard<Mutex> lk(WriteMutex);
+
     if (!fname.empty() && !l.file.is_open())
     {
         l.file.open(fname, ifstream::out);
@@ -163,23 +188,280 @@ void dbg_print() {
 }
 
 
-/// Used to serialize access to std::cout to avoid multiple threads writing at
-/// the same time.
+namespace {
+
+/// OutputQueue moves the writing of the protocol output off the search threads.
+/// sync_cout builds each line in a buffer of the calling thread, and sync_endl
+/// pushes it into a lock-free ring buffer. A dedicated thread drains the ring
+/// and writes the lines in batches, with one flush per batch, so that a slow
+/// pipe or log file never blocks the search.
+///
+/// The 'info' lines that only report the current state, the current move and
+/// the PV of each multipv index, are coalesced: of a series of them, only the
+/// last one with the same role is written. With an info interval, they are
+/// also held back and written at most once per interval. Any other line, like
+/// 'bestmove', first releases the lines held before it.
+
+class OutputQueue {
+
+  static constexpr size_t Capacity = 4096; // A power of 2
+
+  struct Slot {
+    std::atomic<size_t> seq;
+    std::string line;
+  };
+
+public:
+  OutputQueue() : enqueuePos(0), dequeuePos(0), pushed(0), written(0),
+                  interval(0), sleeping(false), flushing(false), exit(false) {
+
+    for (size_t i = 0; i < Capacity; ++i)
+        slots[i].seq = i;
+
+    cin.tie(nullptr); // Reading std::cin must not flush std::cout from another thread
+    thread = std::thread(&OutputQueue::idle_loop, this);
+  }
+
+ ~OutputQueue() {
+    exit = true;
+    wake();
+    thread.join();
+  }
+
+  // push() queues each line of a block, like the lines of all the PVs with
+  // MultiPV, on its own, so that they are coalesced one by one.
+  void push(std::string&& block) {
+
+    size_t end = block.find('\n');
+
+    if (end == std::string::npos || end + 1 == block.size())
+    {
+        push_line(std::move(block));
+        return;
+    }
+
+    for (size_t start = 0; start < block.size(); start = end + 1)
+    {
+        end = std::min(block.find('\n', start), block.size() - 1);
+        push_line(block.substr(start, end + 1 - start));
+    }
+  }
+
+  // flush() waits until all the lines pushed so far are written
+  void flush() {
+
+    size_t target = pushed;
+    flushing = true;
+    wake();
+
+    while (written < target)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    flushing = false;
+  }
+
+  void set_interval(int ms) { interval = ms; }
+
+private:
+  // push_line() is the multiple producer side of a bounded ring buffer, after
+  // Dmitry Vyukov's MPMC queue. When the ring is full, the lines that would be
+  // coalesced anyway are dropped and the other ones wait for a free slot.
+  void push_line(std::string&& line) {
+
+    bool transient = !coalesce_key(line).empty();
+    size_t pos = enqueuePos.load(std::memory_order_relaxed);
+    Slot* slot;
+
+    while (true)
+    {
+        slot = &slots[pos & (Capacity - 1)];
+        size_t seq = slot->seq.load(std::memory_order_acquire);
+        intptr_t diff = intptr_t(seq) - intptr_t(pos);
+
+        if (diff == 0 && enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            break;
+
+        if (diff < 0)
+        {
+            if (transient)
+                return;
+
+            std::this_thread::yield();
+        }
+
+        if (diff != 0)
+            pos = enqueuePos.load(std::memory_order_relaxed);
+    }
+
+    slot->line = std::move(line);
+    slot->seq.store(pos + 1, std::memory_order_release);
+    ++pushed;
+
+    // Pairs with the fence in idle_loop(), so that a sleeping writer is woken
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping)
+        wake();
+  }
+
+  void wake() {
+    std::lock_guard<Mutex> lk(mutex);
+    cv.notify_one();
+  }
+
+  // pop() is the single consumer side of the ring
+  bool pop(std::string& line) {
+
+    Slot& slot = slots[dequeuePos & (Capacity - 1)];
+
+    if (slot.seq.load(std::memory_order_acquire) != dequeuePos + 1)
+        return false;
+
+    line = std::move(slot.line);
+    slot.seq.store(dequeuePos + Capacity, std::memory_order_release);
+    ++dequeuePos;
+    return true;
+  }
+
+  // coalesce_key() returns the role of a line that is superseded by the next
+  // one with the same role, or an empty string.
+  static std::string coalesce_key(const std::string& line) {
+
+    if (line.compare(0, 5, "info "))
+        return "";
+
+    if (line.find(" currmove ") != std::string::npos)
+        return "currmove";
+
+    size_t idx = line.find(" multipv ");
+    if (idx != std::string::npos && line.find(" pv ") != std::string::npos)
+        return "pv" + line.substr(idx + 9, line.find(' ', idx + 9) - idx - 9);
+
+    return "";
+  }
+
+  // hold() keeps the last line of each role, in the order the roles appeared
+  void hold(const std::string& key, std::string&& line) {
+
+    for (auto& h : held)
+        if (h.first == key)
+        {
+            h.second = std::move(line);
+            ++written; // The superseded line counts as written
+            return;
+        }
+
+    held.emplace_back(key, std::move(line));
+  }
+
+  void release(std::string& out) {
+
+    for (auto& h : held)
+        out += h.second;
+
+    written += held.size();
+    held.clear();
+    lastRelease = now();
+  }
+
+  void idle_loop() {
+
+    std::string line, out;
+    lastRelease = now();
+
+    while (true)
+    {
+        while (pop(line))
+        {
+            std::string key = coalesce_key(line);
+
+            if (!key.empty())
+            {
+                hold(key, std::move(line));
+                continue;
+            }
+
+            release(out);
+            out += line;
+            ++written;
+        }
+
+        if (!held.empty() && (flushing || exit || now() - lastRelease >= interval))
+            release(out);
+
+        if (!out.empty())
+        {
+            std::lock_guard<Mutex> lk(WriteMutex);
+            cout << out << std::flush;
+            out.clear();
+            continue;
+        }
+
+        if (exit && held.empty())
+            break;
+
+        // Sleep until a new line comes, or the held lines are due
+        TimePoint timeout = held.empty() ? 100 : std::max(TimePoint(1), lastRelease + interval - now());
+        std::unique_lock<Mutex> lk(mutex);
+        sleeping = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (    slots[dequeuePos & (Capacity - 1)].seq.load(std::memory_order_acquire) != dequeuePos + 1
+            && !exit && !flushing)
+            cv.wait_for(lk, std::chrono::milliseconds(timeout));
+
+        sleeping = false;
+    }
+  }
+
+  Slot slots[Capacity];
+  std::atomic<size_t> enqueuePos;
+  size_t dequeuePos;
+  std::atomic<size_t> pushed, written;
+  std::atomic<int> interval;
+  std::atomic<bool> sleeping, flushing, exit;
+  std::vector<std::pair<std::string, std::string>> held;
+  TimePoint lastRelease;
+  Mutex mutex;
+  ConditionVariable cv;
+  std::thread thread;
+};
+
+OutputQueue& output_queue() {
+  static OutputQueue q;
+  return q;
+}
+
+} // namespace
+
+
+/// sync_cout returns a stream local to the calling thread, where the line is
+/// built, and sync_endl hands the line over to the output thread.
 
 std::ostream& operator<<(std::ostream& os, SyncCout sc) {
 
-  static Mutex m;
+  thread_local std::ostringstream line;
 
   if (sc == IO_LOCK)
-      m.lock();
-
-  if (sc == IO_UNLOCK)
-      m.unlock();
+      return line;
 
+  output_queue().push(line.str());
+  line.str("");
   return os;
 }
 
 
+/// flush_output() waits until all the protocol output is written, it is called
+/// before the engine exits.
+
+void flush_output() { output_queue().flush(); }
+
+
+/// set_info_interval() sets the minimum time between two writes of the 'info'
+/// lines that are coalesced, 0 writes them as soon as possible.
+
+void set_info_interval(int ms) { output_queue().set_interval(ms); }
+
+
 /// Trampoline helper to avoid moving Logger to misc.h
 void start_logger(const std::string& fname) { Logger::start(fname); }
 
@@ -216,9 +498,97 @@ void prefetch2(void* addr) {
   prefetch((uint8_t*)addr + 64);
 }
 
+#if defined(USE_LINUX_NUMA)
+
+namespace SysFs {
+
+  // read_list() parses a sysfs file in the "0-3,8,10-11" range list format
+  vector<int> read_list(const string& path) {
+
+    ifstream file(path);
+    string range;
+    vector<int> list;
+
+    while (getline(file, range, ','))
+    {
+        int first, last;
+        char dash;
+        istringstream ss(range);
+
+        if (!(ss >> first))
+            continue;
+
+        if (!(ss >> dash >> last))
+            last = first;
+
+        for (int n = first; n <= last; ++n)
+            list.push_back(n);
+    }
+
+    return list;
+  }
+
+} // namespace SysFs
+
+#endif
+
 namespace WinProcGroup {
 
-#ifndef _WIN32
+#if defined(USE_LINUX_NUMA)
+
+namespace {
+
+  // cpu_order() returns the CPUs the process is allowed to run on, grouped by
+  // NUMA node, so that consecutive thread indices fill up one node before the
+  // next one, the same as the Windows groups below. The allowed set is taken
+  // once, before any thread has been bound.
+  const vector<int>& cpu_order() {
+
+    static const vector<int> cpus = [] {
+
+        vector<int> order;
+        cpu_set_t allowed;
+
+        if (sched_getaffinity(0, sizeof(allowed), &allowed))
+            return order;
+
+        for (int n : SysFs::read_list("/sys/devices/system/node/online"))
+            for (int cpu : SysFs::read_list("/sys/devices/system/node/node" + to_string(n) + "/cpulist"))
+                if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+                    order.push_back(cpu);
+
+        // No NUMA information, use the allowed CPUs in their natural order
+        if (order.empty())
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+                if (CPU_ISSET(cpu, &allowed))
+                    order.push_back(cpu);
+
+        return order;
+    }();
+
+    return cpus;
+  }
+
+} // namespace
+
+
+/// bindThisThread() pins the current thread to a single CPU. The kernel then
+/// allocates the memory first touched by the thread on the CPU's local node.
+
+void bindThisThread(size_t idx) {
+
+  const vector<int>& cpus = cpu_order();
+
+  if (cpus.empty())
+      return;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpus[idx % cpus.size()], &set);
+  sched_setaffinity(0, sizeof(set), &set);
+}
+
+#elif !defined(_WIN32)
 
 void bindThisThread(size_t) {}
 
@@ -320,3 +690,281 @@ void bindThisThread(size_t idx) {
 #endif
 
 } // namespace WinProcGroup
+
+
+namespace Memory {
+
+namespace {
+
+  constexpr size_t CacheLineSize = 64;
+
+#if defined(USE_LINUX_NUMA)
+
+  constexpr size_t HugePageSize = 2 * 1024 * 1024;
+
+  // online_nodes() returns the bitmask of the online NUMA nodes. Nodes above
+  // 63 are ignored.
+  uint64_t online_nodes() {
+
+    uint64_t mask = 0;
+
+    for (int n : SysFs::read_list("/sys/devices/system/node/online"))
+        if (n < 64)
+            mask |= 1ULL << n;
+
+    return mask;
+  }
+
+  // interleave() sets the NUMA policy of the given range so that its pages
+  // are spread round robin over all online nodes when first touched.
+  bool interleave(void* mem, size_t size) {
+
+    constexpr int MPOL_INTERLEAVE = 3;
+    unsigned long mask = online_nodes();
+
+    if (popcount(mask) < 2)
+        return false;
+
+    return !syscall(SYS_mbind, mem, size, MPOL_INTERLEAVE, &mask, 8 * sizeof(mask) + 1, 0);
+  }
+
+#elif defined(_WIN32)
+
+  // large_pages_alloc() enables the "Lock pages in memory" privilege for the
+  // process, which the user must have been granted, and then tries to get the
+  // allocation backed by large pages.
+  void* large_pages_alloc(size_t& size) {
+
+    HANDLE token;
+    LUID luid;
+    void* mem = nullptr;
+
+    const size_t largePageSize = GetLargePageMinimum();
+    if (!largePageSize)
+        return nullptr;
+
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+        return nullptr;
+
+    if (LookupPrivilegeValue(nullptr, SE_LOCK_MEMORY_NAME, &luid))
+    {
+        TOKEN_PRIVILEGES tp { }, prevTp { };
+        DWORD prevTpLen = 0;
+
+        tp.PrivilegeCount = 1;
+        tp.Privileges[0].Luid = luid;
+        tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+        // AdjustTokenPrivileges() succeeds even when the privilege is not held,
+        // so the last error has to be checked as well.
+        if (   AdjustTokenPrivileges(token, FALSE, &tp, sizeof(TOKEN_PRIVILEGES), &prevTp, &prevTpLen)
+            && GetLastError() == ERROR_SUCCESS)
+        {
+            size = (size + largePageSize - 1) / largePageSize * largePageSize;
+            mem = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+
+            // Privilege no longer needed, restore the previous state
+            AdjustTokenPrivileges(token, FALSE, &prevTp, 0, nullptr, nullptr);
+        }
+    }
+
+    CloseHandle(token);
+    return mem;
+  }
+
+#endif
+
+} // namespace
+
+
+/// Memory::bind_local() moves the pages of an existing range, and any page
+/// faulted in later, to the NUMA node of the CPU the caller is running on. It
+/// is used by bound search threads for their tables, which are allocated and
+/// cleared by the main thread. The range is widened to whole pages, so it may
+/// also move the neighbouring data on the first and last page.
+
+bool bind_local(void* ptr, size_t size) {
+
+#if defined(USE_LINUX_NUMA)
+
+  constexpr int MPOL_PREFERRED = 1, MPOL_MF_MOVE = 1 << 1;
+  const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+  const uintptr_t start = uintptr_t(ptr) & ~(pageSize - 1);
+  const uintptr_t end = (uintptr_t(ptr) + size + pageSize - 1) & ~(pageSize - 1);
+  unsigned cpu, node;
+
+  if (popcount(online_nodes()) < 2 || syscall(SYS_getcpu, &cpu, &node, nullptr) || node >= 64)
+      return false;
+
+  unsigned long mask = 1UL << node;
+  return !syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, &mask, 8 * sizeof(mask) + 1, MPOL_MF_MOVE);
+
+#else
+
+  (void)ptr, (void)size;
+  return false;
+
+#endif
+}
+
+
+Block alloc(size_t size, bool largePages, bool numaInterleave) {
+
+  Block b;
+  b.size = size;
+
+#if defined(USE_LINUX_NUMA)
+
+  const size_t hugeSize = (size + HugePageSize - 1) / HugePageSize * HugePageSize;
+
+  if (largePages)
+  {
+      void* mem = mmap(nullptr, hugeSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+      if (mem != MAP_FAILED)
+          b.ptr = mem, b.size = hugeSize, b.flags = HUGETLB | MAPPED;
+
+      else if (!posix_memalign(&mem, HugePageSize, hugeSize))
+      {
+          b.ptr = mem, b.size = hugeSize;
+          if (!madvise(mem, hugeSize, MADV_HUGEPAGE))
+              b.flags = TRANSPARENT_HUGE;
+      }
+  }
+
+  if (!b.ptr && posix_memalign(&b.ptr, CacheLineSize, size))
+      b.ptr = nullptr;
+
+  if (b.ptr && numaInterleave && interleave(b.ptr, b.size))
+      b.flags |= INTERLEAVED;
+
+#elif defined(_WIN32)
+
+  (void)numaInterleave; // First touch by the clearing threads only
+
+  if (largePages && (b.ptr = large_pages_alloc(b.size)) != nullptr)
+      b.flags = HUGETLB | MAPPED;
+  else
+      b.size = size, b.ptr = _aligned_malloc(size, CacheLineSize);
+
+#else
+
+  (void)largePages, (void)numaInterleave;
+
+  if (posix_memalign(&b.ptr, CacheLineSize, size))
+      b.ptr = nullptr;
+
+#endif
+
+  return b;
+}
+
+
+Block alloc_shared(const string& name, size_t size) {
+
+  Block b;
+
+#if defined(_WIN32)
+
+  const DWORD high = DWORD(uint64_t(size) >> 32), low = DWORD(size);
+  HANDLE mapping = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                     high, low, ("Local\\" + name).c_str());
+  if (!mapping)
+      return b;
+
+  const bool created = GetLastError() != ERROR_ALREADY_EXISTS;
+  void* mem = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+
+  if (!mem)
+  {
+      CloseHandle(mapping);
+      return b;
+  }
+
+  b.ptr = mem, b.size = size, b.handle = mapping;
+  b.flags = SHARED | MAPPED | (created ? CREATED : 0);
+
+#else
+
+  const string path = "/" + name;
+  bool created = true;
+  int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+
+  if (fd == -1)
+  {
+      created = false;
+      fd = shm_open(path.c_str(), O_RDWR, 0600);
+  }
+
+  struct stat statbuf;
+
+  if (   fd == -1
+      || (created && ftruncate(fd, off_t(size)))
+      || fstat(fd, &statbuf)
+      || size_t(statbuf.st_size) != size)
+  {
+      if (fd != -1)
+          close(fd);
+      return b;
+  }
+
+  void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (mem == MAP_FAILED)
+      return b;
+
+  b.ptr = mem, b.size = size;
+  b.flags = SHARED | MAPPED | (created ? CREATED : 0);
+
+#endif
+
+  return b;
+}
+
+
+/// Memory::free() releases a block obtained from alloc() and resets it
+
+void free(Block& b) {
+
+  if (b.ptr)
+  {
+#if defined(_WIN32)
+      if (b.flags & SHARED)
+          UnmapViewOfFile(b.ptr), CloseHandle(b.handle);
+      else if (b.flags & MAPPED)
+          VirtualFree(b.ptr, 0, MEM_RELEASE);
+      else
+          _aligned_free(b.ptr);
+#else
+      if (b.flags & MAPPED)
+          munmap(b.ptr, b.size);
+      else
+          std::free(b.ptr);
+#endif
+  }
+
+  b = Block();
+}
+
+
+/// Memory::describe() returns a human readable summary of how a block is backed
+
+string describe(const Block& b) {
+
+  string s =  (b.flags & SHARED)           ? string("shared memory")
+                                             + ((b.flags & CREATED) ? " (created)" : " (attached)")
+            : (b.flags & HUGETLB)          ? "large pages"
+            : (b.flags & TRANSPARENT_HUGE) ? "transparent huge pages"
+                                           : "default pages";
+
+#if defined(USE_LINUX_NUMA)
+  if (b.flags & INTERLEAVED)
+      s += ", interleaved over " + std::to_string(popcount(online_nodes())) + " NUMA nodes";
+#endif
+
+  return s;
+}
+
+} // namespace Memory
@@ -23,6 +23,9 @@
 
 #include <cassert>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
 #include <ostream>
 #include <string>
 #include <vector>
@@ -33,6 +36,8 @@ const std::string engine_info(bool to_uci = false);
 void prefetch(void* addr);
 void prefetch2(void* addr);
 void start_logger(const std::string& fname);
+void flush_output();
+void set_info_interval(int ms);
 
 void dbg_hit_on(bool b);
 void dbg_hit_on(bool c, bool b);
@@ -48,15 +53,6 @@ inline TimePoint now() {
         (std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-template<class Entry, int Size>
-struct HashTable {
-  Entry* operator[](Key key) { return &table[(uint32_t)key & (Size - 1)]; }
-
-private:
-  std::vector<Entry> table = std::vector<Entry>(Size);
-};
-
-
 enum SyncCout { IO_LOCK, IO_UNLOCK };
 std::ostream& operator<<(std::ostream&, SyncCout);
 
@@ -106,9 +102,111 @@ public:
 /// cores. To overcome this, some special platform specific API should be
 /// called to set group affinity for each thread. Original code from Texel by
 /// Peter Österlund.
+///
+/// On Linux the same entry point pins each thread to one CPU, taking the CPUs
+/// node by node as listed in /sys/devices/system/node.
 
 namespace WinProcGroup {
   void bindThisThread(size_t idx);
 }
 
+
+/// Memory::alloc() allocates the big hash tables. When asked for large pages
+/// it tries explicit huge pages first (MAP_HUGETLB on Linux, MEM_LARGE_PAGES
+/// on Windows), then transparent huge pages on Linux, and otherwise falls
+/// back to a plain cache line aligned allocation. On Linux the block can also
+/// be interleaved across all NUMA nodes before its pages are first touched.
+/// The returned Block records what was obtained, to be freed accordingly.
+/// Memory::alloc_shared() instead maps a named shared memory segment, which
+/// is created zero-filled by the first process asking for it and attached to
+/// as is by the others. The segment outlives the processes (on Linux it shows
+/// up in /dev/shm) until removed by hand.
+
+namespace Memory {
+
+  enum Flags {
+    HUGETLB = 1, TRANSPARENT_HUGE = 2, INTERLEAVED = 4, MAPPED = 8, SHARED = 16, CREATED = 32
+  };
+
+  struct Block {
+    void* ptr = nullptr;
+    size_t size = 0;
+    int flags = 0;
+    void* handle = nullptr; // File mapping handle of a shared block on Windows
+  };
+
+  Block alloc(size_t size, bool largePages, bool interleave);
+  Block alloc_shared(const std::string& name, size_t size);
+  bool bind_local(void* ptr, size_t size);
+  void free(Block& block);
+  std::string describe(const Block& block);
+}
+
+
+/// HashTable is a per-thread hash of pawn or material entries. Its size is set
+/// at runtime by resize(), in megabytes rounded down to a power of two number
+/// of entries, and the memory comes from Memory::alloc(). The tables are
+/// allocated by the main thread, so a thread bound to a NUMA node moves its own
+/// tables there with bind_local() before searching.
+///
+/// clear() does not need to zero the table: keys are xored with a salt before
+/// being masked, and changing the low bits of the salt sends every key to a
+/// different slot than the one it was stored in, so no old entry can match.
+/// Only when the salt wraps around is the memory actually cleared.
+
+template<class Entry>
+class HashTable {
+
+public:
+  HashTable() = default;
+  HashTable(const HashTable&) = delete;
+  HashTable& operator=(const HashTable&) = delete;
+  ~HashTable() { Memory::free(mem); }
+
+  Entry* operator[](Key key) { return &table[((uint32_t)key ^ salt) & mask]; }
+
+  void resize(size_t mbSize) {
+
+    size_t entries = mbSize * 1024 * 1024 / sizeof(Entry);
+
+    while (entries & (entries - 1))
+        entries &= entries - 1;
+
+    if (table && entries == mask + 1)
+        return;
+
+    Memory::free(mem);
+    mem = Memory::alloc(entries * sizeof(Entry), false, false);
+
+    if (!mem.ptr)
+    {
+        std::cerr << "Failed to allocate " << mbSize << "MB for a hash table." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    table = static_cast<Entry*>(mem.ptr);
+    mask = entries - 1;
+    bound = false;
+    salt = 0;
+    std::memset(static_cast<void*>(table), 0, entries * sizeof(Entry));
+  }
+
+  void clear() {
+    if (!(salt = (salt + 1) & mask))
+        std::memset(static_cast<void*>(table), 0, (mask + 1) * sizeof(Entry));
+  }
+
+  void bind_local() {
+    if (!bound)
+        bound = true, Memory::bind_local(mem.ptr, mem.size);
+  }
+
+private:
+  Entry* table = nullptr;
+  size_t mask = 0;
+  uint32_t salt = 0;
+  Memory::Block mem;
+  bool bound = false;
+};
+
 #endif // #ifndef MISC_H_INCLUDED
@@ -95,6 +95,26 @@ namespace {
   }
 
 
+  // pin_ray() returns the squares a pinned piece can move to without exposing
+  // its king: the ones between the king and the pinner, and the pinner itself.
+  // Aligned squares beyond the king or the pinner don't do, as a leaper could
+  // jump there.
+  Bitboard pin_ray(const Position& pos, Color us, Square from) {
+
+    Square ksq = pos.square<KING>(us);
+
+    for (Bitboard b = pos.pinners(~us) & LineBB[ksq][from]; b; )
+    {
+        Square pinner = pop_lsb(&b);
+        if (between_bb(ksq, pinner) & from)
+            return between_bb(ksq, pinner) | pinner;
+    }
+
+    assert(false);
+    return 0;
+  }
+
+
   template<Color Us, GenType Type>
   ExtMove* generate_pawn_moves(const Position& pos, ExtMove* moveList, Bitboard target) {
 
@@ -231,13 +251,13 @@ namespace {
   }
 
 
-  template<bool Checks>
-  ExtMove* generate_moves(const Position& pos, ExtMove* moveList, Color us, PieceType pt,
-                          Bitboard target) {
+  template<PieceType Pt, bool Checks>
+  ExtMove* generate_moves(const Position& pos, ExtMove* moveList, Color us,
+                          Bitboard target, Bitboard pinned) {
 
-    assert(pt != KING && pt != PAWN);
+    assert(Pt != KING && Pt != PAWN);
 
-    const Square* pl = pos.squares(us, pt);
+    const Square* pl = pos.squares<Pt>(us);
 
     for (Square from = *pl; from != SQ_NONE; from = *++pl)
     {
@@ -245,10 +265,13 @@ namespace {
         if (Checks && (pos.blockers_for_king(~us) & from))
             continue;
 
-        Bitboard b = pos.attacks_from(us, pt, from) & target;
+        Bitboard b = pos.attacks_from<Pt>(us, from) & target;
+
+        if (pinned & from)
+            b &= pin_ray(pos, us, from);
 
         if (Checks)
-            b &= pos.check_squares(pt);
+            b &= pos.check_squares(Pt);
 
         while (b)
             *moveList++ = make_move(from, pop_lsb(&b));
@@ -260,7 +283,7 @@ namespace {
   // Custom move generation for Betza notation pieces
   template<bool Checks>
   ExtMove* generate_custom_moves(const Position& pos, ExtMove* moveList, Color us, PieceType pt,
-                                 Bitboard target) {
+                                 Bitboard target, Bitboard pinned) {
 
     assert(is_custom(pt) && pt != KING && pt != PAWN);
 
@@ -272,8 +295,14 @@ namespace {
         if (Checks && (pos.blockers_for_king(~us) & from))
             continue;
 
-        // Generate moves using Betza notation pattern for this custom piece
-        Bitboard b = pos.attacks_from_betza(us, pt, from) & target;
+        // Generate moves using Betza notation pattern for this custom piece,
+        // move-only and capture-only patterns apply to empty and occupied
+        // target squares respectively.
+        Bitboard b = (  (pos.attacks_from_betza(us, pt, from, false) & ~pos.pieces())
+                      | (pos.attacks_from_betza(us, pt, from, true) & pos.pieces())) & target;
+
+        if (pinned & from)
+            b &= pin_ray(pos, us, from);
 
         if (Checks)
             b &= pos.check_squares(pt);
@@ -286,19 +315,60 @@ namespace {
   }
 
 
-  template<Color Us, GenType Type>
+  // generate_all() generates the moves of the given type. With Legal set, it
+  // emits only legal ones: pinned pieces stay on their pin ray and the king
+  // doesn't step to an attacked square, en passant captures are tested apart.
+  // This doesn't track the lame or jumping steps of custom pieces.
+
+  template<Color Us, GenType Type, bool Legal = false>
   ExtMove* generate_all(const Position& pos, ExtMove* moveList, Bitboard target) {
 
     constexpr bool Checks = Type == QUIET_CHECKS;
 
+    const Bitboard pinned = Legal ? pos.blockers_for_king(Us) & pos.pieces(Us) : 0;
+    ExtMove* pawnMoves = moveList;
+
     moveList = generate_pawn_moves<Us, Type>(pos, moveList, target);
-    for (PieceType pt = KNIGHT; pt < KING; ++pt)
+
+    // Pawn moves are generated by sets, filter the few ones that are illegal
+    if (Legal && ((pinned & pos.pieces(Us, PAWN)) || pos.ep_square() != SQ_NONE))
     {
-        // Handle custom Betza pieces separately
-        if (is_custom(pt))
-            moveList = generate_custom_moves<Checks>(pos, moveList, Us, pt, target);
-        else
-            moveList = generate_moves<Checks>(pos, moveList, Us, pt, target);
+        for (ExtMove* cur = pawnMoves; cur != moveList; )
+            if (  type_of(cur->move) == ENPASSANT ? !pos.legal(cur->move)
+                : (pinned & from_sq(cur->move)) && !(pin_ray(pos, Us, from_sq(cur->move)) & to_sq(cur->move)))
+                *cur = (--moveList)->move;
+            else
+                ++cur;
+    }
+
+    // Only visit the piece types we actually have on the board
+    uint64_t types = pos.piece_types(Us) & ~((1ULL << PAWN) | (1ULL << KING));
+
+    while (types)
+    {
+        PieceType pt = pop_piece_type(&types);
+
+        switch (pt)
+        {
+        case KNIGHT:     moveList = generate_moves<KNIGHT,     Checks>(pos, moveList, Us, target, pinned); break;
+        case BISHOP:     moveList = generate_moves<BISHOP,     Checks>(pos, moveList, Us, target, pinned); break;
+        case ROOK:       moveList = generate_moves<ROOK,       Checks>(pos, moveList, Us, target, pinned); break;
+        case QUEEN:      moveList = generate_moves<QUEEN,      Checks>(pos, moveList, Us, target, pinned); break;
+        case CANNON:     moveList = generate_moves<CANNON,     Checks>(pos, moveList, Us, target, pinned); break;
+        case LEOPARD:    moveList = generate_moves<LEOPARD,    Checks>(pos, moveList, Us, target, pinned); break;
+        case ARCHBISHOP: moveList = generate_moves<ARCHBISHOP, Checks>(pos, moveList, Us, target, pinned); break;
+        case CHANCELLOR: moveList = generate_moves<CHANCELLOR, Checks>(pos, moveList, Us, target, pinned); break;
+        case SPIDER:     moveList = generate_moves<SPIDER,     Checks>(pos, moveList, Us, target, pinned); break;
+        case DRAGON:     moveList = generate_moves<DRAGON,     Checks>(pos, moveList, Us, target, pinned); break;
+        case UNICORN:    moveList = generate_moves<UNICORN,    Checks>(pos, moveList, Us, target, pinned); break;
+        case HAWK:       moveList = generate_moves<HAWK,       Checks>(pos, moveList, Us, target, pinned); break;
+        case ELEPHANT:   moveList = generate_moves<ELEPHANT,   Checks>(pos, moveList, Us, target, pinned); break;
+        case FORTRESS:   moveList = generate_moves<FORTRESS,   Checks>(pos, moveList, Us, target, pinned); break;
+        default:
+            // Handle custom Betza pieces separately
+            assert(is_custom(pt));
+            moveList = generate_custom_moves<Checks>(pos, moveList, Us, pt, target, pinned);
+        }
     }
 
     if (Type != QUIET_CHECKS && Type != EVASIONS)
@@ -306,7 +376,11 @@ namespace {
         Square ksq = pos.square<KING>(Us);
         Bitboard b = pos.attacks_from<KING>(Us, ksq) & target;
         while (b)
-            *moveList++ = make_move(ksq, pop_lsb(&b));
+        {
+            Square to = pop_lsb(&b);
+            if (!Legal || !(pos.attackers_to(to) & pos.pieces(~Us)))
+                *moveList++ = make_move(ksq, to);
+        }
     }
 
     if (Type != CAPTURES && Type != EVASIONS && pos.can_castle(Us))
@@ -404,47 +478,62 @@ ExtMove* generate<QUIET_CHECKS>(const Position& pos, ExtMove* moveList) {
 }
 
 
-/// generate<EVASIONS> generates all pseudo-legal check evasions when the side
-/// to move is in check. Returns a pointer to the end of the move list.
-template<>
-ExtMove* generate<EVASIONS>(const Position& pos, ExtMove* moveList) {
+namespace {
 
-  if (pos.game_phase() != GAMEPHASE_PLAYING)
-      return moveList;
+  template<bool Legal>
+  ExtMove* generate_evasions(const Position& pos, ExtMove* moveList) {
 
-  assert(pos.checkers());
+    assert(pos.checkers());
 
-  Color us = pos.side_to_move();
-  Square ksq = pos.square<KING>(us);
-  Bitboard sliderAttacks = 0;
-  Bitboard sliders = pos.checkers();
-
-  // Find all the squares attacked by slider checkers. We will remove them from
-  // the king evasions in order to skip known illegal moves, which avoids any
-  // useless legality checks later on.
-  while (sliders)
-  {
-      Square checksq = pop_lsb(&sliders);
-      sliderAttacks |= attacks_bb(~us, type_of(pos.piece_on(checksq)), checksq, pos.pieces() ^ ksq);
+    Color us = pos.side_to_move();
+    Square ksq = pos.square<KING>(us);
+    Bitboard sliderAttacks = 0;
+    Bitboard sliders = pos.checkers();
+
+    // Find all the squares attacked by slider checkers. We will remove them from
+    // the king evasions in order to skip known illegal moves, which avoids any
+    // useless legality checks later on.
+    while (sliders)
+    {
+        Square checksq = pop_lsb(&sliders);
+        sliderAttacks |= attacks_bb(~us, type_of(pos.piece_on(checksq)), checksq, pos.pieces() ^ ksq);
+    }
+
+    // Generate evasions for king, capture and non capture moves
+    Bitboard b = pos.attacks_from<KING>(us, ksq) & ~pos.pieces(us) & ~sliderAttacks;
+    while (b)
+    {
+        Square to = pop_lsb(&b);
+        if (!Legal || !(pos.attackers_to(to) & pos.pieces(~us)))
+            *moveList++ = make_move(ksq, to);
+    }
+
+    if (more_than_one(pos.checkers()))
+        return moveList; // Double check, only a king move can save the day
+
+    // Generate blocking evasions or captures of the checking piece
+    Square checksq = lsb(pos.checkers());
+    Bitboard target = between_bb(checksq, ksq) | checksq;
+    // Leaper attacks can not be blocked
+    if (LeaperAttacks[~us][type_of(pos.piece_on(checksq))][checksq] & ksq)
+        target = SquareBB[checksq];
+
+    return us == WHITE ? generate_all<WHITE, EVASIONS, Legal>(pos, moveList, target)
+                       : generate_all<BLACK, EVASIONS, Legal>(pos, moveList, target);
   }
 
-  // Generate evasions for king, capture and non capture moves
-  Bitboard b = pos.attacks_from<KING>(us, ksq) & ~pos.pieces(us) & ~sliderAttacks;
-  while (b)
-      *moveList++ = make_move(ksq, pop_lsb(&b));
+} // namespace
 
-  if (more_than_one(pos.checkers()))
-      return moveList; // Double check, only a king move can save the day
 
-  // Generate blocking evasions or captures of the checking piece
-  Square checksq = lsb(pos.checkers());
-  Bitboard target = between_bb(checksq, ksq) | checksq;
-  // Leaper attacks can not be blocked
-  if (LeaperAttacks[~us][type_of(pos.piece_on(checksq))][checksq] & ksq)
-      target = SquareBB[checksq];
+/// generate<EVASIONS> generates all pseudo-legal check evasions when the side
+/// to move is in check. Returns a pointer to the end of the move list.
+template<>
+ExtMove* generate<EVASIONS>(const Position& pos, ExtMove* moveList) {
+
+  if (pos.game_phase() != GAMEPHASE_PLAYING)
+      return moveList;
 
-  return us == WHITE ? generate_all<WHITE, EVASIONS>(pos, moveList, target)
-                     : generate_all<BLACK, EVASIONS>(pos, moveList, target);
+  return generate_evasions<false>(pos, moveList);
 }
 
 
@@ -480,21 +569,32 @@ ExtMove* generate<PLACEMENTS>(const Position& pos, ExtMove* moveList) {
   return moveList;
 }
 
-/// generate<LEGAL> generates all the legal moves in the given position
+/// generate<LEGAL> generates all the legal moves in the given position. The pin
+/// rays and the check evasion targets are computed once, so that the moves need
+/// no legality test, see generate_all(). Lame and jumping custom pieces can pin
+/// and check in ways the masks don't cover: with any of them on the other side,
+/// every move is tested instead.
 
 template<>
 ExtMove* generate<LEGAL>(const Position& pos, ExtMove* moveList) {
 
   Color us = pos.side_to_move();
-  Bitboard pinned = pos.blockers_for_king(us) & pos.pieces(us);
-  Square ksq = pos.square<KING>(us);
+
+  if (pos.game_phase() == GAMEPHASE_PLAYING && !pos.betza_slow_pieces(~us))
+  {
+      if (pos.checkers())
+          return generate_evasions<true>(pos, moveList);
+
+      return us == WHITE ? generate_all<WHITE, NON_EVASIONS, true>(pos, moveList, ~pos.pieces(us))
+                         : generate_all<BLACK, NON_EVASIONS, true>(pos, moveList, ~pos.pieces(us));
+  }
+
   ExtMove* cur = moveList;
 
   moveList = pos.checkers() ? generate<EVASIONS    >(pos, moveList)
                             : generate<NON_EVASIONS>(pos, moveList);
   while (cur != moveList)
-      if (   (pinned || from_sq(*cur) == ksq || type_of(*cur) == ENPASSANT)
-          && !pos.legal(*cur))
+      if (!pos.legal(*cur))
           *cur = (--moveList)->move;
       else
           ++cur;
@@ -21,11 +21,12 @@
 #include <cassert>
 
 #include "movepick.h"
+#include "thread.h"
 
 namespace {
 
   enum Stages {
-    MAIN_TT, CAPTURE_INIT, GOOD_CAPTURE, REFUTATION, QUIET_INIT, QUIET, BAD_CAPTURE,
+    MAIN_TT, CAPTURE_INIT, GOOD_CAPTURE, REFUTATION, QUIET_INIT, GATING, QUIET, BAD_CAPTURE,
     EVASION_TT, EVASION_INIT, EVASION,
     PROBCUT_TT, PROBCUT_INIT, PROBCUT,
     QSEARCH_TT, QCAPTURE_INIT, QCAPTURE, QCHECK_INIT, QCHECK
@@ -52,6 +53,50 @@ namespace {
 } // namespace
 
 
+/// HistorySlots::clear() forgets the pieces seen so far, leaving only the
+/// standard types with a slot of their own.
+
+void HistorySlots::clear() {
+
+  assigned = 0;
+  nextSlot = HISTORY_FIXED_TYPES;
+
+  for (Piece pc = NO_PIECE; pc < PIECE_NB; ++pc)
+  {
+      PieceType pt = type_of(pc);
+      int s =  pt <= QUEEN ? pt
+             : pt == KING  ? QUEEN + 1 : HISTORY_TYPE_NB - 1;
+
+      slot[pc] = uint8_t((pc >> PIECE_TYPE_BITS) * HISTORY_TYPE_NB + s);
+
+      if (s != HISTORY_TYPE_NB - 1)
+          assigned |= 1ULL << pt;
+  }
+}
+
+/// HistorySlots::add() gives a free slot to the piece types on the board or
+/// waiting at a gate that do not have one yet.
+
+void HistorySlots::add(const Position& pos) {
+
+  uint64_t types = pos.piece_types();
+
+  for (Gate g = GATE_1; g < GATE_NB; ++g)
+      types |= 1ULL << pos.gating_piece(g);
+
+  types &= ~assigned;
+
+  while (types && nextSlot < HISTORY_TYPE_NB - 1)
+  {
+      PieceType pt = pop_piece_type(&types);
+
+      slot[make_piece(WHITE, pt)] = uint8_t(nextSlot);
+      slot[make_piece(BLACK, pt)] = uint8_t(HISTORY_TYPE_NB + nextSlot++);
+      assigned |= 1ULL << pt;
+  }
+}
+
+
 /// Constructors of the MovePicker class. As arguments we pass information
 /// to help it to return the (presumably) good moves first, to decide which
 /// moves to return (in the quiescence search, for instance, we only want to
@@ -59,9 +104,9 @@ namespace {
 /// ordering is at the current node.
 
 /// MovePicker constructor for the main search
-MovePicker::MovePicker(const Position& p, Move ttm, Depth d, const ButterflyHistory* mh,
+MovePicker::MovePicker(const Position& p, Move ttm, Depth d, const ButterflyHistory* mh, const GatingHistory* gh,
                        const CapturePieceToHistory* cph, const PieceToHistory** ch, Move cm, Move* killers)
-           : pos(p), mainHistory(mh), captureHistory(cph), contHistory(ch),
+           : pos(p), slots(p.this_thread()->historySlots), mainHistory(mh), gatingHistory(gh), captureHistory(cph), contHistory(ch),
              refutations{{killers[0], 0}, {killers[1], 0}, {cm, 0}}, depth(d) {
 
   assert(d > DEPTH_ZERO);
@@ -74,7 +119,7 @@ MovePicker::MovePicker(const Position& p, Move ttm, Depth d, const ButterflyHist
 /// MovePicker constructor for quiescence search
 MovePicker::MovePicker(const Position& p, Move ttm, Depth d, const ButterflyHistory* mh,
                        const CapturePieceToHistory* cph, Square rs)
-           : pos(p), mainHistory(mh), captureHistory(cph), recaptureSquare(rs), depth(d) {
+           : pos(p), slots(p.this_thread()->historySlots), mainHistory(mh), captureHistory(cph), recaptureSquare(rs), depth(d) {
 
   assert(d <= DEPTH_ZERO);
 
@@ -88,7 +133,7 @@ MovePicker::MovePicker(const Position& p, Move ttm, Depth d, const ButterflyHist
 /// MovePicker constructor for ProbCut: we generate captures with SEE greater
 /// than or equal to the given threshold.
 MovePicker::MovePicker(const Position& p, Move ttm, Value th, const CapturePieceToHistory* cph)
-           : pos(p), captureHistory(cph), threshold(th) {
+           : pos(p), slots(p.this_thread()->historySlots), captureHistory(cph), threshold(th) {
 
   assert(!pos.checkers());
 
@@ -111,13 +156,13 @@ void MovePicker::score() {
   for (auto& m : *this)
       if (Type == CAPTURES)
           m.value =  PieceValue[MG][pos.piece_on(to_sq(m))]
-                   + (*captureHistory)[pos.moved_piece(m)][to_sq(m)][type_of(pos.piece_on(to_sq(m)))] / 16;
+                   + (*captureHistory)[slots[pos.moved_piece(m)]][to_sq(m)][slots[type_of(pos.piece_on(to_sq(m)))]] / 16;
 
       else if (Type == QUIETS)
           m.value =  (*mainHistory)[pos.side_to_move()][from_to(m)]
-                   + (*contHistory[0])[pos.moved_piece(m)][to_sq(m)]
-                   + (*contHistory[1])[pos.moved_piece(m)][to_sq(m)]
-                   + (*contHistory[3])[pos.moved_piece(m)][to_sq(m)];
+                   + (*contHistory[0])[slots[pos.moved_piece(m)]][to_sq(m)]
+                   + (*contHistory[1])[slots[pos.moved_piece(m)]][to_sq(m)]
+                   + (*contHistory[3])[slots[pos.moved_piece(m)]][to_sq(m)];
 
       else // Type == EVASIONS
       {
@@ -142,7 +187,10 @@ Move MovePicker::select(Pred filter) {
       move = *cur++;
 
       if (move != ttMove && filter())
+      {
+          STAT_INC(pos.this_thread(), stageMoves[stage]);
           return move;
+      }
   }
   return move = MOVE_NONE;
 }
@@ -159,6 +207,7 @@ top:
   case EVASION_TT:
   case QSEARCH_TT:
   case PROBCUT_TT:
+      STAT_INC(pos.this_thread(), stageMoves[stage]);
       ++stage;
       return ttMove;
 
@@ -166,7 +215,7 @@ top:
   case PROBCUT_INIT:
   case QCAPTURE_INIT:
       cur = endBadCaptures = moves;
-      endMoves = generate<CAPTURES>(pos, cur);
+      endMoves = STAT_TIME(pos.this_thread(), PH_MOVEGEN, generate<CAPTURES>(pos, cur));
 
       score<CAPTURES>();
       ++stage;
@@ -201,10 +250,42 @@ top:
 
   case QUIET_INIT:
       cur = endBadCaptures;
-      endMoves = generate<QUIETS>(pos, cur);
+      endMoves = STAT_TIME(pos.this_thread(), PH_MOVEGEN, generate<QUIETS>(pos, cur));
 
       score<QUIETS>();
-      partial_insertion_sort(cur, endMoves, -4000 * depth / ONE_PLY);
+
+      // Move the quiets that leave a gate to the front, to be tried in their
+      // own stage ordered with the help of the gating history.
+      endQuiets = endMoves;
+      if (pos.gates() & pos.pieces(pos.side_to_move()))
+      {
+          endMoves = std::partition(cur, endMoves, [&](const ExtMove& m){
+                                    return pos.released_gate(m) != SQ_NONE; });
+
+          for (ExtMove* m = cur; m < endMoves; ++m)
+          {
+              Square s = pos.released_gate(*m);
+              m->value += 2 * (*gatingHistory)[pos.side_to_move()][pos.gating_piece(s)][s];
+          }
+      }
+      else
+          endMoves = cur;
+
+      partial_insertion_sort(endMoves, endQuiets, -4000 * depth / ONE_PLY);
+      ++stage;
+      /* fallthrough */
+
+  case GATING:
+      if (   !skipQuiets
+          && select<Best>([&](){return   move != refutations[0]
+                                      && move != refutations[1]
+                                      && move != refutations[2];}))
+          return move;
+
+      // Prepare the pointers to loop over the remaining quiets
+      cur = endMoves;
+      endMoves = endQuiets;
+
       ++stage;
       /* fallthrough */
 
@@ -227,7 +308,7 @@ top:
 
   case EVASION_INIT:
       cur = moves;
-      endMoves = generate<EVASIONS>(pos, cur);
+      endMoves = STAT_TIME(pos.this_thread(), PH_MOVEGEN, generate<EVASIONS>(pos, cur));
 
       score<EVASIONS>();
       ++stage;
@@ -253,7 +334,7 @@ top:
 
   case QCHECK_INIT:
       cur = moves;
-      endMoves = generate<QUIET_CHECKS>(pos, cur);
+      endMoves = STAT_TIME(pos.this_thread(), PH_MOVEGEN, generate<QUIET_CHECKS>(pos, cur));
 
       ++stage;
       /* fallthrough */
@@ -87,20 +87,55 @@ enum StatsParams { NOT_USED = 0 };
 /// the move's from and to squares, see chessprogramming.wikispaces.com/Butterfly+Boards
 typedef Stats<int16_t, 10368, COLOR_NB, int(SQUARE_NB) * int(SQUARE_NB)> ButterflyHistory;
 
+/// GatingHistory records how often quiet moves that leave a gate, and so bring
+/// the waiting piece into play, have been successful. It is indexed by the
+/// [color][gated piece type][gate square], so that it learns which pieces are
+/// worth developing from which gates independently of the move that does it.
+typedef Stats<int16_t, 10368, COLOR_NB, PIECE_TYPE_USED, SQUARE_NB> GatingHistory;
+
+/// HistorySlots maps pieces to the dense range [0, HISTORY_PIECE_NB) used by
+/// the tables below that are indexed by piece or by captured piece type. A game
+/// only ever has a handful of the PIECE_TYPE_USED types in play, so the standard
+/// types have fixed slots and the others get one of the free slots the first
+/// time they are seen at the root. Types without a slot of their own, because
+/// they are not in play yet or because the free slots ran out, share the last
+/// one. Slots are only handed out again after clear(), so the histories keep
+/// their meaning for the whole game.
+enum HistoryLayout {
+  HISTORY_FIXED_TYPES = QUEEN + 2, // NO_PIECE_TYPE, PAWN to QUEEN and KING
+  HISTORY_FREE_TYPES = 4,
+  HISTORY_TYPE_NB = HISTORY_FIXED_TYPES + HISTORY_FREE_TYPES + 1,
+  HISTORY_PIECE_NB = 2 * HISTORY_TYPE_NB
+};
+
+class HistorySlots {
+
+public:
+  void clear();
+  void add(const Position& pos);
+  int operator[](Piece pc) const { return slot[pc]; }
+  int operator[](PieceType pt) const { return slot[pt]; }
+
+private:
+  uint64_t assigned;
+  int nextSlot;
+  uint8_t slot[PIECE_NB];
+};
+
 /// CounterMoveHistory stores counter moves indexed by [piece][to] of the previous
 /// move, see chessprogramming.wikispaces.com/Countermove+Heuristic
-typedef Stats<Move, NOT_USED, PIECE_NB, SQUARE_NB> CounterMoveHistory;
+typedef Stats<Move, NOT_USED, HISTORY_PIECE_NB, SQUARE_NB> CounterMoveHistory;
 
 /// CapturePieceToHistory is addressed by a move's [piece][to][captured piece type]
-typedef Stats<int16_t, 10368, PIECE_NB, SQUARE_NB, PIECE_TYPE_NB> CapturePieceToHistory;
+typedef Stats<int16_t, 10368, HISTORY_PIECE_NB, SQUARE_NB, HISTORY_TYPE_NB> CapturePieceToHistory;
 
 /// PieceToHistory is like ButterflyHistory but is addressed by a move's [piece][to]
-typedef Stats<int16_t, 29952, PIECE_NB, SQUARE_NB> PieceToHistory;
+typedef Stats<int16_t, 29952, HISTORY_PIECE_NB, SQUARE_NB> PieceToHistory;
 
 /// ContinuationHistory is the combined history of a given pair of moves, usually
 /// the current one given a previous one. The nested history table is based on
 /// PieceToHistory instead of ButterflyBoards.
-typedef Stats<PieceToHistory, NOT_USED, PIECE_NB, SQUARE_NB> ContinuationHistory;
+typedef Stats<PieceToHistory, NOT_USED, HISTORY_PIECE_NB, SQUARE_NB> ContinuationHistory;
 
 
 /// MovePicker class is used to pick one pseudo legal move at a time from the
@@ -121,6 +156,7 @@ public:
                                            const CapturePieceToHistory*,
                                            Square);
   MovePicker(const Position&, Move, Depth, const ButterflyHistory*,
+                                           const GatingHistory*,
                                            const CapturePieceToHistory*,
                                            const PieceToHistory**,
                                            Move,
@@ -134,11 +170,13 @@ private:
   ExtMove* end() { return endMoves; }
 
   const Position& pos;
+  const HistorySlots& slots;
   const ButterflyHistory* mainHistory;
+  const GatingHistory* gatingHistory;
   const CapturePieceToHistory* captureHistory;
   const PieceToHistory** contHistory;
   Move ttMove;
-  ExtMove refutations[3], *cur, *endMoves, *endBadCaptures;
+  ExtMove refutations[3], *cur, *endMoves, *endBadCaptures, *endQuiets;
   int stage;
   Move move;
   Square recaptureSquare;
@@ -0,0 +1,412 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2018 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>   // For std::memcpy, std::memcmp
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+
+#include "evaluate.h"
+#include "misc.h"
+#include "nnue.h"
+#include "position.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace Eval {
+namespace NNUE {
+
+namespace {
+
+  // A network file starts with Version, ArchHash and a length prefixed
+  // description, then all the parameters follow in little endian order.
+  constexpr uint32_t Version  = 0x4D4E4E01;
+  constexpr uint32_t ArchHash =  uint32_t(InputDimensions) * 0x9E3779B1u
+                               ^ uint32_t(HalfDimensions << 20 | Hidden1 << 10 | Hidden2);
+
+  constexpr int WeightScaleBits = 6;  // Hidden layer outputs are shifted by this
+  constexpr int OutputScale     = 16; // Network output units per centipawn-ish Value
+
+  // The output is clamped so that, with the tempo added by Eval::evaluate(),
+  // a static evaluation is never taken for a mate score.
+  constexpr int MaxOutput = VALUE_MATE_IN_MAX_PLY - 1 - Tempo;
+
+  // The network parameters. The feature transformer is large, but as static
+  // data it only takes memory once a network is loaded.
+  alignas(64) int16_t FeatureBiases[HalfDimensions];
+  alignas(64) int16_t FeatureWeights[InputDimensions * HalfDimensions];
+  alignas(64) int32_t Biases1[Hidden1];
+  alignas(64) int8_t  Weights1[Hidden1 * 2 * HalfDimensions];
+  alignas(64) int32_t Biases2[Hidden2];
+  alignas(64) int8_t  Weights2[Hidden2 * Hidden1];
+  alignas(64) int32_t OutputBias;
+  alignas(64) int8_t  OutputWeights[Hidden2];
+
+  // Feature indices of a piece on the board and of a piece at a gate, as seen
+  // by perspective 'p' whose king is in bucket 'b'.
+  int board_index(Color p, int b, Piece pc, Square s) {
+    int slot = (color_of(pc) != p) * (KING - PAWN) + type_of(pc) - PAWN;
+    return b * FeaturesPerBucket + slot * SQUARE_NB + relative_square(p, s);
+  }
+
+  int gate_index(Color p, int b, Piece pc, Square s) {
+    int slot = (color_of(pc) != p) * (KING - PAWN) + type_of(pc) - PAWN;
+    return b * FeaturesPerBucket + PieceSlots * SQUARE_NB + slot * FILE_NB + file_of(s);
+  }
+
+  int bucket(const Position& pos, Color p) { return file_of(pos.square<KING>(p)); }
+
+
+  // Vector kernels. add_row() and sub_row() update HalfDimensions int16 values,
+  // dot() is the product of 'n' uint8 inputs and int8 weights, with 'n' a
+  // multiple of 32, and pack() clips int16 values to [0, 127] as uint8.
+
+  void add_row(int16_t* acc, const int16_t* w) {
+#if defined(__AVX2__)
+    for (int i = 0; i < HalfDimensions; i += 16)
+    {
+        __m256i* a = reinterpret_cast<__m256i*>(acc + i);
+        *a = _mm256_add_epi16(*a, *reinterpret_cast<const __m256i*>(w + i));
+    }
+#elif defined(__SSE2__)
+    for (int i = 0; i < HalfDimensions; i += 8)
+    {
+        __m128i* a = reinterpret_cast<__m128i*>(acc + i);
+        *a = _mm_add_epi16(*a, *reinterpret_cast<const __m128i*>(w + i));
+    }
+#elif defined(__ARM_NEON)
+    for (int i = 0; i < HalfDimensions; i += 8)
+        vst1q_s16(acc + i, vaddq_s16(vld1q_s16(acc + i), vld1q_s16(w + i)));
+#else
+    for (int i = 0; i < HalfDimensions; ++i)
+        acc[i] += w[i];
+#endif
+  }
+
+  void sub_row(int16_t* acc, const int16_t* w) {
+#if defined(__AVX2__)
+    for (int i = 0; i < HalfDimensions; i += 16)
+    {
+        __m256i* a = reinterpret_cast<__m256i*>(acc + i);
+        *a = _mm256_sub_epi16(*a, *reinterpret_cast<const __m256i*>(w + i));
+    }
+#elif defined(__SSE2__)
+    for (int i = 0; i < HalfDimensions; i += 8)
+    {
+        __m128i* a = reinterpret_cast<__m128i*>(acc + i);
+        *a = _mm_sub_epi16(*a, *reinterpret_cast<const __m128i*>(w + i));
+    }
+#elif defined(__ARM_NEON)
+    for (int i = 0; i < HalfDimensions; i += 8)
+        vst1q_s16(acc + i, vsubq_s16(vld1q_s16(acc + i), vld1q_s16(w + i)));
+#else
+    for (int i = 0; i < HalfDimensions; ++i)
+        acc[i] -= w[i];
+#endif
+  }
+
+  int32_t dot(const uint8_t* in, const int8_t* w, int n) {
+#if defined(__AVX2__)
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i sum = _mm256_setzero_si256();
+    for (int i = 0; i < n; i += 32)
+    {
+        __m256i p = _mm256_maddubs_epi16(*reinterpret_cast<const __m256i*>(in + i),
+                                         *reinterpret_cast<const __m256i*>(w + i));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(p, ones));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+    return _mm_cvtsi128_si32(s);
+#elif defined(__SSSE3__)
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i sum = _mm_setzero_si128();
+    for (int i = 0; i < n; i += 16)
+    {
+        __m128i p = _mm_maddubs_epi16(*reinterpret_cast<const __m128i*>(in + i),
+                                      *reinterpret_cast<const __m128i*>(w + i));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(p, ones));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+#elif defined(__SSE2__)
+    // Without pmaddubsw both operands are widened to 16 bits first
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum = _mm_setzero_si128();
+    for (int i = 0; i < n; i += 16)
+    {
+        __m128i a = *reinterpret_cast<const __m128i*>(in + i);
+        __m128i b = *reinterpret_cast<const __m128i*>(w + i);
+        __m128i bl = _mm_srai_epi16(_mm_unpacklo_epi8(b, b), 8);
+        __m128i bh = _mm_srai_epi16(_mm_unpackhi_epi8(b, b), 8);
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi8(a, zero), bl));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpackhi_epi8(a, zero), bh));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+#elif defined(__ARM_NEON)
+    // Inputs are at most 127, so they can be multiplied as signed bytes
+    int32x4_t sum = vdupq_n_s32(0);
+    for (int i = 0; i < n; i += 16)
+    {
+        int8x16_t a = vreinterpretq_s8_u8(vld1q_u8(in + i));
+        int8x16_t b = vld1q_s8(w + i);
+        int16x8_t p = vmull_s8(vget_low_s8(a), vget_low_s8(b));
+        p = vmlal_s8(p, vget_high_s8(a), vget_high_s8(b));
+        sum = vpadalq_s16(sum, p);
+    }
+    return vgetq_lane_s32(sum, 0) + vgetq_lane_s32(sum, 1) + vgetq_lane_s32(sum, 2) + vgetq_lane_s32(sum, 3);
+#else
+    int32_t sum = 0;
+    for (int i = 0; i < n; ++i)
+        sum += in[i] * w[i];
+    return sum;
+#endif
+  }
+
+  void pack(const int16_t* acc, uint8_t* out) {
+#if defined(__AVX2__)
+    const __m256i max = _mm256_set1_epi8(127);
+    for (int i = 0; i < HalfDimensions; i += 32)
+    {
+        __m256i v = _mm256_packus_epi16(*reinterpret_cast<const __m256i*>(acc + i),
+                                        *reinterpret_cast<const __m256i*>(acc + i + 16));
+        v = _mm256_permute4x64_epi64(_mm256_min_epu8(v, max), 0xD8);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(out + i), v);
+    }
+#elif defined(__SSE2__)
+    const __m128i max = _mm_set1_epi8(127);
+    for (int i = 0; i < HalfDimensions; i += 16)
+    {
+        __m128i v = _mm_packus_epi16(*reinterpret_cast<const __m128i*>(acc + i),
+                                     *reinterpret_cast<const __m128i*>(acc + i + 8));
+        _mm_store_si128(reinterpret_cast<__m128i*>(out + i), _mm_min_epu8(v, max));
+    }
+#elif defined(__ARM_NEON)
+    const uint8x8_t max = vdup_n_u8(127);
+    for (int i = 0; i < HalfDimensions; i += 8)
+        vst1_u8(out + i, vmin_u8(vqmovun_s16(vld1q_s16(acc + i)), max));
+#else
+    for (int i = 0; i < HalfDimensions; ++i)
+        out[i] = uint8_t(std::max(0, std::min(127, int(acc[i]))));
+#endif
+  }
+
+
+  // refresh() sums the features of the position for perspective 'p'
+  void refresh(const Position& pos, Color p, Accumulator& acc) {
+
+    int b = acc.bucket[p] = bucket(pos, p);
+    int16_t* v = acc.values[p];
+
+    std::memcpy(v, FeatureBiases, sizeof(FeatureBiases));
+
+    for (Bitboard pcs = pos.pieces() ^ pos.pieces(KING); pcs; )
+    {
+        Square s = pop_lsb(&pcs);
+        add_row(v, &FeatureWeights[board_index(p, b, pos.piece_on(s), s) * HalfDimensions]);
+    }
+
+    for (Color c = WHITE; c <= BLACK; ++c)
+        for (Gate g = Gate(NO_GATE + 1); g < GATE_NB; ++g)
+        {
+            Square s = pos.gating_square(c, g);
+            if (s != SQ_NONE && (pos.gates() & s))
+                add_row(v, &FeatureWeights[gate_index(p, b, make_piece(c, pos.gating_piece(g)), s) * HalfDimensions]);
+        }
+  }
+
+  // update() applies the changes of the last move to the previous accumulator,
+  // or falls back to a refresh when the king changed bucket.
+  void update(const Position& pos, StateInfo* st) {
+
+    Accumulator& acc = st->accumulator;
+    const StateInfo* prev = st->previous;
+    bool incremental =  prev
+                      && prev->accumulator.computed
+                      && st->dirty.count <= MaxDirty;
+
+    for (Color p = WHITE; p <= BLACK; ++p)
+    {
+        int b = bucket(pos, p);
+
+        if (!incremental || prev->accumulator.bucket[p] != b)
+        {
+            refresh(pos, p, acc);
+            continue;
+        }
+
+        int16_t* v = acc.values[p];
+        std::memcpy(v, prev->accumulator.values[p], sizeof(acc.values[p]));
+        acc.bucket[p] = b;
+
+        for (int i = 0; i < st->dirty.count; ++i)
+        {
+            int change = st->dirty.change[i];
+            Square s = Square(change & 63);
+            Piece pc = Piece((change >> 6) & 127);
+
+            if (type_of(pc) == KING)
+                continue;
+
+            int idx = change & (1 << 13) ? gate_index(p, b, pc, s) : board_index(p, b, pc, s);
+
+            if (change & (1 << 14))
+                add_row(v, &FeatureWeights[idx * HalfDimensions]);
+            else
+                sub_row(v, &FeatureWeights[idx * HalfDimensions]);
+        }
+    }
+
+    acc.computed = true;
+
+#ifndef NDEBUG
+    Accumulator check;
+    refresh(pos, WHITE, check);
+    refresh(pos, BLACK, check);
+    assert(!std::memcmp(check.values, acc.values, sizeof(acc.values)));
+#endif
+  }
+
+  // The hidden layers are affine transforms of uint8 inputs followed by a
+  // clipped ReLU, which shifts the sums back and clips them to [0, 127].
+  template<int In, int Out>
+  void affine_relu(const uint8_t* in, const int32_t* biases, const int8_t* weights, uint8_t* out) {
+
+    for (int i = 0; i < Out; ++i)
+    {
+        int32_t sum = biases[i] + dot(in, weights + i * In, In);
+        out[i] = uint8_t(std::max(0, std::min(127, sum >> WeightScaleBits)));
+    }
+  }
+
+
+  // Parameters are read byte by byte, so that the file format does not depend
+  // on the endianness of the machine.
+  template<typename T>
+  bool read(std::istream& is, T* out, size_t count) {
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        unsigned char buf[sizeof(T)];
+        if (!is.read(reinterpret_cast<char*>(buf), sizeof(T)))
+            return false;
+
+        typename std::make_unsigned<T>::type u = 0;
+        for (size_t j = 0; j < sizeof(T); ++j)
+            u |= typename std::make_unsigned<T>::type(buf[j]) << (8 * j);
+
+        out[i] = T(u);
+    }
+    return true;
+  }
+
+  bool read_network(std::istream& is) {
+
+    uint32_t version, hash, descLength;
+
+    if (   !read(is, &version, 1) || version != Version
+        || !read(is, &hash, 1)    || hash != ArchHash
+        || !read(is, &descLength, 1))
+        return false;
+
+    is.ignore(descLength);
+
+    return   read(is, FeatureBiases, HalfDimensions)
+          && read(is, FeatureWeights, size_t(InputDimensions) * HalfDimensions)
+          && read(is, Biases1, Hidden1)
+          && read(is, Weights1, Hidden1 * 2 * HalfDimensions)
+          && read(is, Biases2, Hidden2)
+          && read(is, Weights2, Hidden2 * Hidden1)
+          && read(is, &OutputBias, 1)
+          && read(is, OutputWeights, Hidden2)
+          && is.peek() == std::ifstream::traits_type::eof();
+  }
+
+} // namespace
+
+
+bool Loaded = false;
+
+
+/// NNUE::init() loads the network given by the "EvalFile" option. An empty
+/// name or a file which doesn't fit this architecture leaves the classical
+/// evaluation in charge.
+
+void init(const std::string& evalFile) {
+
+  Loaded = false;
+
+  if (evalFile.empty() || evalFile == "<empty>")
+      return;
+
+  std::ifstream file(evalFile, std::ios::binary);
+  Loaded = file && read_network(file);
+
+  if (Loaded)
+      sync_cout << "info string NNUE evaluation using " << evalFile << sync_endl;
+  else
+      sync_cout << "info string Could not load NNUE network " << evalFile
+                << ", using the classical evaluation" << sync_endl;
+}
+
+
+/// NNUE::evaluate() returns the network evaluation of the position from the
+/// point of view of the side to move.
+
+Value evaluate(const Position& pos) {
+
+  assert(Loaded);
+
+  StateInfo* st = pos.state();
+
+  if (!st->accumulator.computed)
+      update(pos, st);
+
+  alignas(64) uint8_t input[2 * HalfDimensions];
+  alignas(64) uint8_t hidden1[Hidden1];
+  alignas(64) uint8_t hidden2[Hidden2];
+
+  pack(st->accumulator.values[ pos.side_to_move()], input);
+  pack(st->accumulator.values[~pos.side_to_move()], input + HalfDimensions);
+
+  affine_relu<2 * HalfDimensions, Hidden1>(input, Biases1, Weights1, hidden1);
+  affine_relu<Hidden1, Hidden2>(hidden1, Biases2, Weights2, hidden2);
+
+  int v = (OutputBias + dot(hidden2, OutputWeights, Hidden2)) / OutputScale;
+
+  return Value(std::max(-MaxOutput, std::min(MaxOutput, v)));
+}
+
+} // namespace NNUE
+} // namespace Eval
@@ -0,0 +1,91 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2018 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef NNUE_H_INCLUDED
+#define NNUE_H_INCLUDED
+
+#include <cstdint>
+#include <string>
+
+#include "types.h"
+
+class Position;
+
+namespace Eval {
+namespace NNUE {
+
+/// The network input is seen from both sides. For each side every piece but
+/// the kings is a feature, indexed by the file of the own king, by whether the
+/// piece is ours or theirs, by its type and by its square, with the board
+/// flipped so that our pieces start on the first rank. Pieces still waiting
+/// at a gate have their own features, indexed by the gate file only.
+
+constexpr int KingBuckets       = FILE_NB;
+constexpr int PieceSlots        = 2 * (KING - PAWN);
+constexpr int FeaturesPerBucket = PieceSlots * (SQUARE_NB + FILE_NB);
+constexpr int InputDimensions   = KingBuckets * FeaturesPerBucket;
+constexpr int HalfDimensions    = 256;
+constexpr int Hidden1           = 32;
+constexpr int Hidden2           = 32;
+
+constexpr int MaxDirty = 16;
+
+extern bool Loaded; // Set by init() when a network is loaded
+
+/// DirtyPieces records the pieces and gates a move puts on the board and takes
+/// off it, so that evaluate() can update the accumulator of the previous
+/// position instead of summing all the features again. Each change is packed
+/// as square | piece << 6 | gate << 13 | added << 14; when a move makes more
+/// than MaxDirty changes the accumulator is simply refreshed. Nothing is
+/// recorded while the classical evaluation is in use.
+
+struct DirtyPieces {
+
+  void reset() { count = 0; }
+
+  void push(Piece pc, Square s, bool gate, bool added) {
+    if (!Loaded)
+        return;
+    if (count < MaxDirty)
+        change[count] = uint16_t(s | pc << 6 | gate << 13 | added << 14);
+    ++count;
+  }
+
+  int count;
+  uint16_t change[MaxDirty];
+};
+
+/// Accumulator holds the first layer output for both perspectives, computed
+/// lazily by evaluate() and kept in the StateInfo of the position.
+
+struct alignas(32) Accumulator {
+  int16_t values[COLOR_NB][HalfDimensions];
+  int bucket[COLOR_NB];
+  bool computed;
+};
+
+void init(const std::string& evalFile);
+inline bool enabled() { return Loaded; }
+Value evaluate(const Position& pos);
+
+} // namespace NNUE
+} // namespace Eval
+
+#endif // #ifndef NNUE_H_INCLUDED
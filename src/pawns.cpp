@@ -184,8 +184,13 @@ Entry* probe(const Position& pos) {
   Key key = pos.pawn_key();
   Entry* e = pos.this_thread()->pawnsTable[key];
 
+  STAT_INC(pos.this_thread(), pawnProbes);
+
   if (e->key == key)
+  {
+      STAT_INC(pos.this_thread(), pawnHits);
       return e;
+  }
 
   e->key = key;
   e->scores[WHITE] = evaluate<WHITE>(pos, e);
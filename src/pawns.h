@@ -76,7 +76,7 @@ struct Entry {
   int openFiles;
 };
 
-typedef HashTable<Entry, 16384> Table;
+typedef HashTable<Entry> Table;
 
 void init();
 Entry* probe(const Position& pos);
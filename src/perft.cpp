@@ -0,0 +1,186 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2018 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <vector>
+
+#include "movegen.h"
+#include "perft.h"
+#include "search.h"
+#include "thread.h"
+#include "uci.h"
+
+namespace {
+
+  /// Entry stores the leaf count of a subtree together with its remaining
+  /// depth. The key is stored xor-ed with the data, so that an entry torn by
+  /// concurrent writers from different threads fails the key check instead of
+  /// returning a wrong count.
+  ///
+  /// depth      8 bit
+  /// nodes     56 bit
+
+  struct Entry {
+    Key keyXorData;
+    uint64_t data;
+  };
+
+  constexpr int MinHashDepth = 2; // Depth 1 is bulk-counted, no need to cache it
+
+  std::vector<Entry> Table;
+  size_t RequestedMB;
+
+  std::vector<uint64_t> RootCounts;
+  std::atomic<size_t> NextRootMove;
+
+  Entry* entry(Key key) {
+    return &Table[(uint32_t(key) * uint64_t(Table.size())) >> 32];
+  }
+
+  // count() returns the number of leaf nodes at the given depth. Leaves are
+  // not visited: at depth 1 the size of the legal move list is returned.
+  uint64_t count(Position& pos, int depth) {
+
+    if (depth == 1)
+        return MoveList<LEGAL>(pos).size();
+
+    const bool useHash = depth >= MinHashDepth && !Table.empty();
+    const Key key = pos.key();
+
+    if (useHash)
+    {
+        const Entry* e = entry(key);
+        const uint64_t data = e->data;
+
+        if ((e->keyXorData ^ data) == key && int(data & 0xFF) == depth)
+            return data >> 8;
+    }
+
+    StateInfo st;
+    uint64_t nodes = 0;
+
+    for (const auto& m : MoveList<LEGAL>(pos))
+    {
+        pos.do_move(m, st);
+        nodes += count(pos, depth - 1);
+        pos.undo_move(m);
+    }
+
+    if (useHash)
+    {
+        Entry* e = entry(key);
+        const uint64_t data = (nodes << 8) | uint64_t(depth);
+
+        e->keyXorData = key ^ data;
+        e->data = data;
+    }
+
+    return nodes;
+  }
+
+} // namespace
+
+
+/// Perft::resize() sets the size of the perft hash table in megabytes. The
+/// allocation is deferred until the next perft run, so that the memory is
+/// not taken by engines that never run perft. A size of 0 disables the table.
+
+void Perft::resize(size_t mbSize) {
+
+  RequestedMB = mbSize;
+  Table.clear();
+  Table.shrink_to_fit();
+}
+
+
+/// Perft::clear() empties the perft hash table when the user asks to clear
+/// the hash. Stored counts never become stale, so this is not done for a new
+/// game: it is only useful to time the move generator from a cold table.
+
+void Perft::clear() {
+
+  std::fill(Table.begin(), Table.end(), Entry());
+}
+
+
+void Perft::run(MainThread* mainThread) {
+
+  const size_t entries = RequestedMB * 1024 * 1024 / sizeof(Entry);
+
+  if (Table.size() != entries)
+      Table.assign(entries, Entry());
+
+  RootCounts.assign(mainThread->rootMoves.size(), 0);
+  NextRootMove = 0;
+
+  for (Thread* th : Threads)
+      if (th != mainThread)
+          th->start_searching();
+
+  search(mainThread);
+
+  for (Thread* th : Threads)
+      if (th != mainThread)
+          th->wait_for_search_finished();
+
+  // do_move() counts visited nodes, but perft reports leaves, so overwrite
+  // the counters to let 'bench' sum them up as usual.
+  uint64_t nodes = 0;
+
+  for (uint64_t cnt : RootCounts)
+      nodes += cnt;
+
+  for (Thread* th : Threads)
+      th->nodes = 0;
+
+  mainThread->nodes = nodes;
+
+  if (Search::Limits.divide)
+      for (size_t i = 0; i < RootCounts.size(); ++i)
+          sync_cout << UCI::move(mainThread->rootMoves[i].pv[0], mainThread->rootPos)
+                    << ": " << RootCounts[i] << sync_endl;
+
+  sync_cout << "\nNodes searched: " << nodes << "\n" << sync_endl;
+}
+
+
+void Perft::search(Thread* th) {
+
+  Position& pos = th->rootPos;
+  StateInfo st;
+  size_t idx;
+
+  while ((idx = NextRootMove++) < th->rootMoves.size())
+  {
+      const Move m = th->rootMoves[idx].pv[0];
+      uint64_t cnt = 1;
+
+      if (Search::Limits.perft > 1)
+      {
+          pos.do_move(m, st);
+          cnt = count(pos, Search::Limits.perft - 1);
+          pos.undo_move(m);
+      }
+
+      RootCounts[idx] = cnt;
+  }
+}
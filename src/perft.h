@@ -0,0 +1,47 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2018 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PERFT_H_INCLUDED
+#define PERFT_H_INCLUDED
+
+#include <cstddef>
+
+class Thread;
+struct MainThread;
+
+namespace Perft {
+
+/// Perft::run() is called by the main thread instead of the search when the
+/// GUI asks for 'go perft N' or 'go divide N'. Root moves are handed out to
+/// all the threads of the pool one by one and the subtree counts are summed
+/// up once every thread is done.
+void run(MainThread* mainThread);
+
+/// Perft::search() is the worker entry point, called by every thread that
+/// takes part in a perft run. It keeps picking unclaimed root moves until
+/// none is left.
+void search(Thread* th);
+
+void resize(size_t mbSize);
+void clear();
+
+} // namespace Perft
+
+#endif // #ifndef PERFT_H_INCLUDED
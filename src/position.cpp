@@ -24,6 +24,7 @@
 #include <cstring> // For std::memset, std::memcmp
 #include <iomanip>
 #include <sstream>
+#include <vector>
 
 #include "bitboard.h"
 #include "misc.h"
@@ -51,43 +52,8 @@ namespace Zobrist {
   Key side, noPawns;
 }
 
-namespace {
-
-// min_attacker() is a helper function used by see_ge() to locate the least
-// valuable attacker for the side to move, remove the attacker we just found
-// from the bitboards and scan for new X-ray attacks behind it.
-
-template<int Pt>
-PieceType min_attacker(const Bitboard* byTypeBB, Square to, Bitboard stmAttackers,
-                       Bitboard& occupied, Bitboard& attackers) {
-
-  Bitboard b = stmAttackers & byTypeBB[Pt];
-  if (!b)
-      return min_attacker<Pt + 1>(byTypeBB, to, stmAttackers, occupied, attackers);
-
-  occupied ^= lsb(b); // Remove the attacker from occupied
-
-  // Add any X-ray attack behind the just removed piece. For instance with
-  // rooks in a8 and a7 attacking a1, after removing a7 we add rook in a8.
-  // Note that new added attackers can be of any color.
-  if (Pt == PAWN || Pt == BISHOP || Pt == QUEEN)
-      attackers |= attacks_bb<BISHOP>(to, occupied) & (byTypeBB[BISHOP] | byTypeBB[QUEEN]);
-
-  if (Pt == ROOK || Pt == QUEEN)
-      attackers |= attacks_bb<ROOK>(to, occupied) & (byTypeBB[ROOK] | byTypeBB[QUEEN]);
-
-  // X-ray may add already processed pieces because byTypeBB[] is constant: in
-  // the rook example, now attackers contains _again_ rook in a7, so remove it.
-  attackers &= occupied;
-  return (PieceType)Pt;
-}
-
-template<>
-PieceType min_attacker<KING>(const Bitboard*, Square, Bitboard, Bitboard&, Bitboard&) {
-  return KING; // No need to update bitboards: it is the last cycle
-}
-
-} // namespace
+PieceType Position::SeeOrder[PIECE_TYPE_USED];
+int Position::SeeRank[PIECE_TYPE_USED];
 
 
 /// operator<<(Position) returns an ASCII representation of the position
@@ -132,13 +98,25 @@ std::ostream& operator<<(std::ostream& os, const Position& pos) {
 // situations. Description of the algorithm in the following paper:
 // https://marcelk.net/2013-04-06/paper/upcoming-rep-v2.pdf
 
-// First and second hash functions for indexing the cuckoo tables
-inline int H1(Key h) { return h & 0x1fff; }
-inline int H2(Key h) { return (h >> 16) & 0x1fff; }
+// Cuckoo table with Zobrist hashes of valid reversible moves, and the moves themselves.
+// Its size is a power of two picked from the piece types in use, see init_cuckoo().
+struct CuckooEntry {
+  Key key;
+  Move move;
+};
 
-// Cuckoo tables with Zobrist hashes of valid reversible moves, and the moves themselves
-Key cuckoo[8192];
-Move cuckooMove[8192];
+std::vector<CuckooEntry> Cuckoo;
+int CuckooMask;
+
+// First and second hash functions for indexing the cuckoo table
+inline int H1(Key h) { return h & CuckooMask; }
+inline int H2(Key h) { return (h >> 32) & CuckooMask; }
+
+// quiet_targets() returns the squares a piece reaches with a non-capturing move
+inline Bitboard quiet_targets(Color c, PieceType pt, Square s, Bitboard occupied) {
+  return is_custom(pt) ? attacks_from_betza(c, pt, s, occupied, false)
+                       : attacks_bb(c, pt, s, occupied);
+}
 
 
 /// Position::init() initializes at startup the various arrays used to compute
@@ -179,31 +157,106 @@ void Position::init() {
   Zobrist::side = rng.rand<Key>();
   Zobrist::noPawns = rng.rand<Key>();
 
-  // Prepare the cuckoo tables
-  int count = 0;
+  // Order the piece types for see_ge(), least valuable first and king last.
+  // Each position keeps the types in play as a mask of these ranks, so that
+  // the least valuable attacker is found scanning only the types present.
+  int n = 0;
+  for (PieceType pt = PAWN; pt < KING; ++pt)
+      SeeOrder[n++] = pt;
+
+  std::stable_sort(SeeOrder, SeeOrder + n, [](PieceType a, PieceType b) {
+                   return PieceValue[MG][a] < PieceValue[MG][b]; });
+
+  SeeOrder[n++] = KING;
+
+  for (int i = 0; i < n; ++i)
+      SeeRank[SeeOrder[i]] = i;
+
+  init_cuckoo();
+}
+
+
+/// Position::init_cuckoo() fills the cuckoo table with the reversible moves of
+/// all the piece types in use: the pieces but pawns, including the gating and
+/// the custom ones. A move is reversible when the piece can move back the same
+/// way on an empty board. It is called again when the custom pieces change,
+/// as their moves and keys do.
+
+void Position::init_cuckoo() {
+
+  std::vector<CuckooEntry> moves;
+
   for (Color c = WHITE; c <= BLACK; ++c)
-      for (PieceType pt = KNIGHT; pt <= QUEEN || pt == KING; pt != QUEEN ? ++pt: pt = KING)
+      for (PieceType pt = KNIGHT; pt <= KING; ++pt)
+      {
+          if (is_custom(pt) && !betzaManager.isCustomPiece(pt))
+              continue;
+
+          Piece pc = make_piece(c, pt);
+          for (Square s1 = SQ_A1; s1 <= SQ_H8; ++s1)
+              for (Square s2 = Square(s1 + 1); s2 <= SQ_H8; ++s2)
+                  if (   (quiet_targets(c, pt, s1, 0) & s2)
+                      && (quiet_targets(c, pt, s2, 0) & s1))
+                      moves.push_back({ Zobrist::psq[pc][s1] ^ Zobrist::psq[pc][s2] ^ Zobrist::side,
+                                        make_move(s1, s2) });
+      }
+
+  // Keep the table at most half full, and grow it in the unlikely case a
+  // move can't be placed after a long chain of displacements.
+  size_t size = 8192;
+  while (size < 2 * moves.size())
+      size *= 2;
+
+  for (bool done = false; !done; size *= 2)
+  {
+      Cuckoo.assign(size, CuckooEntry());
+      CuckooMask = int(size - 1);
+      done = true;
+
+      for (CuckooEntry e : moves)
       {
-      Piece pc = make_piece(c, pt);
-      for (Square s1 = SQ_A1; s1 <= SQ_H8; ++s1)
-          for (Square s2 = Square(s1 + 1); s2 <= SQ_H8; ++s2)
-              if (PseudoAttacks[WHITE][type_of(pc)][s1] & s2)
+          int i = H1(e.key), kicks = 0;
+          while (true)
+          {
+              std::swap(Cuckoo[i], e);
+              if (e.move == MOVE_NONE) // Arrived at empty slot ?
+                  break;
+              if (++kicks > int(size))
               {
-                  Move move = make_move(s1, s2);
-                  Key key = Zobrist::psq[pc][s1] ^ Zobrist::psq[pc][s2] ^ Zobrist::side;
-                  int i = H1(key);
-                  while (true)
-                  {
-                      std::swap(cuckoo[i], key);
-                      std::swap(cuckooMove[i], move);
-                      if (move == 0)   // Arrived at empty slot ?
-                          break;
-                      i = (i == H1(key)) ? H2(key) : H1(key); // Push victim to alternative slot
-                  }
-                  count++;
-             }
+                  done = false;
+                  break;
+              }
+              i = (i == H1(e.key)) ? H2(e.key) : H1(e.key); // Push victim to alternative slot
+          }
+          if (!done)
+              break;
       }
-  assert(count == 3668);
+  }
+
+  assert(moves.size() >= 3668); // Orthodox moves of both colors
+}
+
+
+/// Position::rekey() draws new hash keys for a piece type whose moves have
+/// been redefined. The keys and material keys of the positions with the piece
+/// change, so that the entries stored for them in the hash tables are not
+/// found any more, while the other positions keep their keys and entries.
+
+void Position::rekey(PieceType pt, uint64_t seed) {
+
+  PRNG rng(seed);
+
+  for (Color c = WHITE; c <= BLACK; ++c)
+  {
+      for (Square s = SQ_A1; s <= SQ_H8; ++s)
+          Zobrist::psq[make_piece(c, pt)][s] = rng.rand<Key>();
+
+      for (File f = FILE_A; f <= FILE_H; ++f)
+          Zobrist::psq_gate[make_piece(c, pt)][f] = rng.rand<Key>();
+  }
+
+  for (Gate g = NO_GATE; g < GATE_NB; ++g)
+      Zobrist::inhand[pt][g] = rng.rand<Key>();
 }
 
 
@@ -440,10 +493,25 @@ void Position::set_check_info(StateInfo* si) const {
   si->blockersForKing[BLACK] = slider_blockers(pieces(WHITE), square<KING>(BLACK), si->pinners[WHITE]);
 
   Square ksq = square<KING>(~sideToMove);
+  Bitboard rays = attacks_bb<BISHOP>(ksq, pieces()) | attacks_bb<ROOK>(ksq, pieces());
 
-  for (PieceType pt = PAWN; pt < KING; ++pt)
-      si->checkSquares[pt] = attacks_from(~sideToMove, pt, ksq);
-  si->checkSquares[KING]   = 0;
+  // Only the types the side to move has on the board are ever looked up
+  for (uint64_t types = pieceTypes[sideToMove]; types; )
+  {
+      PieceType pt = pop_piece_type(&types);
+      si->checkSquares[pt] =  LeaperAttacks[~sideToMove][pt][ksq]
+                            | (PseudoAttacks[~sideToMove][pt][ksq] & rays);
+  }
+  si->checkSquares[KING] = 0;
+
+  // Lame and jumping steps don't reverse exactly, use a superset for them.
+  // Checks by these pieces are detected exactly in do_move().
+  for (uint64_t types = betzaManager.slowPieceTypes() & pieceTypes[sideToMove]; types; )
+  {
+      PieceType pt = pop_piece_type(&types);
+      si->checkSquares[pt] =  attacks_from_betza(~sideToMove, pt, ksq, Bitboard(0))
+                            | attacks_from_betza(~sideToMove, pt, ksq, AllSquares);
+  }
 }
 
 
@@ -608,10 +676,32 @@ Bitboard Position::slider_blockers(Bitboard sliders, Square s, Bitboard& pinners
   Bitboard blockers = 0;
   pinners = 0;
 
-  // Snipers are sliders that attack 's' when a piece is removed
-  Bitboard snipers =   sliders
-                    &  attackers_to(s, 0)
-                    & ~attackers_to(s);
+  // Snipers are sliders that attack 's' on an empty board but not through the
+  // current occupancy. The rider part of every piece type is a subset of the
+  // queen lines from 's', so one pair of magic lookups serves all the types.
+  Bitboard rays = attacks_bb<BISHOP>(s, pieces()) | attacks_bb<ROOK>(s, pieces());
+  Bitboard snipers = 0;
+
+  for (Color c = WHITE; c <= BLACK; ++c)
+      if (sliders & pieces(c))
+          for (uint64_t types = pieceTypes[c]; types; )
+          {
+              PieceType pt = pop_piece_type(&types);
+              snipers |= pieces(c, pt) & (PseudoAttacks[~c][pt][s] & ~LeaperAttacks[~c][pt][s]);
+          }
+
+  snipers &= sliders & ~rays;
+
+  // Lame steps of custom pieces can be blocked as well
+  for (Bitboard slow = sliders & (betza_slow_pieces(WHITE) | betza_slow_pieces(BLACK)); slow; )
+  {
+      Square from = pop_lsb(&slow);
+      Color c = color_of(piece_on(from));
+      PieceType pt = type_of(piece_on(from));
+      if (    (attacks_from_betza(c, pt, from, Bitboard(0)) & s)
+          && !(attacks_from_betza(c, pt, from, pieces()) & s))
+          snipers |= from;
+  }
 
   while (snipers)
   {
@@ -634,10 +724,23 @@ Bitboard Position::slider_blockers(Bitboard sliders, Square s, Bitboard& pinners
 
 Bitboard Position::attackers_to(Square s, Bitboard occupied) const {
 
+  // The slider rays from 's' are shared by all the piece types
+  Bitboard rays = attacks_bb<BISHOP>(s, occupied) | attacks_bb<ROOK>(s, occupied);
   Bitboard b = 0;
   for (Color c = WHITE; c <= BLACK; ++c)
-      for (PieceType pt = PAWN; pt <= KING; ++pt)
-          b |= attacks_bb(~c, pt, s, occupied) & pieces(c, pt);
+      for (uint64_t types = pieceTypes[c]; types; )
+      {
+          PieceType pt = pop_piece_type(&types);
+          b |= (LeaperAttacks[~c][pt][s] | (PseudoAttacks[~c][pt][s] & rays)) & pieces(c, pt);
+      }
+
+  // Custom pieces with untabulated steps are tested one by one
+  for (Bitboard slow = betza_slow_pieces(WHITE) | betza_slow_pieces(BLACK); slow; )
+  {
+      Square from = pop_lsb(&slow);
+      if (attacks_from_betza(color_of(piece_on(from)), type_of(piece_on(from)), from, occupied) & s)
+          b |= from;
+  }
   return b;
 }
 
@@ -686,8 +789,9 @@ bool Position::legal(Move m) const {
       return type_of(m) == CASTLING || !(attackers_to(to_sq(m)) & pieces(~us));
 
   // A non-king move is legal if and only if it is not pinned or it
-  // does not expose the king to attackers.
-  return   !(blockers_for_king(us) & from)
+  // does not expose the king to attackers. Pins by lame or jumping custom
+  // pieces are not tracked, so always test the king when there are any.
+  return   (!(blockers_for_king(us) & from) && !betza_slow_pieces(~us))
         || !(attackers_to(ksq, (pieces() ^ from) | to) & pieces(~us) & ~SquareBB[to]);
 }
 
@@ -740,6 +844,11 @@ bool Position::pseudo_legal(const Move m) const {
                && empty(to - pawn_push(us))))
           return false;
   }
+  else if (is_custom(type_of(pc)))
+  {
+      if (!(attacks_from_betza(us, type_of(pc), from, !empty(to)) & to))
+          return false;
+  }
   else if (!(attacks_from(us, type_of(pc), from) & to))
       return false;
 
@@ -858,9 +967,13 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
   std::memcpy(&newSt, st, offsetof(StateInfo, key));
   newSt.previous = st;
   st = &newSt;
+  st->dirty.reset();
+  st->accumulator.computed = false;
 
   Color us = sideToMove;
   Color them = ~us;
+  st->capturedPiece = NO_PIECE;
+
   switch (type_of(m))
   {
   case SET_GATING_TYPE:
@@ -991,6 +1104,8 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
               Piece gated_piece = make_piece(us, gating_piece(from));
               st->psq += PSQT::psq[gated_piece][from] - PSQT::psq_gate[gated_piece][file_of(from)];
               k ^= Zobrist::psq[gated_piece][from] ^ Zobrist::psq_gate[gated_piece][file_of(from)];
+              st->materialKey ^= Zobrist::psq[gated_piece][pieceCount[gated_piece]];
+              st->nonPawnMaterial[us] += PieceValue[MG][gated_piece];
               gate_piece(us, from);
           }
       }
@@ -1044,8 +1159,9 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
       st->capturedPiece = captured;
   }
 
-  // Calculate checkers bitboard (if move gives check)
-  st->checkersBB = givesCheck ? attackers_to(square<KING>(them)) & pieces(us) : 0;
+  // Calculate checkers bitboard (if move gives check). gives_check() may miss
+  // discovered checks through lame or jumping custom pieces.
+  st->checkersBB = givesCheck || betza_slow_pieces(us) ? attackers_to(square<KING>(them)) & pieces(us) : 0;
 
   // Update the key with the final value
   st->key = k;
@@ -1181,6 +1297,8 @@ void Position::do_castling(Color us, Square from, Square& to, Square& rfrom, Squ
         Piece gated_piece = make_piece(us, gating_piece(s));
         st->psq += PSQT::psq[gated_piece][s] - PSQT::psq_gate[gated_piece][file_of(s)];
         k ^= Zobrist::psq[gated_piece][s] ^ Zobrist::psq_gate[gated_piece][file_of(s)];
+        st->materialKey ^= Zobrist::psq[gated_piece][pieceCount[gated_piece]];
+        st->nonPawnMaterial[us] += PieceValue[MG][gated_piece];
         gate_piece(us, s);
     }
     else
@@ -1204,9 +1322,12 @@ void Position::do_null_move(StateInfo& newSt) {
   assert(!checkers());
   assert(&newSt != st);
 
-  std::memcpy(&newSt, st, sizeof(StateInfo));
+  // The NNUE data is not copied, the accumulator is updated from the previous one
+  std::memcpy(&newSt, st, offsetof(StateInfo, dirty));
   newSt.previous = st;
   st = &newSt;
+  st->dirty.reset();
+  st->accumulator.computed = false;
 
   if (st->epSquare != SQ_NONE)
   {
@@ -1238,10 +1359,15 @@ void Position::undo_null_move() {
 
 /// Position::key_after() computes the new hash key after the given move. Needed
 /// for speculative prefetch. It doesn't recognize special moves like castling,
-/// en-passant and promotions.
+/// en-passant and promotions, nor the setup moves, nor a new en-passant square,
+/// but it does follow pieces entering the board through a gate, gates lost to
+/// a capture and the castling and gate rights lost by the move.
 
 Key Position::key_after(Move m) const {
 
+  if (type_of(m) == SET_GATING_TYPE || type_of(m) == PUT_GATING_PIECE)
+      return st->key ^ Zobrist::side;
+
   Square from = from_sq(m);
   Square to = to_sq(m);
   Piece pc = piece_on(from);
@@ -1249,8 +1375,25 @@ Key Position::key_after(Move m) const {
   Key k = st->key ^ Zobrist::side;
 
   if (captured)
+  {
       k ^= Zobrist::psq[captured][to];
 
+      if (gateBB & to)
+          k ^= Zobrist::psq_gate[make_piece(~sideToMove, gating_piece(to))][file_of(to)];
+  }
+
+  if (gateBB & from)
+  {
+      Piece gated = make_piece(sideToMove, gating_piece(from));
+      k ^= Zobrist::psq[gated][from] ^ Zobrist::psq_gate[gated][file_of(from)];
+  }
+
+  if (st->epSquare != SQ_NONE)
+      k ^= Zobrist::enpassant[file_of(st->epSquare)];
+
+  if (st->castlingRights && (castlingRightsMask[from] | castlingRightsMask[to]))
+      k ^= Zobrist::castling[st->castlingRights & (castlingRightsMask[from] | castlingRightsMask[to])];
+
   return k ^ Zobrist::psq[pc][to] ^ Zobrist::psq[pc][from];
 }
 
@@ -1261,6 +1404,8 @@ Key Position::key_after(Move m) const {
 
 bool Position::see_ge(Move m, Value threshold) const {
 
+  STAT_SCOPE(thisThread, PH_SEE);
+
   assert(is_ok(m));
 
   // Only deal with normal moves, assume others pass a simple see
@@ -1296,9 +1441,16 @@ bool Position::see_ge(Move m, Value threshold) const {
       return true;
 
   // Find all attackers to the destination square, with the moving piece
-  // removed, but possibly an X-ray attacker added behind it.
-  Bitboard occupied = pieces() ^ from ^ to;
-  Bitboard attackers = attackers_to(to, occupied) & occupied;
+  // removed, but possibly an X-ray attacker added behind it. A piece leaving
+  // a gate square is replaced by the gated piece, which then blocks the line.
+  Bitboard gate = gateBB & from;
+  Bitboard occupied = (pieces() ^ from ^ to) | gate;
+  Bitboard attackers = attackers_to(to, occupied) & occupied & ~gate;
+
+  // Custom pieces with untabulated steps, e.g. hoppers, can gain or lose an
+  // attack whenever any square changes, so they are rescanned after each capture.
+  Bitboard slow = betza_slow_pieces(WHITE) | betza_slow_pieces(BLACK);
+
 
   while (true)
   {
@@ -1313,9 +1465,44 @@ bool Position::see_ge(Move m, Value threshold) const {
       if (!stmAttackers)
           break;
 
-      // Locate and remove the next least valuable attacker, and add to
-      // the bitboard 'attackers' the possibly X-ray attackers behind it.
-      nextVictim = min_attacker<PAWN>(byTypeBB, to, stmAttackers, occupied, attackers);
+      // Locate and remove the next least valuable attacker
+      Bitboard b;
+      for (uint64_t r = seeRanks[stm]; !(b = stmAttackers & byTypeBB[nextVictim = SeeOrder[pop_lsb(&r)]]); ) {}
+
+      Square sq = lsb(b);
+      occupied ^= sq;
+      attackers ^= sq;
+
+      // Add any X-ray attacker behind the just removed piece. The pieces that
+      // became visible from 'to' are tested with their own attacks, so that
+      // hybrid and short range sliders of any color are found as well. For
+      // instance with rooks in a8 and a7 attacking a1, after removing a7 we
+      // add a8. Pieces that are visible but not attackers were so before the
+      // capture too, unless their empty board attacks reach 'to'.
+      if (nextVictim != KING && (PseudoAttacks[WHITE][QUEEN][to] & sq))
+      {
+          Bitboard seen = (PseudoAttacks[WHITE][BISHOP][to] & sq) ? attacks_bb<BISHOP>(to, occupied)
+                                                                  : attacks_bb<ROOK>(to, occupied);
+          for (seen &= occupied & ~attackers & ~gate; seen; )
+          {
+              Square s = pop_lsb(&seen);
+              Piece pc = piece_on(s);
+              if (   (PseudoAttacks[color_of(pc)][type_of(pc)][s] & to)
+                  && (attacks_bb(color_of(pc), type_of(pc), s, occupied) & to))
+                  attackers |= s;
+          }
+      }
+
+      for (Bitboard hoppers = slow & occupied & ~gate; hoppers; )
+      {
+          Square s = pop_lsb(&hoppers);
+          Piece pc = piece_on(s);
+          if ((  attacks_bb(color_of(pc), type_of(pc), s, occupied)
+               | attacks_from_betza(color_of(pc), type_of(pc), s, occupied)) & to)
+              attackers |= s;
+          else
+              attackers &= ~SquareBB[s];
+      }
 
       stm = ~stm; // Switch side to move
 
@@ -1423,20 +1610,23 @@ bool Position::has_game_cycle(int ply) const {
       stp = stp->previous->previous;
 
       Key moveKey = originalKey ^ stp->key;
-      if (   (j = H1(moveKey), cuckoo[j] == moveKey)
-          || (j = H2(moveKey), cuckoo[j] == moveKey))
+      if (   (j = H1(moveKey), Cuckoo[j].key == moveKey)
+          || (j = H2(moveKey), Cuckoo[j].key == moveKey))
       {
-          Move move = cuckooMove[j];
+          Move move = Cuckoo[j].move;
           Square s1 = from_sq(move);
           Square s2 = to_sq(move);
 
-          if (!(between_bb(s1, s2) & pieces()))
-          {
-              // In the cuckoo table, both moves Rc1c5 and Rc5c1 are stored in the same
-              // location. We select the legal one by reversing the move variable if necessary.
-              if (empty(s1))
-                  move = make_move(s2, s1);
+          // In the cuckoo table, both moves Rc1c5 and Rc5c1 are stored in the same
+          // location. We select the legal one by reversing the move if necessary.
+          if (empty(s1))
+              std::swap(s1, s2);
 
+          // Test the move with the actual occupancy rather than between_bb(),
+          // which doesn't fit jumping leapers, lame steps and oblique riders.
+          Piece pc = piece_on(s1);
+          if (pc != NO_PIECE && (quiet_targets(color_of(pc), type_of(pc), s1, pieces()) & s2))
+          {
               if (ply > i)
                   return true;
 
@@ -1490,6 +1680,21 @@ void Position::flip() {
 }
 
 
+/// Position::keys_ok() recomputes the hash keys from scratch with set_state()
+/// and tells whether the incrementally updated ones agree. Unlike pos_is_ok()
+/// it also works in release builds, where it is used by the key benchmark.
+
+bool Position::keys_ok() const {
+
+  StateInfo si = *st;
+  set_state(&si);
+
+  return   si.key == st->key
+        && si.pawnKey == st->pawnKey
+        && si.materialKey == st->materialKey;
+}
+
+
 /// Position::pos_is_ok() performs some consistency checks for the
 /// position object and raises an asserts if something wrong is detected.
 /// This is meant to be helpful when debugging.
@@ -1539,7 +1744,8 @@ bool Position::pos_is_ok() const {
       {
           Piece pc = make_piece(c, pt);
           if (   pieceCount[pc] != popcount(pieces(c, pt))
-              || pieceCount[pc] != std::count(board, board + SQUARE_NB, pc))
+              || pieceCount[pc] != std::count(board, board + SQUARE_NB, pc)
+              || !pieceCount[pc] != !(pieceTypes[c] & (1ULL << pt)))
               assert(0 && "pos_is_ok: Pieces");
 
           for (int i = 0; i < pieceCount[pc]; ++i)
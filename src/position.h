@@ -25,10 +25,12 @@
 #include <deque>
 #include <memory> // For std::unique_ptr
 #include <string>
+#include <vector>
 
 #include "bitboard.h"
 #include "types.h"
 #include "betza.h"
+#include "nnue.h"
 
 
 /// StateInfo struct stores information needed to restore a Position object to
@@ -57,14 +59,46 @@ struct StateInfo {
   StateInfo* previous;
   Bitboard   blockersForKing[COLOR_NB];
   Bitboard   pinners[COLOR_NB];
-  Bitboard   checkSquares[PIECE_TYPE_NB];
+  Bitboard   checkSquares[PIECE_TYPE_USED];
+
+  // Used by the NNUE evaluation, see nnue.h
+  Eval::NNUE::DirtyPieces  dirty;
+  Eval::NNUE::Accumulator  accumulator;
 };
 
 /// A list to keep track of the position states along the setup moves (from the
 /// start position to the position just before the search starts). Needed by
-/// 'draw by repetition' detection. Use a std::deque because pointers to
-/// elements are not invalidated upon list resizing.
-typedef std::unique_ptr<std::deque<StateInfo>> StateListPtr;
+/// 'draw by repetition' detection. It is an arena of fixed size blocks, so that
+/// pointers to elements are not invalidated upon list resizing, and blocks are
+/// kept when the list shrinks, so that a list reused for the next 'position'
+/// command does not allocate again.
+
+class StateList {
+
+  static constexpr size_t BlockSize = 64;
+
+public:
+  StateList() { clear(); }
+
+  size_t size() const { return count; }
+  StateInfo& back() { return blocks[(count - 1) / BlockSize][(count - 1) % BlockSize]; }
+
+  void emplace_back() {
+    if (count == blocks.size() * BlockSize)
+        blocks.emplace_back(new StateInfo[BlockSize]);
+    ++count;
+    back() = StateInfo();
+  }
+
+  void pop_back() { assert(count > 1); --count; }
+  void clear() { count = 0; emplace_back(); } // Keeps the root state only
+
+private:
+  std::vector<std::unique_ptr<StateInfo[]>> blocks;
+  size_t count;
+};
+
+typedef std::unique_ptr<StateList> StateListPtr;
 
 
 /// Position class stores information regarding the board representation as
@@ -76,6 +110,8 @@ class Thread;
 class Position {
 public:
   static void init();
+  static void init_cuckoo();
+  static void rekey(PieceType pt, uint64_t seed);
 
   Position() = default;
   Position(const Position&) = delete;
@@ -101,6 +137,8 @@ public:
   template<PieceType Pt> const Square* squares(Color c) const;
   const Square* squares(Color c, PieceType pt) const;
   template<PieceType Pt> Square square(Color c) const;
+  uint64_t piece_types() const;
+  uint64_t piece_types(Color c) const;
   Bitboard gates() const;
   PieceType gating_piece(Gate gate) const;
   PieceType gating_piece(Square s) const;
@@ -115,6 +153,7 @@ public:
   // Checking
   Bitboard checkers() const;
   Bitboard blockers_for_king(Color c) const;
+  Bitboard pinners(Color c) const;
   Bitboard check_squares(PieceType pt) const;
 
   // Attacks to/from a given square
@@ -122,7 +161,9 @@ public:
   Bitboard attackers_to(Square s, Bitboard occupied) const;
   Bitboard attacks_from(Color c, PieceType pt, Square s) const;
   template<PieceType> Bitboard attacks_from(Color c, Square s) const;
-  Bitboard attacks_from_betza(Color c, PieceType pt, Square s) const;
+  Bitboard attacks_from_betza(Color c, PieceType pt, Square s, bool capturesOnly = true) const;
+  Bitboard attacks_from_betza(Color c, PieceType pt, Square s, Bitboard occupied, bool capturesOnly = true) const;
+  Bitboard betza_slow_pieces(Color c) const;
   Bitboard slider_blockers(Bitboard sliders, Square s, Bitboard& pinners) const;
 
   // Properties of moves
@@ -130,6 +171,7 @@ public:
   bool pseudo_legal(const Move m) const;
   bool capture(Move m) const;
   bool capture_or_promotion(Move m) const;
+  Square released_gate(Move m) const;
   bool gives_check(Move m) const;
   bool advanced_pawn_push(Move m) const;
   Piece moved_piece(Move m) const;
@@ -160,6 +202,7 @@ public:
   int game_ply() const;
   bool is_chess960() const;
   Thread* this_thread() const;
+  StateInfo* state() const;
   bool is_draw(int ply) const;
   bool has_game_cycle(int ply) const;
   bool has_repeated() const;
@@ -173,6 +216,7 @@ public:
 
   // Position consistency check, for debugging
   bool pos_is_ok() const;
+  bool keys_ok() const;
   void flip();
 
 private:
@@ -198,15 +242,21 @@ private:
   template<bool Do>
   void do_castling(Color us, Square from, Square& to, Square& rfrom, Square& rto, Key& k);
 
+  // Piece types by increasing value with the king last, and the inverse map
+  static PieceType SeeOrder[PIECE_TYPE_USED];
+  static int SeeRank[PIECE_TYPE_USED];
+
   // Data members
   Piece board[SQUARE_NB];
   Gate gateBoard[SQUARE_NB];
   PieceType gatingPieces[GATE_NB];
   Square gatingSquares[COLOR_NB][GATE_NB];
-  Bitboard byTypeBB[PIECE_TYPE_NB];
+  Bitboard byTypeBB[PIECE_TYPE_USED];
   Bitboard byColorBB[COLOR_NB];
   Bitboard gateBB;
   int pieceCount[PIECE_NB];
+  uint64_t pieceTypes[COLOR_NB];
+  uint64_t seeRanks[COLOR_NB]; // pieceTypes[] in see_ge() order, see SeeRank[]
   Gate gateCount;
   Gate setupCount[COLOR_NB];
   Square pieceList[PIECE_NB][16];
@@ -286,6 +336,24 @@ template<PieceType Pt> inline Square Position::square(Color c) const {
   return pieceList[make_piece(c, Pt)][0];
 }
 
+/// Position::piece_types() returns a mask with bit 'pt' set for every piece
+/// type 'pt' of which the given side has at least one piece on the board.
+
+inline uint64_t Position::piece_types() const {
+  return pieceTypes[WHITE] | pieceTypes[BLACK];
+}
+
+inline uint64_t Position::piece_types(Color c) const {
+  return pieceTypes[c];
+}
+
+/// pop_piece_type() finds and clears the lowest piece type in a mask returned
+/// by Position::piece_types(). Used to iterate over the types in play.
+
+inline PieceType pop_piece_type(uint64_t* types) {
+  return PieceType(pop_lsb(types));
+}
+
 inline Bitboard Position::gates() const {
   return gateBB;
 }
@@ -328,15 +396,29 @@ inline Square Position::castling_rook_square(CastlingRight cr) const {
 
 template<PieceType Pt>
 inline Bitboard Position::attacks_from(Color c, Square s) const {
-  return attacks_bb(c, Pt, s, byTypeBB[ALL_PIECES]);
+  return attacks_bb<Pt>(c, s, byTypeBB[ALL_PIECES]);
 }
 
 inline Bitboard Position::attacks_from(Color c, PieceType pt, Square s) const {
   return attacks_bb(c, pt, s, byTypeBB[ALL_PIECES]);
 }
 
-inline Bitboard Position::attacks_from_betza(Color c, PieceType pt, Square s) const {
-  return ::attacks_from_betza(c, pt, s);
+inline Bitboard Position::attacks_from_betza(Color c, PieceType pt, Square s, bool capturesOnly) const {
+  return ::attacks_from_betza(c, pt, s, byTypeBB[ALL_PIECES], capturesOnly);
+}
+
+inline Bitboard Position::attacks_from_betza(Color c, PieceType pt, Square s, Bitboard occupied, bool capturesOnly) const {
+  return ::attacks_from_betza(c, pt, s, occupied, capturesOnly);
+}
+
+/// Position::betza_slow_pieces() returns the custom pieces whose attacks are
+/// not fully covered by attacks_bb(), see BetzaAttacks.
+
+inline Bitboard Position::betza_slow_pieces(Color c) const {
+  Bitboard b = 0;
+  for (uint64_t types = betzaManager.slowPieceTypes() & pieceTypes[c]; types; )
+      b |= pieces(c, pop_piece_type(&types));
+  return b;
 }
 
 inline Bitboard Position::attackers_to(Square s) const {
@@ -351,6 +433,10 @@ inline Bitboard Position::blockers_for_king(Color c) const {
   return st->blockersForKing[c];
 }
 
+inline Bitboard Position::pinners(Color c) const {
+  return st->pinners[c];
+}
+
 inline Bitboard Position::check_squares(PieceType pt) const {
   return st->checkSquares[pt];
 }
@@ -431,6 +517,19 @@ inline bool Position::capture(Move m) const {
   return (!empty(to_sq(m)) && type_of(m) != CASTLING) || type_of(m) == ENPASSANT;
 }
 
+/// Position::released_gate() returns the gate square a move leaves, so that the
+/// piece waiting there enters the board, or SQ_NONE if the move does not gate.
+/// Castling releases the king gate first, as do_castling() does.
+
+inline Square Position::released_gate(Move m) const {
+  assert(is_ok(m));
+  if (type_of(m) == SET_GATING_TYPE || type_of(m) == PUT_GATING_PIECE)
+      return SQ_NONE;
+
+  return  gateBB & from_sq(m) ? from_sq(m)
+        : type_of(m) == CASTLING && (gateBB & to_sq(m)) ? to_sq(m) : SQ_NONE;
+}
+
 inline Piece Position::captured_piece() const {
   return st->capturedPiece;
 }
@@ -439,6 +538,10 @@ inline Thread* Position::this_thread() const {
   return thisThread;
 }
 
+inline StateInfo* Position::state() const {
+  return st;
+}
+
 inline void Position::set_gating_type(PieceType pt) {
   assert(gateCount < GATE_NB);
   gatingPieces[++gateCount] = pt;
@@ -456,12 +559,14 @@ inline void Position::add_gate(Color c, Square s, Gate gate) {
   gateBoard[s] = gate;
   gatingSquares[c][gate] = s;
   gateBB |= s;
+  st->dirty.push(make_piece(c, gatingPieces[gate]), s, true, true);
 }
 
 inline void Position::remove_gate(Color c, Square s, Gate gate) {
   assert(gate > NO_GATE && gate < GATE_NB);
   assert(gateBB & s);
   assert(gateBoard[s] > NO_GATE);
+  st->dirty.push(make_piece(c, gatingPieces[gate]), s, true, false);
   gateBoard[s] = NO_GATE;
   gatingSquares[c][gate] = SQ_NONE;
   gateBB ^= s;
@@ -510,6 +615,9 @@ inline void Position::put_piece(Piece pc, Square s) {
   index[s] = pieceCount[pc]++;
   pieceList[pc][index[s]] = s;
   pieceCount[make_piece(color_of(pc), ALL_PIECES)]++;
+  pieceTypes[color_of(pc)] |= 1ULL << type_of(pc);
+  seeRanks[color_of(pc)] |= 1ULL << SeeRank[type_of(pc)];
+  st->dirty.push(pc, s, false, true);
 }
 
 inline void Position::remove_piece(Piece pc, Square s) {
@@ -527,6 +635,12 @@ inline void Position::remove_piece(Piece pc, Square s) {
   pieceList[pc][index[lastSquare]] = lastSquare;
   pieceList[pc][pieceCount[pc]] = SQ_NONE;
   pieceCount[make_piece(color_of(pc), ALL_PIECES)]--;
+  if (!pieceCount[pc])
+  {
+      pieceTypes[color_of(pc)] ^= 1ULL << type_of(pc);
+      seeRanks[color_of(pc)] ^= 1ULL << SeeRank[type_of(pc)];
+  }
+  st->dirty.push(pc, s, false, false);
 }
 
 inline void Position::move_piece(Piece pc, Square from, Square to) {
@@ -541,6 +655,8 @@ inline void Position::move_piece(Piece pc, Square from, Square to) {
   board[to] = pc;
   index[to] = index[from];
   pieceList[pc][index[to]] = to;
+  st->dirty.push(pc, from, false, false);
+  st->dirty.push(pc, to, false, true);
 }
 
 inline void Position::do_move(Move m, StateInfo& newSt) {
@@ -22,13 +22,18 @@
 #include <cassert>
 #include <cmath>
 #include <cstring>   // For std::memset
+#include <functional>
 #include <iostream>
+#include <map>
 #include <sstream>
 
+#include "batch.h"
+#include "cluster.h"
 #include "evaluate.h"
 #include "misc.h"
 #include "movegen.h"
 #include "movepick.h"
+#include "perft.h"
 #include "position.h"
 #include "search.h"
 #include "thread.h"
@@ -65,6 +70,32 @@ namespace {
   constexpr int SkipSize[]  = { 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4 };
   constexpr int SkipPhase[] = { 0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7 };
 
+  // ABDADA-style cooperative search. Threads mark the moves they are searching
+  // in a small lock-free table, and a thread that meets a move marked by another
+  // one defers it until the rest of the move list has been searched.
+  namespace Abdada {
+
+    constexpr int TableSize   = 1 << 15;
+    constexpr int MaxDeferred = 32;
+    constexpr Depth MinDepth  = 4 * ONE_PLY;
+
+    bool enabled;
+    std::atomic<Key> table[TableSize];
+
+    inline Key move_key(Key posKey, Move m) { return posKey ^ (Key(m) * 0x9E3779B97F4A7C15ULL); }
+
+    inline bool busy(Key k) {
+      return table[k & (TableSize - 1)].load(std::memory_order_relaxed) == k;
+    }
+
+    inline void start(Key k) { table[k & (TableSize - 1)].store(k, std::memory_order_relaxed); }
+
+    inline void finish(Key k) {
+      Key expected = k; // Leave the slot alone if another move took it meanwhile
+      table[k & (TableSize - 1)].compare_exchange_strong(expected, 0, std::memory_order_relaxed);
+    }
+  }
+
   // Razor and futility margins
   constexpr int RazorMargin[] = {0, 590, 604};
   Value futility_margin(Depth d, bool improving) {
@@ -105,40 +136,15 @@ namespace {
   Value value_to_tt(Value v, int ply);
   Value value_from_tt(Value v, int ply);
   void update_pv(Move* pv, Move move, Move* childPv);
-  void update_continuation_histories(Stack* ss, Piece pc, Square to, int bonus);
+  void update_continuation_histories(Stack* ss, int pc, Square to, int bonus);
   void update_quiet_stats(const Position& pos, Stack* ss, Move move, Move* quiets, int quietsCnt, int bonus);
   void update_capture_stats(const Position& pos, Move move, Move* captures, int captureCnt, int bonus);
+  bool vote_cluster(RootMoves& rootMoves, Depth depth, const std::vector<Cluster::Result>& results);
 
   inline bool gives_check(const Position& pos, Move move) {
     return  pos.gives_check(move);
   }
 
-  // perft() is our utility to verify move generation. All the leaf nodes up
-  // to the given depth are generated and counted, and the sum is returned.
-  template<bool Root>
-  uint64_t perft(Position& pos, Depth depth) {
-
-    StateInfo st;
-    uint64_t cnt, nodes = 0;
-    const bool leaf = (depth == 2 * ONE_PLY);
-
-    for (const auto& m : MoveList<LEGAL>(pos))
-    {
-        if (Root && depth <= ONE_PLY)
-            cnt = 1, nodes++;
-        else
-        {
-            pos.do_move(m, st);
-            cnt = leaf ? MoveList<LEGAL>(pos).size() : perft<false>(pos, depth - ONE_PLY);
-            nodes += cnt;
-            pos.undo_move(m);
-        }
-        if (Root)
-            sync_cout << UCI::move(m, pos) << ": " << cnt << sync_endl;
-    }
-    return nodes;
-  }
-
 } // namespace
 
 
@@ -187,8 +193,14 @@ void MainThread::search() {
 
   if (Limits.perft)
   {
-      nodes = perft<true>(rootPos, Limits.perft * ONE_PLY);
-      sync_cout << "\nNodes searched: " << nodes << "\n" << sync_endl;
+      Perft::run(this);
+      return;
+  }
+
+  if (Limits.batch)
+  {
+      Abdada::enabled = false;
+      Batch::run(this);
       return;
   }
 
@@ -211,6 +223,8 @@ void MainThread::search() {
   }
   else
   {
+      Abdada::enabled = Options["ABDADA"] && Threads.size() > 1;
+
       for (Thread* th : Threads)
           if (th != this)
               th->start_searching();
@@ -237,36 +251,45 @@ void MainThread::search() {
       if (th != this)
           th->wait_for_search_finished();
 
+  // Then stop the other nodes of a cluster and gather their results
+  std::vector<Cluster::Result> clusterResults;
+  Cluster::stop_search(clusterResults);
+
   // When playing in 'nodes as time' mode, subtract the searched nodes from
   // the available ones before exiting.
   if (Limits.npmsec)
       Time.availableNodes += Limits.inc[us] - Threads.nodes_searched();
 
-  // Check if there are threads with a better score than main thread
+  // Check if the threads together prefer another move than main thread
   bestThread = this;
   if (    Options["MultiPV"] == 1
       && !Limits.depth
       && !Skill(Options["Skill Level"]).enabled()
       &&  rootMoves[0].pv[0] != MOVE_NONE)
-  {
-      for (Thread* th : Threads)
-      {
-          Depth depthDiff = th->completedDepth - bestThread->completedDepth;
-          Value scoreDiff = th->rootMoves[0].score - bestThread->rootMoves[0].score;
-
-          // Select the thread with the best score, always if it is a mate
-          if (    scoreDiff > 0
-              && (depthDiff >= 0 || th->rootMoves[0].score >= VALUE_MATE_IN_MAX_PLY))
-              bestThread = th;
-      }
-  }
+      bestThread = vote_best_thread();
+
+  // A worker reports its move to the root of the cluster, the root lets the
+  // nodes vote as its threads did.
+  bool clusterMove = false;
+  if (Cluster::is_worker())
+      Cluster::report({ bestThread->rootMoves[0].pv[0], bestThread->rootMoves[0].score,
+                        int(bestThread->completedDepth / ONE_PLY) });
+
+  else if (   !clusterResults.empty()
+           &&  Options["MultiPV"] == 1
+           && !Limits.depth
+           && !Skill(Options["Skill Level"]).enabled()
+           &&  rootMoves[0].pv[0] != MOVE_NONE)
+      clusterMove = vote_cluster(bestThread->rootMoves, bestThread->completedDepth, clusterResults);
 
   previousScore = bestThread->rootMoves[0].score;
 
-  // Send again PV info if we have a new best thread
-  if (bestThread != this)
+  // Send again PV info if we have a new best thread or move
+  if (bestThread != this || clusterMove)
       sync_cout << UCI::pv(bestThread->rootPos, bestThread->completedDepth, -VALUE_INFINITE, VALUE_INFINITE) << sync_endl;
 
+  Time.finish();
+
   if (Options["Protocol"] == "xboard")
   {
       // Send move only when not in analyze mode and not at game end
@@ -274,12 +297,56 @@ void MainThread::search() {
           sync_cout << "move " << UCI::move(bestThread->rootMoves[0].pv[0], rootPos) << sync_endl;
       return;
   }
-  sync_cout << "bestmove " << UCI::move(bestThread->rootMoves[0].pv[0], rootPos);
-
+  // The line is built apart, sync_cout writes through a buffer of this thread
+  std::string ponder;
   if (bestThread->rootMoves[0].pv.size() > 1 || bestThread->rootMoves[0].extract_ponder_from_tt(rootPos))
-      std::cout << " ponder " << UCI::move(bestThread->rootMoves[0].pv[1], rootPos);
+      ponder = " ponder " + UCI::move(bestThread->rootMoves[0].pv[1], rootPos);
 
-  std::cout << sync_endl;
+  sync_cout << "bestmove " << UCI::move(bestThread->rootMoves[0].pv[0], rootPos) << ponder << sync_endl;
+}
+
+
+/// MainThread::vote_best_thread() lets the threads vote for a best move once
+/// they have all finished. Each thread votes for its best move with a weight
+/// that grows with its completed depth and with its score above the worst
+/// one. Proven mates override the vote. Returns the thread with the highest
+/// voted move that reached the deepest depth for it.
+
+Thread* MainThread::vote_best_thread() {
+
+  std::map<Move, int64_t> votes;
+  Value minScore = rootMoves[0].score;
+  Thread* best = this;
+
+  for (Thread* th : Threads)
+      if (th->completedDepth > DEPTH_ZERO)
+          minScore = std::min(minScore, th->rootMoves[0].score);
+
+  for (Thread* th : Threads)
+      if (th->completedDepth > DEPTH_ZERO)
+          votes[th->rootMoves[0].pv[0]] += (th->rootMoves[0].score - minScore + 14) * int(th->completedDepth / ONE_PLY);
+
+  for (Thread* th : Threads)
+  {
+      if (th->completedDepth == DEPTH_ZERO || th == best)
+          continue;
+
+      Value bestScore = best->rootMoves[0].score, score = th->rootMoves[0].score;
+      Move bestMove = best->rootMoves[0].pv[0], move = th->rootMoves[0].pv[0];
+
+      if (bestScore >= VALUE_MATE_IN_MAX_PLY)
+      {
+          // Prefer the shortest mate
+          if (score > bestScore)
+              best = th;
+      }
+      else if (   score >= VALUE_MATE_IN_MAX_PLY
+               || (score > VALUE_MATED_IN_MAX_PLY && votes[move] > votes[bestMove])
+               || (move == bestMove && th->completedDepth > best->completedDepth))
+          best = th;
+  }
+
+  return best;
 }
 
 
@@ -289,15 +356,23 @@ void MainThread::search() {
 
 void Thread::search() {
 
+  if (Limits.perft)
+  {
+      Perft::search(this);
+      return;
+  }
+
   Stack stack[MAX_PLY+7], *ss = stack+4; // To reference from (ss-4) to (ss+2)
   Value bestValue, alpha, beta, delta;
   Move  lastBestMove = MOVE_NONE;
   Depth lastBestMoveDepth = DEPTH_ZERO;
-  MainThread* mainThread = (this == Threads.main() ? Threads.main() : nullptr);
+  MainThread* mainThread = (this == Threads.main() && !Limits.batch ? Threads.main() : nullptr);
   double timeReduction = 1.0;
   Color us = rootPos.side_to_move();
   bool failedLow;
 
+  historySlots.add(rootPos);
+
   std::memset(ss-4, 0, 7 * sizeof(Stack));
   for (int i = 4; i > 0; i--)
      (ss-i)->contHistory = this->contHistory[NO_PIECE][0].get(); // Use as sentinel
@@ -318,6 +393,13 @@ void Thread::search() {
 
   multiPV = std::min(multiPV, rootMoves.size());
 
+  // In the shared mode the main thread searches the lines together, see
+  // below. The helpers keep a window per line: they are more useful deepening
+  // each line on its own in the TT than repeating the shared search.
+  bool sharedMode =   multiPV > 1
+                   && (mainThread || Limits.batch)
+                   && Options["MultiPV Mode"] == "shared";
+
   int ct = int(Options["Contempt"]) * PawnValueEg / 100; // From centipawns
 
   // In analysis mode, adjust contempt in accordance with user preference
@@ -332,19 +414,35 @@ void Thread::search() {
   contempt = (us == WHITE ?  make_score(ct, ct / 2)
                           : -make_score(ct, ct / 2));
 
+  // A resumed search reports at once the PV it starts from, see start_thinking()
+  if (mainThread && rootDepth > DEPTH_ZERO && rootMoves[0].score != -VALUE_INFINITE)
+  {
+      pvIdx = 0;
+      sync_cout << UCI::pv(rootPos, rootDepth, -VALUE_INFINITE, VALUE_INFINITE) << sync_endl;
+  }
+
   // Iterative deepening loop until requested to stop or the target depth is reached
   while (   (rootDepth += ONE_PLY) < DEPTH_MAX
          && !Threads.stop
-         && !(Limits.depth && mainThread && rootDepth / ONE_PLY > Limits.depth))
+         && !(Limits.depth && (mainThread || Limits.batch) && rootDepth / ONE_PLY > Limits.depth))
   {
-      // Distribute search depths across the helper threads
-      if (idx > 0)
+      // Distribute search depths across the helper threads. In a batch every
+      // thread searches its own position alone.
+      if (idx > 0 && !Limits.batch)
       {
           int i = (idx - 1) % 20;
           if (((rootDepth / ONE_PLY + rootPos.game_ply() + SkipPhase[i]) / SkipSize[i]) % 2)
               continue;  // Retry with an incremented rootDepth
+
+          // The skip pattern repeats every 20 helpers, so with many threads
+          // also leave a depth that half of the pool is already searching.
+          if (   Threads.size() > 20
+              && Threads.depthSearchers[rootDepth / ONE_PLY] >= int(Threads.size()) / 2)
+              continue;
       }
 
+      ++Threads.depthSearchers[rootDepth / ONE_PLY];
+
       // Age out PV variability metric
       if (mainThread)
           mainThread->bestMoveChanges *= 0.517, failedLow = false;
@@ -356,8 +454,14 @@ void Thread::search() {
 
       size_t pvFirst = 0;
       pvLast = 0;
-
-      // MultiPV loop. We perform a full root search for each PV line
+      Value sharedAlpha = VALUE_INFINITE; // Lines left by a shared window score below
+
+      // MultiPV loop. We perform a full root search for each PV line, or in
+      // the shared mode one for all the lines left. There the root alpha is
+      // lowered to the score of the last of the lines found so far, so that the
+      // subtrees common to the lines are searched once, and a search that finds
+      // only some of the lines goes on with the others. The shared mode needs
+      // the lines left in a single group of equal TB rank.
       for (pvIdx = 0; pvIdx < multiPV && !Threads.stop; ++pvIdx)
       {
           if (pvIdx == pvLast)
@@ -368,6 +472,8 @@ void Thread::search() {
                       break;
           }
 
+          sharedPV = sharedMode && pvLast >= multiPV ? multiPV - pvIdx : 1;
+
           // Reset UCI info selDepth for each depth and each PV line
           selDepth = 0;
 
@@ -379,6 +485,15 @@ void Thread::search() {
               alpha = std::max(previousScore - delta,-VALUE_INFINITE);
               beta  = std::min(previousScore + delta, VALUE_INFINITE);
 
+              // A shared window starts below the last line and is open above,
+              // a fail high would stop the search of the other lines.
+              if (sharedPV > 1)
+              {
+                  Value lastScore = std::min(rootMoves[pvIdx + sharedPV - 1].previousScore, sharedAlpha);
+                  alpha = std::max(lastScore - delta, -VALUE_INFINITE);
+                  beta = VALUE_INFINITE;
+              }
+
               // Adjust contempt based on root move's previousScore (dynamic contempt)
               int dct = ct + 88 * previousScore / (abs(previousScore) + 200);
 
@@ -391,6 +506,7 @@ void Thread::search() {
           // high/low anymore.
           while (true)
           {
+              sharedScores.clear();
               bestValue = ::search<PV>(rootPos, ss, alpha, beta, rootDepth, false);
 
               // Bring the best move to the front. It is critical that sorting
@@ -419,7 +535,7 @@ void Thread::search() {
               // re-search, otherwise exit the loop.
               if (bestValue <= alpha)
               {
-                  beta = (alpha + beta) / 2;
+                  beta = sharedPV > 1 ? beta : (alpha + beta) / 2;
                   alpha = std::max(bestValue - delta, -VALUE_INFINITE);
 
                   if (mainThread)
@@ -438,6 +554,15 @@ void Thread::search() {
               assert(alpha >= -VALUE_INFINITE && beta <= VALUE_INFINITE);
           }
 
+          // Skip the lines found by a shared window, they all score above alpha
+          if (sharedPV > 1 && !Threads.stop)
+          {
+              while (pvIdx + 1 < multiPV && rootMoves[pvIdx + 1].score > alpha)
+                  ++pvIdx;
+
+              sharedAlpha = alpha;
+          }
+
           // Sort the PV lines searched so far and update the GUI
           std::stable_sort(rootMoves.begin() + pvFirst, rootMoves.begin() + pvIdx + 1);
 
@@ -446,14 +571,26 @@ void Thread::search() {
               sync_cout << UCI::pv(rootPos, rootDepth, alpha, beta) << sync_endl;
       }
 
+      --Threads.depthSearchers[rootDepth / ONE_PLY];
+
       if (!Threads.stop)
+      {
           completedDepth = rootDepth;
+          result = IterationResult::pack(rootMoves[0].pv[0], rootMoves[0].score, completedDepth);
+
+          if (mainThread)
+              mainThread->iterationTimes.push_back(Time.elapsed());
+      }
 
       if (rootMoves[0].pv[0] != lastBestMove) {
          lastBestMove = rootMoves[0].pv[0];
          lastBestMoveDepth = rootDepth;
       }
 
+      // In a batch the nodes limit is per thread, and only ends the iterations
+      if (Limits.batch && Limits.nodes && nodes >= uint64_t(Limits.nodes))
+          break;
+
       // Have we found a "mate in x"?
       if (   Limits.mate
           && bestValue >= VALUE_MATE_IN_MAX_PLY
@@ -487,6 +624,20 @@ void Thread::search() {
               double bestMoveInstability = 1.0 + mainThread->bestMoveChanges;
               bestMoveInstability *= std::pow(mainThread->previousTimeReduction, 0.528) / timeReduction;
 
+              // Helpers that completed this depth with another best move mean
+              // the position is less settled than our own iterations suggest.
+              int agree = 0, disagree = 0;
+              for (Thread* th : Threads)
+                  if (th != this)
+                  {
+                      IterationResult r = th->published();
+                      if (r.depth >= completedDepth)
+                          ++(r.move == rootMoves[0].pv[0] ? agree : disagree);
+                  }
+
+              if (disagree)
+                  bestMoveInstability *= 1.0 + 0.5 * disagree / (agree + disagree);
+
               // Stop the search if we have only one legal move, or if available time elapsed
               if (   rootMoves.size() == 1
                   || Time.elapsed() > Time.optimum() * bestMoveInstability * improvingFactor / 581)
@@ -559,6 +710,7 @@ namespace {
 
     // Step 1. Initialize node
     Thread* thisThread = pos.this_thread();
+    const HistorySlots& slots = thisThread->historySlots;
     inCheck = pos.checkers();
     Color us = pos.side_to_move();
     moveCount = captureCount = quietCount = ss->moveCount = 0;
@@ -613,7 +765,11 @@ namespace {
     // position key in case of an excluded move.
     excludedMove = ss->excludedMove;
     posKey = pos.key() ^ Key(excludedMove << 16); // Isn't a very good hash
-    tte = TT.probe(posKey, ttHit);
+    tte = STAT_TIME(thisThread, PH_TT_PROBE, TT.probe(posKey, ttHit));
+    STAT_INC(thisThread, searchNodes);
+    STAT_INC(thisThread, ttProbes[SearchStats::depth_slot(depth / ONE_PLY)]);
+    if (ttHit)
+        STAT_INC(thisThread, ttHits[SearchStats::depth_slot(depth / ONE_PLY)]);
     ttValue = ttHit ? value_from_tt(tte->value(), ss->ply) : VALUE_NONE;
     ttMove =  rootNode ? thisThread->rootMoves[thisThread->pvIdx].pv[0]
             : ttHit    ? tte->move() : MOVE_NONE;
@@ -636,14 +792,14 @@ namespace {
 
                 // Extra penalty for a quiet TT move in previous ply when it gets refuted
                 if ((ss-1)->moveCount == 1 && !pos.captured_piece())
-                    update_continuation_histories(ss-1, pos.piece_on(prevSq), prevSq, -stat_bonus(depth + ONE_PLY));
+                    update_continuation_histories(ss-1, slots[pos.piece_on(prevSq)], prevSq, -stat_bonus(depth + ONE_PLY));
             }
             // Penalty for a quiet ttMove that fails low
             else if (!pos.capture_or_promotion(ttMove))
             {
                 int penalty = -stat_bonus(depth);
                 thisThread->mainHistory[us][from_to(ttMove)] << penalty;
-                update_continuation_histories(ss, pos.moved_piece(ttMove), to_sq(ttMove), penalty);
+                update_continuation_histories(ss, slots[pos.moved_piece(ttMove)], to_sq(ttMove), penalty);
             }
         }
         return ttValue;
@@ -660,7 +816,7 @@ namespace {
             && !pos.can_castle(ANY_CASTLING))
         {
             TB::ProbeState err;
-            TB::WDLScore wdl = Tablebases::probe_wdl(pos, &err);
+            TB::WDLScore wdl = STAT_TIME(thisThread, PH_TB_PROBE, Tablebases::probe_wdl(pos, &err));
 
             if (err != TB::ProbeState::FAIL)
             {
@@ -707,7 +863,7 @@ namespace {
     {
         // Never assume anything on values stored in TT
         if ((ss->staticEval = eval = tte->eval()) == VALUE_NONE)
-            eval = ss->staticEval = evaluate(pos);
+            eval = ss->staticEval = STAT_TIME(thisThread, PH_EVAL, evaluate(pos));
 
         // Can ttValue be used as a better position evaluation?
         if (    ttValue != VALUE_NONE
@@ -717,7 +873,7 @@ namespace {
     else
     {
         ss->staticEval = eval =
-        (ss-1)->currentMove != MOVE_NULL ? evaluate(pos)
+        (ss-1)->currentMove != MOVE_NULL ? STAT_TIME(thisThread, PH_EVAL, evaluate(pos))
                                          : -(ss-1)->staticEval + 2 * Eval::Tempo;
 
         tte->save(posKey, VALUE_NONE, BOUND_NONE, DEPTH_NONE, MOVE_NONE,
@@ -765,6 +921,7 @@ namespace {
         ss->contHistory = thisThread->contHistory[NO_PIECE][0].get();
 
         pos.do_null_move(st);
+        STAT_INC(thisThread, nullTries);
 
         Value nullValue = -search<NonPV>(pos, ss+1, -beta, -beta+1, depth-R, !cutNode);
 
@@ -772,6 +929,8 @@ namespace {
 
         if (nullValue >= beta)
         {
+            STAT_INC(thisThread, nullCutoffs);
+
             // Do not return unproven mate scores
             if (nullValue >= VALUE_MATE_IN_MAX_PLY)
                 nullValue = beta;
@@ -813,7 +972,7 @@ namespace {
                 probCutCount++;
 
                 ss->currentMove = move;
-                ss->contHistory = thisThread->contHistory[pos.moved_piece(move)][to_sq(move)].get();
+                ss->contHistory = thisThread->contHistory[slots[pos.moved_piece(move)]][to_sq(move)].get();
 
                 assert(depth >= 5 * ONE_PLY);
 
@@ -847,9 +1006,10 @@ namespace {
 moves_loop: // When in check, search starts from here
 
     const PieceToHistory* contHist[] = { (ss-1)->contHistory, (ss-2)->contHistory, nullptr, (ss-4)->contHistory };
-    Move countermove = thisThread->counterMoves[pos.piece_on(prevSq)][prevSq];
+    Move countermove = thisThread->counterMoves[slots[pos.piece_on(prevSq)]][prevSq];
 
     MovePicker mp(pos, ttMove, depth, &thisThread->mainHistory,
+                                      &thisThread->gatingHistory,
                                       &thisThread->captureHistory,
                                       contHist,
                                       countermove,
@@ -860,9 +1020,14 @@ moves_loop: // When in check, search starts from here
     ttCapture = false;
     pvExact = PvNode && ttHit && tte->bound() == BOUND_EXACT;
 
+    // Moves deferred because another thread is searching them (ABDADA)
+    Move deferred[Abdada::MaxDeferred];
+    int deferredCount = 0, deferredIdx = 0;
+
     // Step 12. Loop through all pseudo-legal moves until no moves remain
-    // or a beta cutoff occurs.
-    while ((move = mp.next_move(skipQuiets)) != MOVE_NONE)
+    // or a beta cutoff occurs. Deferred moves are searched last.
+    while (    (move = mp.next_move(skipQuiets)) != MOVE_NONE
+           || (deferredIdx < deferredCount && (move = deferred[deferredIdx++]) != MOVE_NONE))
     {
       assert(is_ok(move));
 
@@ -879,7 +1044,7 @@ moves_loop: // When in check, search starts from here
 
       ss->moveCount = ++moveCount;
 
-      if (rootNode && thisThread == Threads.main() && Time.elapsed() > 3000 && Options["Protocol"] == "uci")
+      if (rootNode && thisThread == Threads.main() && !Limits.batch && Time.elapsed() > 3000 && Options["Protocol"] == "uci")
           sync_cout << "info depth " << depth / ONE_PLY
                     << " currmove " << UCI::move(move, pos)
                     << " currmovenumber " << moveCount + thisThread->pvIdx << sync_endl;
@@ -947,8 +1112,8 @@ moves_loop: // When in check, search starts from here
 
               // Countermoves based pruning (~20 Elo)
               if (   lmrDepth < 3
-                  && (*contHist[0])[movedPiece][to_sq(move)] < CounterMovePruneThreshold
-                  && (*contHist[1])[movedPiece][to_sq(move)] < CounterMovePruneThreshold)
+                  && (*contHist[0])[slots[movedPiece]][to_sq(move)] < CounterMovePruneThreshold
+                  && (*contHist[1])[slots[movedPiece]][to_sq(move)] < CounterMovePruneThreshold)
                   continue;
 
               // Futility pruning: parent node (~2 Elo)
@@ -976,15 +1141,38 @@ moves_loop: // When in check, search starts from here
           continue;
       }
 
+      // Leave a later sibling that another thread is already searching for the
+      // end of the move list, and mark the ones we search ourselves. Once the
+      // move picker is exhausted deferred moves are searched unconditionally.
+      Key abdadaKey = 0;
+      if (    Abdada::enabled
+          && !rootNode
+          &&  depth >= Abdada::MinDepth
+          &&  moveCount > 1)
+      {
+          abdadaKey = Abdada::move_key(pos.key(), move);
+
+          if (   !deferredIdx
+              &&  deferredCount < Abdada::MaxDeferred
+              &&  Abdada::busy(abdadaKey))
+          {
+              deferred[deferredCount++] = move;
+              ss->moveCount = --moveCount;
+              continue;
+          }
+
+          Abdada::start(abdadaKey);
+      }
+
       if (move == ttMove && captureOrPromotion)
           ttCapture = true;
 
       // Update the current move (this must be done after singular extension search)
       ss->currentMove = move;
-      ss->contHistory = thisThread->contHistory[movedPiece][to_sq(move)].get();
+      ss->contHistory = thisThread->contHistory[slots[movedPiece]][to_sq(move)].get();
 
       // Step 15. Make the move
-      pos.do_move(move, st, givesCheck);
+      STAT_TIME(thisThread, PH_DO_MOVE, pos.do_move(move, st, givesCheck));
 
       // Step 16. Reduced depth search (LMR). If the move fails high it will be
       // re-searched at full depth.
@@ -1028,9 +1216,9 @@ moves_loop: // When in check, search starts from here
                   r -= 2 * ONE_PLY;
 
               ss->statScore =  thisThread->mainHistory[us][from_to(move)]
-                             + (*contHist[0])[movedPiece][to_sq(move)]
-                             + (*contHist[1])[movedPiece][to_sq(move)]
-                             + (*contHist[3])[movedPiece][to_sq(move)]
+                             + (*contHist[0])[slots[movedPiece]][to_sq(move)]
+                             + (*contHist[1])[slots[movedPiece]][to_sq(move)]
+                             + (*contHist[3])[slots[movedPiece]][to_sq(move)]
                              - 4000;
 
               // Decrease/increase reduction by comparing opponent's stat score (~10 Elo)
@@ -1049,6 +1237,10 @@ moves_loop: // When in check, search starts from here
           value = -search<NonPV>(pos, ss+1, -(alpha+1), -alpha, d, true);
 
           doFullDepthSearch = (value > alpha && d != newDepth);
+
+          STAT_INC(thisThread, lmrSearches);
+          if (doFullDepthSearch)
+              STAT_INC(thisThread, lmrResearches);
       }
       else
           doFullDepthSearch = !PvNode || moveCount > 1;
@@ -1069,7 +1261,10 @@ moves_loop: // When in check, search starts from here
       }
 
       // Step 18. Undo move
-      pos.undo_move(move);
+      STAT_TIME(thisThread, PH_DO_MOVE, pos.undo_move(move));
+
+      if (abdadaKey)
+          Abdada::finish(abdadaKey);
 
       assert(value > -VALUE_INFINITE && value < VALUE_INFINITE);
 
@@ -1097,6 +1292,20 @@ moves_loop: // When in check, search starts from here
               for (Move* m = (ss+1)->pv; *m != MOVE_NONE; ++m)
                   rm.pv.push_back(*m);
 
+              // In a shared window a new line raises alpha just below the
+              // score of the last line, once there are enough of them.
+              if (thisThread->sharedPV > 1 && value > alpha && value < beta)
+              {
+                  std::vector<Value>& scores = thisThread->sharedScores;
+                  scores.insert(std::upper_bound(scores.begin(), scores.end(), value, std::greater<Value>()), value);
+
+                  if (scores.size() >= thisThread->sharedPV)
+                  {
+                      scores.resize(thisThread->sharedPV);
+                      alpha = std::max(alpha, scores.back() - 1);
+                  }
+              }
+
               // We record how often the best move has been changed in each
               // iteration. This information is used for time management: When
               // the best move changes frequently, we allocate some more time.
@@ -1122,11 +1331,15 @@ moves_loop: // When in check, search starts from here
                   update_pv(ss->pv, move, (ss+1)->pv);
 
               if (PvNode && value < beta) // Update alpha! Always alpha < beta
-                  alpha = value;
+                  alpha = rootNode && thisThread->sharedPV > 1 ? alpha : value;
               else
               {
                   assert(value >= beta); // Fail high
                   ss->statScore = 0;
+
+                  STAT_INC(thisThread, cutoffs);
+                  if (moveCount == 1)
+                      STAT_INC(thisThread, firstMoveCutoffs);
                   break;
               }
           }
@@ -1171,23 +1384,30 @@ moves_loop: // When in check, search starts from here
 
         // Extra penalty for a quiet TT move in previous ply when it gets refuted
         if ((ss-1)->moveCount == 1 && !pos.captured_piece())
-            update_continuation_histories(ss-1, pos.piece_on(prevSq), prevSq, -stat_bonus(depth + ONE_PLY));
+            update_continuation_histories(ss-1, slots[pos.piece_on(prevSq)], prevSq, -stat_bonus(depth + ONE_PLY));
     }
     // Bonus for prior countermove that caused the fail low
     else if (   (depth >= 3 * ONE_PLY || PvNode)
              && !pos.captured_piece()
              && is_ok((ss-1)->currentMove))
-        update_continuation_histories(ss-1, pos.piece_on(prevSq), prevSq, stat_bonus(depth));
+        update_continuation_histories(ss-1, slots[pos.piece_on(prevSq)], prevSq, stat_bonus(depth));
 
     if (PvNode)
         bestValue = std::min(bestValue, maxValue);
 
     if (!excludedMove)
-        tte->save(posKey, value_to_tt(bestValue, ss->ply),
-                  bestValue >= beta ? BOUND_LOWER :
-                  PvNode && bestMove ? BOUND_EXACT : BOUND_UPPER,
+    {
+        Bound b =  bestValue >= beta ? BOUND_LOWER
+                 : PvNode && bestMove ? BOUND_EXACT : BOUND_UPPER;
+
+        tte->save(posKey, value_to_tt(bestValue, ss->ply), b,
                   depth, bestMove, ss->staticEval, TT.generation());
 
+        // Share the deep entries with the other nodes of a cluster
+        Cluster::save(posKey, value_to_tt(bestValue, ss->ply), b,
+                      depth, bestMove, ss->staticEval);
+    }
+
     assert(bestValue > -VALUE_INFINITE && bestValue < VALUE_INFINITE);
 
     return bestValue;
@@ -1242,7 +1462,11 @@ moves_loop: // When in check, search starts from here
                                                   : DEPTH_QS_NO_CHECKS;
     // Transposition table lookup
     posKey = pos.key();
-    tte = TT.probe(posKey, ttHit);
+    tte = STAT_TIME(pos.this_thread(), PH_TT_PROBE, TT.probe(posKey, ttHit));
+    STAT_INC(pos.this_thread(), qsearchNodes);
+    STAT_INC(pos.this_thread(), ttProbes[0]);
+    if (ttHit)
+        STAT_INC(pos.this_thread(), ttHits[0]);
     ttValue = ttHit ? value_from_tt(tte->value(), ss->ply) : VALUE_NONE;
     ttMove = ttHit ? tte->move() : MOVE_NONE;
 
@@ -1266,7 +1490,7 @@ moves_loop: // When in check, search starts from here
         {
             // Never assume anything on values stored in TT
             if ((ss->staticEval = bestValue = tte->eval()) == VALUE_NONE)
-                ss->staticEval = bestValue = evaluate(pos);
+                ss->staticEval = bestValue = STAT_TIME(pos.this_thread(), PH_EVAL, evaluate(pos));
 
             // Can ttValue be used as a better position evaluation?
             if (   ttValue != VALUE_NONE
@@ -1275,7 +1499,7 @@ moves_loop: // When in check, search starts from here
         }
         else
             ss->staticEval = bestValue =
-            (ss-1)->currentMove != MOVE_NULL ? evaluate(pos)
+            (ss-1)->currentMove != MOVE_NULL ? STAT_TIME(pos.this_thread(), PH_EVAL, evaluate(pos))
                                              : -(ss-1)->staticEval + 2 * Eval::Tempo;
 
         // Stand pat. Return immediately if static value is at least beta
@@ -1358,9 +1582,9 @@ moves_loop: // When in check, search starts from here
       ss->currentMove = move;
 
       // Make and search the move
-      pos.do_move(move, st, givesCheck);
+      STAT_TIME(pos.this_thread(), PH_DO_MOVE, pos.do_move(move, st, givesCheck));
       value = -qsearch<NT>(pos, ss+1, -beta, -alpha, depth - ONE_PLY);
-      pos.undo_move(move);
+      STAT_TIME(pos.this_thread(), PH_DO_MOVE, pos.undo_move(move));
 
       assert(value > -VALUE_INFINITE && value < VALUE_INFINITE);
 
@@ -1441,9 +1665,10 @@ moves_loop: // When in check, search starts from here
 
 
   // update_continuation_histories() updates histories of the move pairs formed
-  // by moves at ply -1, -2, and -4 with current move.
+  // by moves at ply -1, -2, and -4 with current move. The piece is given by its
+  // history slot.
 
-  void update_continuation_histories(Stack* ss, Piece pc, Square to, int bonus) {
+  void update_continuation_histories(Stack* ss, int pc, Square to, int bonus) {
 
     for (int i : {1, 2, 4})
         if (is_ok((ss-i)->currentMove))
@@ -1457,16 +1682,17 @@ moves_loop: // When in check, search starts from here
                             Move* captures, int captureCnt, int bonus) {
 
       CapturePieceToHistory& captureHistory =  pos.this_thread()->captureHistory;
+      const HistorySlots& slots = pos.this_thread()->historySlots;
       Piece moved_piece = pos.moved_piece(move);
       PieceType captured = type_of(pos.piece_on(to_sq(move)));
-      captureHistory[moved_piece][to_sq(move)][captured] << bonus;
+      captureHistory[slots[moved_piece]][to_sq(move)][slots[captured]] << bonus;
 
       // Decrease all the other played capture moves
       for (int i = 0; i < captureCnt; ++i)
       {
           moved_piece = pos.moved_piece(captures[i]);
           captured = type_of(pos.piece_on(to_sq(captures[i])));
-          captureHistory[moved_piece][to_sq(captures[i])][captured] << -bonus;
+          captureHistory[slots[moved_piece]][to_sq(captures[i])][slots[captured]] << -bonus;
       }
   }
 
@@ -1484,23 +1710,85 @@ moves_loop: // When in check, search starts from here
 
     Color us = pos.side_to_move();
     Thread* thisThread = pos.this_thread();
+    const HistorySlots& slots = thisThread->historySlots;
     thisThread->mainHistory[us][from_to(move)] << bonus;
-    update_continuation_histories(ss, pos.moved_piece(move), to_sq(move), bonus);
+    update_continuation_histories(ss, slots[pos.moved_piece(move)], to_sq(move), bonus);
+
+    Square gate = pos.released_gate(move);
+    if (gate != SQ_NONE)
+        thisThread->gatingHistory[us][pos.gating_piece(gate)][gate] << bonus;
 
     if (is_ok((ss-1)->currentMove))
     {
         Square prevSq = to_sq((ss-1)->currentMove);
-        thisThread->counterMoves[pos.piece_on(prevSq)][prevSq] = move;
+        thisThread->counterMoves[slots[pos.piece_on(prevSq)]][prevSq] = move;
     }
 
     // Decrease all the other played quiet moves
     for (int i = 0; i < quietsCnt; ++i)
     {
         thisThread->mainHistory[us][from_to(quiets[i])] << -bonus;
-        update_continuation_histories(ss, pos.moved_piece(quiets[i]), to_sq(quiets[i]), -bonus);
+        update_continuation_histories(ss, slots[pos.moved_piece(quiets[i])], to_sq(quiets[i]), -bonus);
+
+        if ((gate = pos.released_gate(quiets[i])) != SQ_NONE)
+            thisThread->gatingHistory[us][pos.gating_piece(gate)][gate] << -bonus;
     }
   }
 
+  // vote_cluster() lets the nodes of a cluster vote for the move to play, with
+  // the weights of MainThread::vote_best_thread(). The result of this node comes
+  // first and wins the ties. When the move of another node wins, it is brought
+  // to the front of the root moves with its score. Returns true in that case.
+
+  bool vote_cluster(RootMoves& rootMoves, Depth depth, const std::vector<Cluster::Result>& results) {
+
+    std::vector<Cluster::Result> nodes = results;
+    nodes.insert(nodes.begin(), { rootMoves[0].pv[0], rootMoves[0].score, int(depth / ONE_PLY) });
+
+    // Skip the empty results, and any move unknown here
+    auto valid = [&](const Cluster::Result& r) {
+        return r.depth > 0 && std::count(rootMoves.begin(), rootMoves.end(), r.move);
+    };
+
+    std::map<Move, int64_t> votes;
+    Value minScore = VALUE_INFINITE;
+
+    for (const auto& r : nodes)
+        if (valid(r))
+            minScore = std::min(minScore, r.score);
+
+    for (const auto& r : nodes)
+        if (valid(r))
+            votes[r.move] += (r.score - minScore + 14) * r.depth;
+
+    const Cluster::Result* best = &nodes[0];
+
+    for (const auto& r : nodes)
+    {
+        if (!valid(r) || &r == best)
+            continue;
+
+        if (best->score >= VALUE_MATE_IN_MAX_PLY)
+        {
+            // Prefer the shortest mate
+            if (r.score > best->score)
+                best = &r;
+        }
+        else if (   r.score >= VALUE_MATE_IN_MAX_PLY
+                 || (r.score > VALUE_MATED_IN_MAX_PLY && votes[r.move] > votes[best->move]))
+            best = &r;
+    }
+
+    if (best->move == rootMoves[0].pv[0])
+        return false;
+
+    auto it = std::find(rootMoves.begin(), rootMoves.end(), best->move);
+    std::rotate(rootMoves.begin(), it, it + 1);
+    rootMoves[0].score = best->score;
+    rootMoves[0].pv.resize(1);
+    return true;
+  }
+
   // When playing with strength handicap, choose best move among a set of RootMoves
   // using a statistical rule dependent on 'level'. Idea by Heinz van Saanen.
 
@@ -1545,7 +1833,8 @@ void MainThread::check_time() {
       return;
 
   // When using nodes, ensure checking rate is not lower than 0.1% of nodes
-  callsCnt = Limits.nodes ? std::min(1024, int(Limits.nodes / 1024)) : 1024;
+  callsCnt = Limits.nodes ? std::min(1024, int(Limits.nodes / 1024))
+                          : Time.poll_calls(nodes.load(std::memory_order_relaxed));
 
   static TimePoint lastInfoTime = now();
 
@@ -1562,9 +1851,9 @@ void MainThread::check_time() {
   if (Threads.ponder)
       return;
 
-  if (   (Limits.use_time_management() && elapsed > Time.maximum() - 10)
+  if (   (Limits.use_time_management() && elapsed > Time.maximum() - Time.stop_margin())
       || (Limits.movetime && elapsed >= Limits.movetime)
-      || (Limits.nodes && Threads.nodes_searched() >= (uint64_t)Limits.nodes))
+      || (Limits.nodes && !Limits.batch && Threads.nodes_searched() >= (uint64_t)Limits.nodes))
       Threads.stop = true;
 }
 
@@ -1686,6 +1975,9 @@ void Tablebases::rank_root_moves(Position& pos, Search::RootMoves& rootMoves) {
         ProbeDepth = DEPTH_ZERO;
     }
 
+    if (Cardinality)
+        warm(pos);
+
     if (Cardinality >= popcount(pos.pieces()) && !pos.can_castle(ANY_CASTLING))
     {
         // Rank moves using DTZ tables
@@ -84,17 +84,17 @@ struct LimitsType {
 
   LimitsType() { // Init explicitly due to broken value-initialization of non POD in MSVC
     time[WHITE] = time[BLACK] = inc[WHITE] = inc[BLACK] = npmsec = movetime = TimePoint(0);
-    movestogo = depth = mate = perft = infinite = 0;
+    movestogo = depth = mate = perft = divide = infinite = batch = 0;
     nodes = 0;
   }
 
   bool use_time_management() const {
-    return !(mate | movetime | depth | nodes | perft | infinite);
+    return !(mate | movetime | depth | nodes | perft | infinite | batch);
   }
 
   std::vector<Move> searchmoves;
   TimePoint time[COLOR_NB], inc[COLOR_NB], npmsec, movetime, startTime;
-  int movestogo, depth, mate, perft, infinite;
+  int movestogo, depth, mate, perft, divide, infinite, batch;
   int64_t nodes;
 };
 
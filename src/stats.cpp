@@ -0,0 +1,183 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2018 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <algorithm>
+#include <cstring>   // For std::memset
+#include <iomanip>
+#include <sstream>
+
+#include "stats.h"
+#include "thread.h"
+
+#ifdef USE_STATS
+using namespace SearchStats;
+
+namespace {
+
+  // Must follow the Stages enum in movepick.cpp
+  const char* StageNames[] = {
+    "main tt", "capture init", "good capture", "refutation", "quiet init", "gating", "quiet",
+    "bad capture", "evasion tt", "evasion init", "evasion", "probcut tt",
+    "probcut init", "probcut", "qsearch tt", "qcapture init", "qcapture",
+    "qcheck init", "qcheck"
+  };
+
+  const char* PhaseNames[] = {
+    "eval", "movegen", "do/undo move", "see", "tt probe", "tb probe"
+  };
+
+  double pct(uint64_t part, uint64_t total) { return total ? 100.0 * part / total : 0.0; }
+
+  // sum() adds up the counters of all the threads
+  Counters sum() {
+
+    Counters s;
+    std::memset(&s, 0, sizeof(s));
+
+    for (Thread* th : Threads)
+    {
+        const uint64_t* src = reinterpret_cast<const uint64_t*>(&th->stats);
+        uint64_t* dst = reinterpret_cast<uint64_t*>(&s);
+
+        for (size_t i = 0; i < sizeof(Counters) / sizeof(uint64_t); ++i)
+            dst[i] += src[i];
+    }
+
+    return s;
+  }
+
+} // namespace
+#endif
+
+
+/// SearchStats::clear() resets the counters of all the threads. Must be called
+/// while no search is running.
+
+void SearchStats::clear() {
+
+  for (Thread* th : Threads)
+      std::memset(&th->stats, 0, sizeof(th->stats));
+}
+
+
+/// SearchStats::report() sums the counters of all the threads and returns a report
+/// of the search profile as a string.
+
+std::string SearchStats::report() {
+
+#ifndef USE_STATS
+  return "info string Statistics are not compiled in, rebuild with stats=yes";
+#else
+  std::stringstream os;
+  const Counters sum = ::sum();
+  const uint64_t nodes = sum.searchNodes + sum.qsearchNodes;
+
+  os << std::fixed << std::setprecision(2)
+     << "Threads              : " << Threads.size()
+     << "\nSearch nodes         : " << sum.searchNodes
+     << "\nQsearch nodes        : " << sum.qsearchNodes << " (" << pct(sum.qsearchNodes, nodes) << "%)"
+     << "\nCutoffs on 1st move  : " << sum.firstMoveCutoffs << '/' << sum.cutoffs
+     << " (" << pct(sum.firstMoveCutoffs, sum.cutoffs) << "%)"
+     << "\nLMR re-searches      : " << sum.lmrResearches << '/' << sum.lmrSearches
+     << " (" << pct(sum.lmrResearches, sum.lmrSearches) << "%)"
+     << "\nNull move cutoffs    : " << sum.nullCutoffs << '/' << sum.nullTries
+     << " (" << pct(sum.nullCutoffs, sum.nullTries) << "%)"
+     << "\nEval cache hits      : " << sum.evalHits << '/' << sum.evalProbes
+     << " (" << pct(sum.evalHits, sum.evalProbes) << "%)"
+     << "\nPawn hash hits       : " << sum.pawnHits << '/' << sum.pawnProbes
+     << " (" << pct(sum.pawnHits, sum.pawnProbes) << "%)"
+     << "\nMaterial hash hits   : " << sum.materialHits << '/' << sum.materialProbes
+     << " (" << pct(sum.materialHits, sum.materialProbes) << "%)"
+     << "\n\nTT hit rate by depth (0 = qsearch)\n";
+
+  for (int d = 0; d < DEPTH_SLOTS; ++d)
+      if (sum.ttProbes[d])
+          os << std::setw(5) << d << " : " << std::setw(12) << sum.ttProbes[d]
+             << " probes " << std::setw(6) << pct(sum.ttHits[d], sum.ttProbes[d]) << "%\n";
+
+  uint64_t picked = 0;
+  for (int s = 0; s < STAGE_SLOTS; ++s)
+      picked += sum.stageMoves[s];
+
+  os << "\nMoves returned by MovePicker stage\n";
+
+  for (size_t s = 0; s < sizeof(StageNames) / sizeof(*StageNames); ++s)
+      if (sum.stageMoves[s])
+          os << std::setw(14) << StageNames[s] << " : " << std::setw(12) << sum.stageMoves[s]
+             << ' ' << std::setw(6) << pct(sum.stageMoves[s], picked) << "%\n";
+
+  os << '\n' << phases(0);
+
+  return os.str();
+#endif
+}
+
+
+/// SearchStats::phases() returns the cycles spent in each instrumented phase,
+/// summed over all the threads. Shares are given relative to totalCycles, the
+/// cycles available to all the threads during the measured run, or relative to
+/// the instrumented phases alone when totalCycles is zero. Without USE_STATS
+/// the returned string is empty.
+
+std::string SearchStats::phases(uint64_t totalCycles) {
+
+#ifndef USE_STATS
+  (void)totalCycles;
+  return "";
+#else
+  std::stringstream os;
+  const Counters sum = ::sum();
+  uint64_t profiled = 0;
+
+  for (int p = 0; p < PHASE_NB; ++p)
+      profiled += sum.phaseCycles[p];
+
+  const uint64_t total = totalCycles ? totalCycles : profiled;
+
+  os << std::fixed << std::setprecision(2)
+     << "Cycles by phase" << (totalCycles ? " (share of all thread cycles)" : "") << '\n';
+
+  for (int p = 0; p < PHASE_NB; ++p)
+      os << std::setw(14) << PhaseNames[p] << " : " << std::setw(14) << sum.phaseCycles[p]
+         << " cycles " << std::setw(12) << sum.phaseCalls[p] << " calls "
+         << std::setw(8) << (sum.phaseCalls[p] ? double(sum.phaseCycles[p]) / sum.phaseCalls[p] : 0.0)
+         << " per call " << std::setw(6) << pct(sum.phaseCycles[p], total) << "%\n";
+
+  if (totalCycles)
+      os << std::setw(14) << "other" << " : " << std::setw(14) << (total - std::min(total, profiled))
+         << " cycles " << std::setw(6) << pct(total - std::min(total, profiled), total) << "%\n";
+
+  return os.str();
+#endif
+}
+
+
+/// SearchStats::now_cycles() reads the cycle counter used by the phase timers,
+/// or returns zero when the timers are not compiled in.
+
+uint64_t SearchStats::now_cycles() {
+
+#ifdef USE_STATS
+  return cycles();
+#else
+  return 0;
+#endif
+}
@@ -0,0 +1,116 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2018 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef STATS_H_INCLUDED
+#define STATS_H_INCLUDED
+
+#include <cstdint>
+#include <string>
+
+#ifdef USE_STATS
+#  if defined(_MSC_VER)
+#    include <intrin.h>
+#  elif defined(__x86_64__) || defined(__i386__)
+#    include <x86intrin.h>
+#  else
+#    include <chrono>
+#  endif
+#endif
+
+/// Search instrumentation. Each thread owns a SearchStats::Counters block which the
+/// hot paths bump through STAT_INC(); the UCI "stats" command sums the blocks
+/// of all threads. STAT_TIME() evaluates an expression and charges the cycles
+/// spent to a phase, STAT_SCOPE() does the same for the rest of the enclosing
+/// block. Counting is compiled in only with 'make stats=yes' (which defines
+/// USE_STATS), otherwise the macros reduce to the bare expression or to nothing.
+
+#ifdef USE_STATS
+#define STAT_INC(th, counter)    (++(th)->stats.counter)
+#define STAT_TIME(th, ph, expr)  SearchStats::timed<SearchStats::ph>((th)->stats, [&]() { return expr; })
+#define STAT_SCOPE(th, ph)       SearchStats::PhaseTimer<SearchStats::ph> phaseTimer((th)->stats)
+#else
+#define STAT_INC(th, counter)    ((void)0)
+#define STAT_TIME(th, ph, expr)  (expr)
+#define STAT_SCOPE(th, ph)
+#endif
+
+namespace SearchStats {
+
+enum Phase {
+  PH_EVAL, PH_MOVEGEN, PH_DO_MOVE, PH_SEE, PH_TT_PROBE, PH_TB_PROBE, PHASE_NB
+};
+
+constexpr int DEPTH_SLOTS = 64; // Slot 0 is used for qsearch
+constexpr int STAGE_SLOTS = 20; // At least the number of MovePicker stages
+
+inline int depth_slot(int d) { return d < 0 ? 0 : d < DEPTH_SLOTS ? d : DEPTH_SLOTS - 1; }
+
+struct Counters {
+  uint64_t ttProbes[DEPTH_SLOTS], ttHits[DEPTH_SLOTS];
+  uint64_t cutoffs, firstMoveCutoffs;
+  uint64_t lmrSearches, lmrResearches;
+  uint64_t nullTries, nullCutoffs;
+  uint64_t searchNodes, qsearchNodes;
+  uint64_t evalProbes, evalHits;
+  uint64_t pawnProbes, pawnHits;
+  uint64_t materialProbes, materialHits;
+  uint64_t stageMoves[STAGE_SLOTS];
+  uint64_t phaseCalls[PHASE_NB], phaseCycles[PHASE_NB];
+};
+
+#ifdef USE_STATS
+
+/// cycles() reads the time stamp counter, or a steady clock in nanoseconds
+/// where there is none.
+
+inline uint64_t cycles() {
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+template<Phase P>
+struct PhaseTimer {
+  explicit PhaseTimer(Counters& c) : counters(c), start(cycles()) {}
+  ~PhaseTimer() { ++counters.phaseCalls[P]; counters.phaseCycles[P] += cycles() - start; }
+
+  Counters& counters;
+  uint64_t start;
+};
+
+template<Phase P, typename F>
+inline auto timed(Counters& c, F f) -> decltype(f()) {
+  PhaseTimer<P> t(c);
+  return f();
+}
+
+#endif
+
+void clear();
+std::string report();
+std::string phases(uint64_t totalCycles);
+uint64_t now_cycles();
+
+} // namespace SearchStats
+
+#endif // #ifndef STATS_H_INCLUDED
@@ -67,7 +67,12 @@ inline WDLScore operator-(WDLScore d) { return WDLScore(-int(d)); }
 inline Square operator^=(Square& s, int i) { return s = Square(int(s) ^ i); }
 inline Square operator^(Square s, int i) { return Square(int(s) ^ i); }
 
-const std::string PieceToChar = " PNBRQK  pnbrqk";
+// Files encode a piece in 4 bits, with the color in bit 3 and the types from
+// pawn to king as 1 to 6, so convert them to our own encoding.
+Piece tb_piece(int code) {
+    PieceType pt = PieceType(code & 7);
+    return make_piece(Color(code >> 3), pt == QUEEN + 1 ? KING : pt);
+}
 
 int MapPawns[SQUARE_NB];
 int MapB1H1H7[SQUARE_NB];
@@ -425,6 +430,47 @@ public:
 
 TBTables TBTables;
 
+// class ProbeCache is a small cache of WDL and DTZ probe results shared by all
+// the threads, so that a position probed again does not decompress a block of
+// the table file once more, which with tables on slow storage can mean waiting
+// for the page to be read. Each entry is a single 64 bit word holding the upper
+// 44 bits of the position key, the probe state and the result, so entries are
+// read and written atomically without any lock and can never be torn.
+class ProbeCache {
+
+    static const int Size = 1 << 16; // 512KB per table type
+
+    std::atomic<uint64_t> table[2][Size]; // [WDL / DTZ]
+
+public:
+    template<TBType Type>
+    bool probe(Key key, int* value, ProbeState* result) const {
+        uint64_t e = table[Type == DTZ][key & (Size - 1)].load(std::memory_order_relaxed);
+
+        if (!e || (e ^ key) >> 20)
+            return false;
+
+        *result = ProbeState(int(e >> 16 & 0xF) - 1);
+        *value = int16_t(e);
+        return true;
+    }
+
+    template<TBType Type>
+    void save(Key key, int value, ProbeState result) {
+        table[Type == DTZ][key & (Size - 1)].store(  (key & ~0xFFFFFULL)
+                                                   | uint64_t(result + 1) << 16
+                                                   | uint16_t(value), std::memory_order_relaxed);
+    }
+
+    void clear() {
+        for (auto& t : table)
+            for (auto& e : t)
+                e.store(0, std::memory_order_relaxed);
+    }
+};
+
+ProbeCache ProbeCache;
+
 // If the corresponding file exists two new objects TBTable<WDL> and TBTable<DTZ>
 // are created and added to the lists and hash table. Called at init time.
 void TBTables::add(const std::vector<PieceType>& pieces) {
@@ -644,7 +690,7 @@ Ret do_probe_table(const Position& pos, T* entry, WDLScore wdl, ProbeState* resu
     // flip the squares before to lookup.
     bool blackStronger = (pos.material_key() != entry->key);
 
-    int flipColor   = (symmetricBlackToMove || blackStronger) * 8;
+    int flipColor   = (symmetricBlackToMove || blackStronger) << PIECE_TYPE_BITS;
     int flipSquares = (symmetricBlackToMove || blackStronger) * 070;
     int stm         = (symmetricBlackToMove || blackStronger) ^ pos.side_to_move();
 
@@ -1036,7 +1082,7 @@ void set(T& e, uint8_t* data) {
 
         for (int k = 0; k < e.pieceCount; ++k, ++data)
             for (int i = 0; i < sides; i++)
-                e.get(i, f)->pieces[k] = Piece(i ? *data >>  4 : *data & 0xF);
+                e.get(i, f)->pieces[k] = tb_piece(i ? *data >>  4 : *data & 0xF);
 
         for (int i = 0; i < sides; ++i)
             set_groups(e, e.get(i, f), order[i], f);
@@ -1108,12 +1154,42 @@ void* mapped(TBTable<Type>& e, const Position& pos) {
     return e.baseAddress;
 }
 
+// Ask the OS to start reading a mapped table file in the background, so that
+// the first probes into it do not block on page faults.
+template<TBType Type>
+void advise(TBTable<Type>& e) {
+
+    if (!e.baseAddress)
+        return;
+
+#ifndef _WIN32
+    madvise(e.baseAddress, e.mapping, MADV_WILLNEED);
+#else
+    // PrefetchVirtualMemory() is only available from Windows 8
+    struct Range { PVOID addr; SIZE_T size; };
+    typedef BOOL (WINAPI *fun1_t)(HANDLE, ULONG_PTR, Range*, ULONG);
+
+    auto fun1 = (fun1_t)GetProcAddress(GetModuleHandle("Kernel32.dll"), "PrefetchVirtualMemory");
+    MEMORY_BASIC_INFORMATION info;
+
+    if (fun1 && VirtualQuery(e.baseAddress, &info, sizeof(info)))
+    {
+        Range r = { e.baseAddress, info.RegionSize };
+        fun1(GetCurrentProcess(), 1, &r, 0);
+    }
+#endif
+}
+
 template<TBType Type, typename Ret = typename TBTable<Type>::Ret>
 Ret probe_table(const Position& pos, ProbeState* result, WDLScore wdl = WDLDraw) {
 
     if (pos.count<ALL_PIECES>() == 2) // KvK
         return Ret(WDLDraw);
 
+    // Pieces still waiting at a gate are not part of the material key
+    if (pos.gates())
+        return *result = FAIL, Ret();
+
     TBTable<Type>* entry = TBTables.get<Type>(pos.material_key());
 
     if (!entry || !mapped(*entry, pos))
@@ -1206,6 +1282,7 @@ WDLScore search(Position& pos, ProbeState* result) {
 void Tablebases::init(const std::string& paths) {
 
     TBTables.clear();
+    ProbeCache.clear();
     MaxCardinality = 0;
     TBFile::Paths = paths;
 
@@ -1307,14 +1384,14 @@ void Tablebases::init(const std::string& paths) {
         }
 
     // Add entries in TB tables if the corresponding ".rtbw" file exsists
-    for (PieceType p1 = PAWN; p1 < KING; ++p1) {
+    for (PieceType p1 = PAWN; p1 <= QUEEN; ++p1) {
         TBTables.add({KING, p1, KING});
 
         for (PieceType p2 = PAWN; p2 <= p1; ++p2) {
             TBTables.add({KING, p1, p2, KING});
             TBTables.add({KING, p1, KING, p2});
 
-            for (PieceType p3 = PAWN; p3 < KING; ++p3)
+            for (PieceType p3 = PAWN; p3 <= QUEEN; ++p3)
                 TBTables.add({KING, p1, p2, KING, p3});
 
             for (PieceType p3 = PAWN; p3 <= p2; ++p3) {
@@ -1323,7 +1400,7 @@ void Tablebases::init(const std::string& paths) {
                 for (PieceType p4 = PAWN; p4 <= p3; ++p4)
                     TBTables.add({KING, p1, p2, p3, p4, KING});
 
-                for (PieceType p4 = PAWN; p4 < KING; ++p4)
+                for (PieceType p4 = PAWN; p4 <= QUEEN; ++p4)
                     TBTables.add({KING, p1, p2, p3, KING, p4});
             }
 
@@ -1346,37 +1423,23 @@ void Tablebases::init(const std::string& paths) {
 //  2 : win
 WDLScore Tablebases::probe_wdl(Position& pos, ProbeState* result) {
 
+    int v;
+    if (ProbeCache.probe<WDL>(pos.key(), &v, result))
+        return WDLScore(v);
+
     *result = OK;
-    return search<false>(pos, result);
+    WDLScore wdl = search<false>(pos, result);
+
+    if (*result != FAIL)
+        ProbeCache.save<WDL>(pos.key(), wdl, *result);
+
+    return wdl;
 }
 
-// Probe the DTZ table for a particular position.
-// If *result != FAIL, the probe was successful.
-// The return value is from the point of view of the side to move:
-//         n < -100 : loss, but draw under 50-move rule
-// -100 <= n < -1   : loss in n ply (assuming 50-move counter == 0)
-//        -1        : loss, the side to move is mated
-//         0        : draw
-//     1 < n <= 100 : win in n ply (assuming 50-move counter == 0)
-//   100 < n        : win, but draw under 50-move rule
-//
-// The return value n can be off by 1: a return value -n can mean a loss
-// in n+1 ply and a return value +n can mean a win in n+1 ply. This
-// cannot happen for tables with positions exactly on the "edge" of
-// the 50-move rule.
-//
-// This implies that if dtz > 0 is returned, the position is certainly
-// a win if dtz + 50-move-counter <= 99. Care must be taken that the engine
-// picks moves that preserve dtz + 50-move-counter <= 99.
-//
-// If n = 100 immediately after a capture or pawn move, then the position
-// is also certainly a win, and during the whole phase until the next
-// capture or pawn move, the inequality to be preserved is
-// dtz + 50-movecounter <= 100.
-//
-// In short, if a move is available resulting in dtz + 50-move-counter <= 99,
-// then do not accept moves leading to dtz + 50-move-counter == 100.
-int Tablebases::probe_dtz(Position& pos, ProbeState* result) {
+namespace {
+
+// Probe the DTZ table without looking at the probe cache, see probe_dtz() below
+int probe_dtz_uncached(Position& pos, ProbeState* result) {
 
     *result = OK;
     WDLScore wdl = search<true>(pos, result);
@@ -1438,6 +1501,94 @@ int Tablebases::probe_dtz(Position& pos, ProbeState* result) {
     return minDTZ == 0xFFFF ? -1 : minDTZ;
 }
 
+} // namespace
+
+// Probe the DTZ table for a particular position.
+// If *result != FAIL, the probe was successful.
+// The return value is from the point of view of the side to move:
+//         n < -100 : loss, but draw under 50-move rule
+// -100 <= n < -1   : loss in n ply (assuming 50-move counter == 0)
+//        -1        : loss, the side to move is mated
+//         0        : draw
+//     1 < n <= 100 : win in n ply (assuming 50-move counter == 0)
+//   100 < n        : win, but draw under 50-move rule
+//
+// The return value n can be off by 1: a return value -n can mean a loss
+// in n+1 ply and a return value +n can mean a win in n+1 ply. This
+// cannot happen for tables with positions exactly on the "edge" of
+// the 50-move rule.
+//
+// This implies that if dtz > 0 is returned, the position is certainly
+// a win if dtz + 50-move-counter <= 99. Care must be taken that the engine
+// picks moves that preserve dtz + 50-move-counter <= 99.
+//
+// If n = 100 immediately after a capture or pawn move, then the position
+// is also certainly a win, and during the whole phase until the next
+// capture or pawn move, the inequality to be preserved is
+// dtz + 50-movecounter <= 100.
+//
+// In short, if a move is available resulting in dtz + 50-move-counter <= 99,
+// then do not accept moves leading to dtz + 50-move-counter == 100.
+int Tablebases::probe_dtz(Position& pos, ProbeState* result) {
+
+    int dtz;
+    if (ProbeCache.probe<DTZ>(pos.key(), &dtz, result))
+        return dtz;
+
+    dtz = probe_dtz_uncached(pos, result);
+
+    if (*result != FAIL)
+        ProbeCache.save<DTZ>(pos.key(), dtz, *result);
+
+    return dtz;
+}
+
+// Map the tables that a search from the given root is going to probe, those of
+// the root material and of the materials one capture away, and have the OS read
+// them in the background, so that the search threads do not stall on page
+// faults at their first probes.
+void Tablebases::warm(const Position& pos) {
+
+    const uint64_t tbTypes = ((1ULL << (QUEEN + 1)) - (1ULL << PAWN)) | 1ULL << KING;
+    const int pieceCount = pos.count<ALL_PIECES>();
+
+    if (   pieceCount > MaxCardinality + 1
+        || pos.can_castle(ANY_CASTLING)
+        || (pos.piece_types() & ~tbTypes))
+        return;
+
+    std::string sides[COLOR_NB];
+    for (Color c = WHITE; c <= BLACK; ++c)
+        for (PieceType pt = QUEEN; pt >= PAWN; --pt)
+            sides[c] += std::string(popcount(pos.pieces(c, pt)), "PNBRQ"[pt - PAWN]);
+
+    auto warm_table = [](const std::string& code, bool dtz) {
+        StateInfo st;
+        Position p;
+        p.set(code, WHITE, &st);
+
+        TBTable<WDL>* wdl = TBTables.get<WDL>(p.material_key());
+        if (wdl && mapped(*wdl, p))
+            advise(*wdl);
+
+        TBTable<DTZ>* dtzTable = dtz ? TBTables.get<DTZ>(p.material_key()) : nullptr;
+        if (dtzTable && mapped(*dtzTable, p))
+            advise(*dtzTable);
+    };
+
+    if (pieceCount <= MaxCardinality)
+        warm_table("K" + sides[WHITE] + "K" + sides[BLACK], true);
+
+    for (Color c = WHITE; c <= BLACK; ++c)
+        for (size_t i = 0; i < sides[c].size(); ++i)
+            if (!i || sides[c][i] != sides[c][i - 1])
+            {
+                std::string s[] = { sides[WHITE], sides[BLACK] };
+                s[c].erase(i, 1);
+                warm_table("K" + s[WHITE] + "K" + s[BLACK], false);
+            }
+}
+
 
 // Use the DTZ tables to rank root moves.
 //
@@ -20,7 +20,9 @@
 
 #include <algorithm> // For std::count
 #include <cassert>
+#include <sstream>
 
+#include "batch.h"
 #include "movegen.h"
 #include "search.h"
 #include "thread.h"
@@ -57,8 +59,10 @@ Thread::~Thread() {
 
 void Thread::clear() {
 
+  historySlots.clear();
   counterMoves.fill(MOVE_NONE);
   mainHistory.fill(0);
+  gatingHistory.fill(0);
   captureHistory.fill(0);
 
   for (auto& to : contHistory)
@@ -66,6 +70,14 @@ void Thread::clear() {
           h.get()->fill(0);
 
   contHistory[NO_PIECE][0].get()->fill(Search::CounterMovePruneThreshold - 1);
+
+  pawnsTable.resize(Options["Pawn Hash"]);
+  pawnsTable.clear();
+  materialTable.resize(Options["Material Hash"]);
+  materialTable.clear();
+
+  evalCache.resize(Options["Eval Cache"]);
+  evalCache.clear();
 }
 
 /// Thread::start_searching() wakes up the thread that will start the search
@@ -78,6 +90,30 @@ void Thread::start_searching() {
 }
 
 
+/// Thread::start_clearing() wakes up the thread to run clear() on its own,
+/// so that the thread pool is cleared in parallel and, with bound threads, the
+/// tables are first touched from their NUMA node. Completion is waited for
+/// with wait_for_search_finished().
+
+void Thread::start_clearing() {
+
+  std::lock_guard<Mutex> lk(mutex);
+  clearing = searching = true;
+  cv.notify_one();
+}
+
+
+/// Thread::start_batch() wakes up the thread to take part in a batch run, see
+/// batch.h. Completion is waited for with wait_for_search_finished().
+
+void Thread::start_batch() {
+
+  std::lock_guard<Mutex> lk(mutex);
+  batching = searching = true;
+  cv.notify_one();
+}
+
+
 /// Thread::wait_for_search_finished() blocks on the condition variable
 /// until the thread has finished searching.
 
@@ -98,8 +134,16 @@ void Thread::idle_loop() {
   // some Windows NUMA hardware, for instance in fishtest. To make it simple,
   // just check if running threads are below a threshold, in this case all this
   // NUMA machinery is not needed.
-  if (Options["Threads"] >= 8)
+  // Once bound, also move the thread's own tables to the local node, as they are
+  // allocated by the main thread: the histories here, the pawn and material
+  // hashes before each search, since an option change may reallocate them.
+  const bool bound = Options["Threads"] >= 8;
+
+  if (bound)
+  {
       WinProcGroup::bindThisThread(idx);
+      Memory::bind_local(this, sizeof(*this));
+  }
 
   while (true)
   {
@@ -113,6 +157,26 @@ void Thread::idle_loop() {
 
       lk.unlock();
 
+      if (clearing)
+      {
+          clear();
+          clearing = false;
+          continue;
+      }
+
+      if (batching)
+      {
+          Batch::search(this);
+          batching = false;
+          continue;
+      }
+
+      if (bound)
+      {
+          pawnsTable.bind_local();
+          materialTable.bind_local();
+      }
+
       search();
   }
 }
@@ -136,18 +200,36 @@ void ThreadPool::set(size_t requested) {
       while (size() < requested)
           push_back(new Thread(size()));
       clear();
+
+      // Report what the histories cost, as they are allocated once per thread.
+      // The threads created at startup, before the GUI has opened the protocol,
+      // are not reported: the 'stats' command shows them.
+      const size_t historyBytes =  sizeof(CounterMoveHistory) + sizeof(ButterflyHistory)
+                                 + sizeof(GatingHistory) + sizeof(CapturePieceToHistory)
+                                 + sizeof(ContinuationHistory);
+      std::stringstream ss;
+      ss << historyBytes / 1024 << "KB per thread, "
+         << requested * historyBytes / (1024 * 1024) << "MB in total";
+      if (!historyReport.empty() && ss.str() != historyReport)
+          sync_cout << "info string Histories use " << ss.str() << sync_endl;
+
+      historyReport = ss.str();
   }
 
   // Reallocate the hash with the new threadpool size
   TT.resize(Options["Hash"]);
 }
 
-/// ThreadPool::clear() sets threadPool data to initial values.
+/// ThreadPool::clear() sets threadPool data to initial values. The threads
+/// clear their own tables in parallel.
 
 void ThreadPool::clear() {
 
   for (Thread* th : *this)
-      th->clear();
+      th->start_clearing();
+
+  for (Thread* th : *this)
+      th->wait_for_search_finished();
 
   main()->callsCnt = 0;
   main()->previousScore = VALUE_INFINITE;
@@ -156,9 +238,13 @@ void ThreadPool::clear() {
 
 /// ThreadPool::start_thinking() wakes up main thread waiting in idle_loop() and
 /// returns immediately. Main thread will wake up other threads and start the search.
+/// The results of a previous search of the same root, if any, order the root
+/// moves and seed their scores, and the iterations resume after resumeDepth.
+/// The first one then starts with the aspiration windows of these scores.
 
 void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
-                                const Search::LimitsType& limits, bool ponderMode) {
+                                const Search::LimitsType& limits, bool ponderMode,
+                                const Search::RootMoves* previous, Depth resumeDepth) {
 
   main()->wait_for_search_finished();
 
@@ -172,6 +258,23 @@ void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
           || std::count(limits.searchmoves.begin(), limits.searchmoves.end(), m))
           rootMoves.emplace_back(m);
 
+  // The moves searched before come first, in their order and with their results
+  if (previous)
+  {
+      auto first = rootMoves.begin();
+
+      for (const Search::RootMove& rm : *previous)
+      {
+          auto it = std::find(first, rootMoves.end(), rm.pv[0]);
+          if (it != rootMoves.end())
+          {
+              *it = rm;
+              std::rotate(first, it, it + 1);
+              ++first;
+          }
+      }
+  }
+
   if (!rootMoves.empty())
       Tablebases::rank_root_moves(pos, rootMoves);
 
@@ -185,19 +288,25 @@ void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
   // We use Position::set() to set root position across threads. But there are
   // some StateInfo fields (previous, pliesFromNull, capturedPiece) that cannot
   // be deduced from a fen string, so set() clears them and to not lose the info
-  // we need to backup and later restore setupStates->back(). Note that setupStates
-  // is shared by threads but is accessed in read-only mode.
-  StateInfo tmp = setupStates->back();
+  // each thread restores them from setupStates->back(). Every thread searches
+  // from its own copy of the root state, as the NNUE evaluation writes the
+  // accumulator into it, and the earlier setupStates are only read.
+  const StateInfo& root = setupStates->back();
+  const std::string fen = pos.fen();
 
   for (Thread* th : *this)
   {
-      th->nodes = th->tbHits = th->nmpMinPly = 0;
-      th->rootDepth = th->completedDepth = DEPTH_ZERO;
+      th->nodes = th->tbHits = th->result = th->nmpMinPly = 0;
+      th->rootDepth = resumeDepth;
+      th->completedDepth = DEPTH_ZERO;
       th->rootMoves = rootMoves;
-      th->rootPos.set(pos.fen(), pos.is_chess960(), &setupStates->back(), th);
+      th->rootPos.set(fen, pos.is_chess960(), &th->rootState, th);
+      th->rootState = root;
   }
 
-  setupStates->back() = tmp;
+  for (auto& n : depthSearchers)
+      n = 0;
 
+  main()->iterationTimes.clear();
   main()->start_searching();
 }
@@ -27,11 +27,14 @@
 #include <thread>
 #include <vector>
 
+#include "cluster.h"
+#include "evaluate.h"
 #include "material.h"
 #include "movepick.h"
 #include "pawns.h"
 #include "position.h"
 #include "search.h"
+#include "stats.h"
 #include "thread_win32.h"
 
 
@@ -40,12 +43,31 @@
 /// pointer to an entry its life time is unlimited and we don't have
 /// to care about someone changing the entry under our feet.
 
+/// IterationResult is the outcome of the last iteration a thread completed.
+/// Threads publish it packed in a single atomic word, so that the main thread
+/// can poll the helpers while they are still searching, without locking and
+/// without touching their root move lists.
+
+struct IterationResult {
+
+  static uint64_t pack(Move m, Value v, Depth d) {
+    return uint64_t(uint32_t(m)) | uint64_t(uint16_t(int16_t(v))) << 32 | uint64_t(uint16_t(d)) << 48;
+  }
+
+  explicit IterationResult(uint64_t r) : move(Move(uint32_t(r))),
+                                         score(Value(int16_t(r >> 32))),
+                                         depth(Depth(uint16_t(r >> 48))) {}
+  Move move;
+  Value score;
+  Depth depth;
+};
+
 class Thread {
 
   Mutex mutex;
   ConditionVariable cv;
   size_t idx;
-  bool exit = false, searching = true; // Set before starting std::thread
+  bool exit = false, clearing = false, batching = false, searching = true; // Set before starting std::thread
   std::thread stdThread;
 
 public:
@@ -55,25 +77,35 @@ public:
   void clear();
   void idle_loop();
   void start_searching();
+  void start_clearing();
+  void start_batch();
   void wait_for_search_finished();
 
   Pawns::Table pawnsTable;
   Material::Table materialTable;
+  Eval::Cache evalCache;
   Endgames endgames;
-  size_t pvIdx, pvLast;
+  size_t pvIdx, pvLast, sharedPV;
+  std::vector<Value> sharedScores; // Best scores of the lines of a shared window
   int selDepth, nmpMinPly;
   Color nmpColor;
-  std::atomic<uint64_t> nodes, tbHits;
+  std::atomic<uint64_t> nodes, tbHits, result;
 
   Position rootPos;
+  StateInfo rootState; // Own copy of the root state, whose accumulator is written
   Search::RootMoves rootMoves;
   Depth rootDepth, completedDepth;
+  HistorySlots historySlots;
   CounterMoveHistory counterMoves;
   ButterflyHistory mainHistory;
+  GatingHistory gatingHistory;
   CapturePieceToHistory captureHistory;
   ContinuationHistory contHistory;
   Score contempt;
   Thread* bestThread; // to fetch best move when in XBoard mode
+  SearchStats::Counters stats = {};
+
+  IterationResult published() const { return IterationResult(result.load(std::memory_order_relaxed)); }
 };
 
 
@@ -89,6 +121,8 @@ struct MainThread : public Thread {
   double bestMoveChanges, previousTimeReduction;
   Value previousScore;
   int callsCnt;
+  Thread* vote_best_thread();
+  std::vector<TimePoint> iterationTimes; // Elapsed time at each completed depth
 };
 
 
@@ -98,17 +132,20 @@ struct MainThread : public Thread {
 
 struct ThreadPool : public std::vector<Thread*> {
 
-  void start_thinking(Position&, StateListPtr&, const Search::LimitsType&, bool = false);
+  void start_thinking(Position&, StateListPtr&, const Search::LimitsType&, bool = false,
+                      const Search::RootMoves* previous = nullptr, Depth resumeDepth = DEPTH_ZERO);
   void clear();
   void set(size_t);
 
   MainThread* main()        const { return static_cast<MainThread*>(front()); }
-  uint64_t nodes_searched() const { return accumulate(&Thread::nodes); }
-  uint64_t tb_hits()        const { return accumulate(&Thread::tbHits); }
+  uint64_t nodes_searched() const { return accumulate(&Thread::nodes) + Cluster::nodes_searched(); }
+  uint64_t tb_hits()        const { return accumulate(&Thread::tbHits) + Cluster::tb_hits(); }
 
   std::atomic_bool stop, ponder, stopOnPonderhit;
+  std::atomic<int> depthSearchers[MAX_PLY]; // Threads inside each root depth
 
   StateListPtr setupStates;
+  std::string historyReport; // Memory used by the histories, see set()
 
 private:
   uint64_t accumulate(std::atomic<uint64_t> Thread::* member) const {
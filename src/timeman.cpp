@@ -21,6 +21,8 @@
 #include <algorithm>
 #include <cfloat>
 #include <cmath>
+#include <iomanip>
+#include <sstream>
 
 #include "search.h"
 #include "timeman.h"
@@ -36,6 +38,13 @@ namespace {
   constexpr double MaxRatio   = 7.3;  // When in trouble, we can step over reserved time with this ratio
   constexpr double StealRatio = 0.34; // However we must not steal time from remaining moves over this ratio
 
+  constexpr int MinLagSamples  = 3;     // Measured moves before the lag replaces "Move Overhead"
+  constexpr double LagWeight   = 0.125; // Weight of a new lag sample once there are enough of them
+  constexpr TimePoint MaxLag   = 1000;  // Larger differences are clock changes, not lag
+  constexpr TimePoint MinOverhead = 5;  // Floor of the measured overhead, in ms
+  constexpr TimePoint PollPeriod = 2;   // Wanted time between two clock checks, in ms
+  constexpr TimePoint MinMargin  = 10;  // Time kept before the maximum, at least
+
 
   // move_importance() is a skew-logistic function based on naive statistical
   // analysis of "how many games are still undecided after n half-moves". Game
@@ -89,6 +98,38 @@ void TimeManagement::init(Search::LimitsType& limits, Color us, int ply) {
   TimePoint npmsec          = Options["nodestime"];
   TimePoint hypMyTime;
 
+  adaptive = Options["Adaptive Time"] && !npmsec && (limits.use_time_management() || limits.movetime);
+  current = { limits.use_time_management() && !npmsec, Threads.ponder, us, ply,
+              limits.movestogo, limits.time[us], limits.inc[us], 0 };
+
+  // The GUI charged the previous move with the time it left us then, plus the
+  // increment, minus the time it gives us now. The lag is what it charged
+  // beyond the time we measured. A new time control period or a pondered move
+  // give no sample.
+  if (   adaptive
+      && current.valid
+      && last.valid
+      && !last.pondered
+      && last.us == us
+      && last.ply + 2 == ply
+      && last.movestogo != 1)
+  {
+      TimePoint lag = last.time + last.inc - limits.time[us] - last.used;
+
+      if (std::abs(lag) <= MaxLag)
+      {
+          double w = std::max(LagWeight, 1.0 / ++lagSamples);
+          lastLag = lag;
+          lagMean += w * (lag - lagMean);
+          lagDev  += w * (std::abs(lag - lagMean) - lagDev);
+      }
+  }
+
+  if (adaptive && lagSamples >= MinLagSamples)
+      moveOverhead = std::min(TimePoint(5000), std::max(MinOverhead, TimePoint(std::ceil(lagMean + 2 * lagDev))));
+
+  overhead = moveOverhead;
+
   // If we have to play in 'nodes as time' mode, then convert from time
   // to nodes, and use resulting values in time management formulas.
   // WARNING: to avoid time losses, the given npmsec (nodes per millisecond)
@@ -130,4 +171,71 @@ void TimeManagement::init(Search::LimitsType& limits, Color us, int ply) {
 
   if (Options["Ponder"])
       optimumTime += optimumTime / 4;
+
+  // Keep twice the longest recent gap between two clock checks before the
+  // maximum, as the search may overrun it by as much.
+  stopMargin = adaptive ? std::max(MinMargin, std::min(2 * pollGap, maximumTime / 2)) : MinMargin;
+  lastPoll = startTime;
+  searchGap = 0;
+  pollCalls = adaptive && nodesPerMs > 0 ? int(std::max(16.0, std::min(1024.0, nodesPerMs * PollPeriod))) : 1024;
+}
+
+
+/// finish() is called when the best move is sent. It keeps the clock of the
+/// search to measure the lag at the next move.
+
+void TimeManagement::finish() {
+
+  current.used = now() - startTime;
+  last = current;
+
+  if (adaptive)
+      pollGap = std::max(searchGap, pollGap * 3 / 4);
+}
+
+
+/// poll_calls() is called by the main thread at each clock check with the
+/// nodes it searched, and returns the nodes to search until the next check.
+
+int TimeManagement::poll_calls(uint64_t nodes) {
+
+  if (!adaptive)
+      return 1024;
+
+  TimePoint tick = now();
+  searchGap = std::max(searchGap, tick - lastPoll);
+  lastPoll = tick;
+
+  if (tick > startTime)
+      nodesPerMs = double(nodes) / (tick - startTime);
+
+  // A check that came late means we are short of CPU, stop earlier
+  stopMargin = std::max(stopMargin, std::min(2 * searchGap, maximumTime / 2));
+  pollCalls = int(std::max(16.0, std::min(1024.0, nodesPerMs * PollPeriod)));
+
+  return pollCalls;
+}
+
+
+/// report() returns the decisions of the time management at the last search,
+/// for the "stats" command.
+
+std::string TimeManagement::report() const {
+
+  std::stringstream ss;
+
+  ss << std::fixed << std::setprecision(1)
+     << "Time management\n"
+     << "Adaptive time        : " << (adaptive ? "on" : "off")
+     << "\nLag samples          : " << lagSamples
+     << "\nLag mean / deviation : " << lagMean << " / " << lagDev << " ms (last " << lastLag << " ms)"
+     << "\nMove overhead        : " << overhead << " ms"
+     << (adaptive && lagSamples >= MinLagSamples ? " (measured)" : " (option)")
+     << "\nMain thread speed    : " << nodesPerMs << " nodes/ms"
+     << "\nClock check interval : " << pollCalls << " nodes"
+     << "\nLongest check gap    : " << searchGap << " ms (recent " << pollGap << " ms)"
+     << "\nStop margin          : " << stopMargin << " ms"
+     << "\nOptimum / maximum    : " << optimumTime << " / " << maximumTime << " ms";
+
+  return ss.str();
 }
@@ -21,20 +21,33 @@
 #ifndef TIMEMAN_H_INCLUDED
 #define TIMEMAN_H_INCLUDED
 
+#include <string>
+
 #include "misc.h"
 #include "search.h"
 #include "thread.h"
 
 /// The TimeManagement class computes the optimal time to think depending on
 /// the maximum available time, the game move number and other parameters.
+///
+/// With the "Adaptive Time" option it also calibrates itself while playing. It
+/// measures the real overhead of each move, the time the GUI charged us beyond
+/// what we spent between 'go' and 'bestmove', and uses it in place of "Move
+/// Overhead". It also measures the speed of the main thread, to check the
+/// clock about once per PollPeriod whatever the load, and the longest gap
+/// between two checks, to keep that much time before the maximum.
 
 class TimeManagement {
 public:
   void init(Search::LimitsType& limits, Color us, int ply);
+  void finish();
+  int poll_calls(uint64_t nodes);
   TimePoint optimum() const { return optimumTime; }
   TimePoint maximum() const { return maximumTime; }
+  TimePoint stop_margin() const { return stopMargin; }
   TimePoint elapsed() const { return Search::Limits.npmsec ?
                                      TimePoint(Threads.nodes_searched()) : now() - startTime; }
+  std::string report() const;
 
   int64_t availableNodes; // When in 'nodes as time' mode
 
@@ -42,6 +55,20 @@ private:
   TimePoint startTime;
   TimePoint optimumTime;
   TimePoint maximumTime;
+
+  // The clock of a timed search, kept until the next one to measure the lag
+  struct Clock {
+    bool valid, pondered;
+    Color us;
+    int ply, movestogo;
+    TimePoint time, inc, used;
+  };
+
+  bool adaptive = false;
+  int pollCalls = 1024, lagSamples = 0;
+  TimePoint overhead = 0, lastLag = 0, lastPoll = 0, searchGap = 0, pollGap = 0, stopMargin = 10;
+  double lagMean = 0, lagDev = 0, nodesPerMs = 0;
+  Clock current = {}, last = {};
 };
 
 extern TimeManagement Time;
@@ -18,48 +18,173 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <cstring>   // For std::memset
+#include <fstream>
 #include <iostream>
 #include <thread>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "bitboard.h"
 #include "misc.h"
+#include "position.h"
+#include "thread.h"
 #include "tt.h"
 #include "uci.h"
 
 TranspositionTable TT; // Our global transposition table
 
+bool TTEntry::Wide = false;
+
+namespace {
+
+  // FileHeader starts a transposition table saved by TranspositionTable::save().
+  // The fingerprint covers the Zobrist keys, through the key of a position with
+  // pieces in hand, and the variant name, so that a file written by a build
+  // with different keys or for another variant is rejected on load.
+  struct FileHeader {
+    char     magic[8];
+    uint64_t fingerprint;
+    uint64_t clusterCount;
+    uint32_t clusterBytes;
+    uint8_t  generation8;
+    uint8_t  padding[3];
+  };
+
+  constexpr char FileMagic[8] = "MSKTT01";
+
+  // SharedHeader occupies the first cache line of a shared memory table
+  struct SharedHeader {
+    char     magic[8];
+    uint64_t fingerprint;
+    uint64_t clusterCount;
+    uint32_t clusterBytes;
+  };
+  constexpr size_t ChunkSize = 64 * 1024 * 1024;
+
+  uint64_t fingerprint() {
+
+    StateInfo st;
+    Position pos;
+    pos.set("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR[C-L-c-l-] w KQkq - 0 1",
+            false, &st, Threads.main());
+
+    uint64_t h = pos.key();
+    for (char c : std::string(Options["UCI_Variant"]))
+        h = (h ^ uint8_t(c)) * 0x100000001B3ULL; // FNV-1a
+
+    return h;
+  }
+
+} // namespace
+
+
+/// TranspositionTable::attach_shared() maps the named segment set in the "Hash
+/// Shared" option, with room for a SharedHeader in front of the clusters. The
+/// first process creates and describes the segment, the next ones attach only
+/// if the header matches their own table, so that all the processes sharing
+/// a segment agree on its layout and Zobrist keys. A process attaching while
+/// the creator has not written the header yet falls back to a private table.
+
+Memory::Block TranspositionTable::attach_shared(const std::string& name, size_t size,
+                                                size_t clusterBytes) {
+
+  Memory::Block b = Memory::alloc_shared(name, CacheLineSize + size);
+
+  if (!b.ptr)
+      return b;
+
+  SharedHeader* h = (SharedHeader*)b.ptr;
+
+  if (b.flags & Memory::CREATED)
+  {
+      h->fingerprint  = fingerprint();
+      h->clusterCount = clusterCount;
+      h->clusterBytes = uint32_t(clusterBytes);
+      std::memcpy(h->magic, FileMagic, sizeof(FileMagic)); // Written last
+  }
+  else if (   std::memcmp(h->magic, FileMagic, sizeof(FileMagic))
+           || h->fingerprint  != fingerprint()
+           || h->clusterCount != clusterCount
+           || h->clusterBytes != clusterBytes)
+      Memory::free(b);
+
+  return b;
+}
+
 
 /// TranspositionTable::resize() sets the size of the transposition table,
 /// measured in megabytes. Transposition table consists of a power of 2 number
-/// of clusters and each cluster consists of ClusterSize number of TTEntry.
+/// of clusters and each cluster consists of ClusterSize number of TTEntry, or
+/// WideClusterSize number of WideEntry in the wide format. The memory comes from
+/// Memory::alloc() according to the "Large Pages" and "Hash NUMA" options. The
+/// kind of pages obtained is reported whenever it changes, but at startup,
+/// before the GUI has opened the protocol: the 'stats' command shows it then.
 
 void TranspositionTable::resize(size_t mbSize) {
 
-  clusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
+  const size_t clusterBytes = TTEntry::Wide ? sizeof(WideCluster) : sizeof(Cluster);
+
+  clusterCount = mbSize * 1024 * 1024 / clusterBytes;
+
+  Memory::free(mem);
 
-  free(mem);
-  mem = malloc(clusterCount * sizeof(Cluster) + CacheLineSize - 1);
+  const std::string sharedName = Options["Hash Shared"];
 
-  if (!mem)
+  if (!sharedName.empty() && sharedName != "<empty>")
+  {
+      mem = attach_shared(sharedName, clusterCount * clusterBytes, clusterBytes);
+
+      if (!mem.ptr)
+          sync_cout << "info string Could not share hash segment " << sharedName
+                    << ", using a private table" << sync_endl;
+  }
+
+  if (!mem.ptr)
+      mem = Memory::alloc(clusterCount * clusterBytes, Options["Large Pages"],
+                          Options["Hash NUMA"] == "interleave");
+
+  if (!mem.ptr)
   {
       std::cerr << "Failed to allocate " << mbSize
                 << "MB for transposition table." << std::endl;
       exit(EXIT_FAILURE);
   }
 
-  table = (Cluster*)((uintptr_t(mem) + CacheLineSize - 1) & ~(CacheLineSize - 1));
-  clear();
+  if (mem.flags & Memory::SHARED)
+      table = (Cluster*)((char*)mem.ptr + CacheLineSize); // Skip SharedHeader
+  else
+  {
+      table = (Cluster*)mem.ptr;
+      clear();
+  }
+
+  const std::string report = Memory::describe(mem);
+  if (!memoryReport.empty() && report != memoryReport)
+      sync_cout << "info string Hash allocated with " << report << sync_endl;
+
+  memoryReport = report;
 }
 
 
 /// TranspositionTable::clear() overwrites the entire transposition table
 /// with zeros. It is called whenever the table is resized, or when the
 /// user asks the program to clear the table (from the UCI interface).
-/// It starts as many threads as allowed by the Threads option.
+/// It starts as many threads as allowed by the Threads option. A shared
+/// table is never cleared, as other processes may be searching with it.
 
 void TranspositionTable::clear() {
 
+  if (mem.flags & Memory::SHARED)
+      return;
+
+  const size_t clusterBytes = TTEntry::Wide ? sizeof(WideCluster) : sizeof(Cluster);
   const size_t stride = clusterCount / Options["Threads"];
   std::vector<std::thread> threads;
   for (size_t idx = 0; idx < Options["Threads"]; idx++)
@@ -68,10 +193,10 @@ void TranspositionTable::clear() {
                    len =    idx != Options["Threads"] - 1 ?
                             stride :
                             clusterCount - start;
-      threads.push_back(std::thread([this, idx, start, len]() {
+      threads.push_back(std::thread([this, idx, start, len, clusterBytes]() {
           if (Options["Threads"] >= 8)
               WinProcGroup::bindThisThread(idx);
-          std::memset(&table[start], 0, len * sizeof(Cluster));
+          std::memset((char*)table + start * clusterBytes, 0, len * clusterBytes);
       }));
   }
 
@@ -88,6 +213,9 @@ void TranspositionTable::clear() {
 
 TTEntry* TranspositionTable::probe(const Key key, bool& found) const {
 
+  if (TTEntry::Wide)
+      return probe_wide(key, found);
+
   TTEntry* const tte = first_entry(key);
   const uint16_t key16 = key >> 48;  // Use the high 16 bits as key inside the cluster
 
@@ -115,12 +243,66 @@ TTEntry* TranspositionTable::probe(const Key key, bool& found) const {
 }
 
 
+/// TranspositionTable::probe_wide() is probe() for the wide format. A slot
+/// only matches if its check word agrees with the data it guards, otherwise
+/// it is either a different position or was torn by a concurrent save(). In
+/// both cases the slot is emptied and handed out for replacement.
+
+TTEntry* TranspositionTable::probe_wide(const Key key, bool& found) const {
+
+  WideEntry* const we = ((WideCluster*)first_entry(key))->entry;
+  const uint16_t key16 = key >> 48;
+  const uint32_t key32 = key >> 32;
+
+  for (int i = 0; i < WideClusterSize; ++i)
+  {
+      TTEntry* tte = &we[i].entry;
+
+      if (!tte->key16)
+          return found = false, tte;
+
+      if (tte->key16 == key16)
+      {
+          if ((we[i].key32 ^ tte->data32()) != key32)
+          {
+              tte->key16 = 0;
+              return found = false, tte;
+          }
+
+          if ((tte->genBound8 & 0xFC) != generation8)
+              tte->genBound8 = uint8_t(generation8 | tte->bound()); // Refresh
+
+          return found = true, tte;
+      }
+  }
+
+  // Find an entry to be replaced according to the replacement strategy
+  TTEntry* replace = &we[0].entry;
+  for (int i = 1; i < WideClusterSize; ++i)
+      if (  replace->depth8     - ((259 + generation8 - replace->genBound8    ) & 0xFC) * 2
+          >   we[i].entry.depth8 - ((259 + generation8 - we[i].entry.genBound8) & 0xFC) * 2)
+          replace = &we[i].entry;
+
+  return found = false, replace;
+}
+
+
 /// TranspositionTable::hashfull() returns an approximation of the hashtable
 /// occupation during a search. The hash is x permill full, as per UCI protocol.
 
 int TranspositionTable::hashfull() const {
 
   int cnt = 0;
+
+  if (TTEntry::Wide)
+  {
+      for (int i = 0; i < 1000 / WideClusterSize; i++)
+          for (int j = 0; j < WideClusterSize; j++)
+              if ((((WideCluster*)table)[i].entry[j].entry.genBound8 & 0xFC) == generation8)
+                  cnt++;
+      return cnt;
+  }
+
   for (int i = 0; i < 1000 / ClusterSize; i++)
   {
       const TTEntry* tte = &table[i].entry[0];
@@ -130,3 +312,139 @@ int TranspositionTable::hashfull() const {
   }
   return cnt;
 }
+
+
+/// TranspositionTable::save() writes the cluster array to a file, preceded
+/// by a FileHeader, so that a later session can continue from it with load().
+
+bool TranspositionTable::save(const std::string& path) const {
+
+  const size_t clusterBytes = TTEntry::Wide ? sizeof(WideCluster) : sizeof(Cluster);
+  const size_t size = clusterCount * clusterBytes;
+  std::ofstream file(path, std::ios::binary);
+  FileHeader h = {};
+
+  std::memcpy(h.magic, FileMagic, sizeof(FileMagic));
+  h.fingerprint  = fingerprint();
+  h.clusterCount = clusterCount;
+  h.clusterBytes = uint32_t(clusterBytes);
+  h.generation8  = generation8;
+
+  file.write((const char*)&h, sizeof(h));
+
+  for (size_t done = 0; file && done < size; done += ChunkSize)
+      file.write((const char*)table + done, std::min(ChunkSize, size - done));
+
+  if (!file)
+      sync_cout << "info string Could not write hash to " << path << sync_endl;
+
+  return bool(file);
+}
+
+
+/// TranspositionTable::load() restores a table written by save(). The file
+/// must match the current Hash size and format, otherwise it is rejected and
+/// the table is left untouched. On POSIX systems the file is memory-mapped and
+/// copied chunk by chunk, dropping each chunk from the mapping once consumed,
+/// so that huge tables do not double the resident memory on the way in.
+
+bool TranspositionTable::load(const std::string& path) {
+
+  const size_t clusterBytes = TTEntry::Wide ? sizeof(WideCluster) : sizeof(Cluster);
+  const size_t size = clusterCount * clusterBytes;
+  FileHeader h;
+
+  auto check = [&](const FileHeader& fh) {
+      if (std::memcmp(fh.magic, FileMagic, sizeof(FileMagic)) || fh.fingerprint != fingerprint())
+          sync_cout << "info string " << path << " is not a compatible hash file" << sync_endl;
+
+      else if (fh.clusterCount != clusterCount || fh.clusterBytes != clusterBytes)
+          sync_cout << "info string " << path << " needs Hash "
+                    << fh.clusterCount * fh.clusterBytes / (1024 * 1024) << " with "
+                    << (fh.clusterBytes == sizeof(Cluster) ? "compact" : "wide")
+                    << " Hash Format" << sync_endl;
+      else
+          return true;
+
+      return false;
+  };
+
+#ifndef _WIN32
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  struct stat statbuf;
+
+  if (fd == -1 || fstat(fd, &statbuf) || size_t(statbuf.st_size) < sizeof(h))
+  {
+      if (fd != -1)
+          ::close(fd);
+
+      sync_cout << "info string Could not read hash from " << path << sync_endl;
+      return false;
+  }
+
+  void* map = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+
+  if (map == MAP_FAILED)
+  {
+      sync_cout << "info string Could not mmap() " << path << sync_endl;
+      return false;
+  }
+
+  madvise(map, statbuf.st_size, MADV_SEQUENTIAL);
+  std::memcpy(&h, map, sizeof(h));
+
+  bool ok = check(h);
+
+  if (ok && size_t(statbuf.st_size) != sizeof(h) + size)
+  {
+      sync_cout << "info string " << path << " is truncated" << sync_endl;
+      ok = false;
+  }
+
+  if (ok)
+      for (size_t done = 0; done < size; done += ChunkSize)
+      {
+          const size_t len = std::min(ChunkSize, size - done);
+          const char* src = (const char*)map + sizeof(h) + done;
+
+          std::memcpy((char*)table + done, src, len);
+
+          // Only whole pages can be dropped, the header shifts the data a bit
+          const uintptr_t first = (uintptr_t(src) + 4095) & ~uintptr_t(4095);
+          const uintptr_t last  = (uintptr_t(src) + len) & ~uintptr_t(4095);
+          if (last > first)
+              madvise((void*)first, last - first, MADV_DONTNEED);
+      }
+
+  munmap(map, statbuf.st_size);
+
+#else
+
+  std::ifstream file(path, std::ios::binary);
+
+  if (!file.read((char*)&h, sizeof(h)))
+  {
+      sync_cout << "info string Could not read hash from " << path << sync_endl;
+      return false;
+  }
+
+  bool ok = check(h);
+
+  for (size_t done = 0; ok && done < size; done += ChunkSize)
+      ok = bool(file.read((char*)table + done, std::min(ChunkSize, size - done)));
+
+  if (!ok && file.fail())
+  {
+      sync_cout << "info string " << path << " is truncated" << sync_endl;
+      clear();
+  }
+
+#endif
+
+  if (ok)
+      generation8 = h.generation8;
+
+  return ok;
+}
@@ -21,6 +21,8 @@
 #ifndef TT_H_INCLUDED
 #define TT_H_INCLUDED
 
+#include <string>
+
 #include "misc.h"
 #include "types.h"
 
@@ -33,6 +35,11 @@
 /// generation  6 bit
 /// bound type  2 bit
 /// depth       8 bit
+///
+/// In the wide format (see TranspositionTable::set_wide()) every entry is
+/// followed by a 32 bit check word holding the upper half of the key xor-ed
+/// with the entry data, so that entries torn by concurrent writers are
+/// rejected by probe() instead of being returned as hits.
 
 struct TTEntry {
 
@@ -62,11 +69,24 @@ struct TTEntry {
         genBound8 = (uint8_t)(g | b);
         depth8    = (int8_t)(d / ONE_PLY);
     }
+
+    if (Wide)
+        seal(k);
   }
 
 private:
   friend class TranspositionTable;
 
+  // The generation bits are left out, as probe() refreshes them in place
+  uint32_t data32() const {
+    return  (uint32_t(move16)          | uint32_t(uint16_t(value16)) << 16)
+          ^ (uint32_t(uint16_t(eval16)) | uint32_t(uint8_t(depth8)) << 16
+                                       | uint32_t(genBound8 & 0x3) << 24);
+  }
+
+  void seal(Key k);
+  static bool Wide;
+
   uint16_t key16;
   uint16_t move16;
   int16_t  value16;
@@ -81,41 +101,71 @@ private:
 /// contains information of exactly one position. The size of a cluster should
 /// divide the size of a cache line size, to ensure that clusters never cross
 /// cache lines. This ensures best cache performance, as the cacheline is
-/// prefetched, as soon as possible.
+/// prefetched, as soon as possible. The wide format trades the fourth part of
+/// the entries for 32 bit key verification: WideClusterSize entries of 16 bytes
+/// fill a whole cache line.
 
 class TranspositionTable {
 
+  friend struct TTEntry;
+
   static constexpr int CacheLineSize = 64;
   static constexpr int ClusterSize = 3;
+  static constexpr int WideClusterSize = 4;
 
   struct Cluster {
     TTEntry entry[ClusterSize];
     char padding[2]; // Align to a divisor of the cache line size
   };
 
+  struct WideEntry {
+    TTEntry entry;
+    uint16_t padding;
+    uint32_t key32; // Upper 32 bits of the key xor-ed with TTEntry::data32()
+  };
+
+  struct WideCluster {
+    WideEntry entry[WideClusterSize];
+  };
+
   static_assert(CacheLineSize % sizeof(Cluster) == 0, "Cluster size incorrect");
+  static_assert(sizeof(WideCluster) == CacheLineSize, "Wide cluster size incorrect");
+
+  TTEntry* probe_wide(const Key key, bool& found) const;
+  Memory::Block attach_shared(const std::string& name, size_t size, size_t clusterBytes);
 
 public:
- ~TranspositionTable() { free(mem); }
+ ~TranspositionTable() { Memory::free(mem); }
   void new_search() { generation8 += 4; } // Lower 2 bits are used by Bound
   uint8_t generation() const { return generation8; }
   TTEntry* probe(const Key key, bool& found) const;
   int hashfull() const;
   void resize(size_t mbSize);
+  void set_wide(bool wide) { TTEntry::Wide = wide; }
   void clear();
+  bool save(const std::string& path) const;
+  bool load(const std::string& path);
+  const std::string& memory() const { return memoryReport; }
 
   // The 32 lowest order bits of the key are used to get the index of the cluster
   TTEntry* first_entry(const Key key) const {
-    return &table[(uint32_t(key) * uint64_t(clusterCount)) >> 32].entry[0];
+    const size_t idx = (uint32_t(key) * uint64_t(clusterCount)) >> 32;
+    return TTEntry::Wide ? &((WideCluster*)table)[idx].entry[0].entry
+                         : &table[idx].entry[0];
   }
 
 private:
   size_t clusterCount;
-  Cluster* table;
-  void* mem;
+  Cluster* table; // Points to WideCluster-s in the wide format
+  Memory::Block mem;
+  std::string memoryReport; // Kind of pages of 'mem', see Memory::describe()
   uint8_t generation8; // Size must be not bigger than TTEntry::genBound8
 };
 
 extern TranspositionTable TT;
 
+inline void TTEntry::seal(Key k) {
+  reinterpret_cast<TranspositionTable::WideEntry*>(this)->key32 = uint32_t(k >> 32) ^ data32();
+}
+
 #endif // #ifndef TT_H_INCLUDED
@@ -239,6 +239,7 @@ enum PieceType {
   ALL_PIECES = 0,
 
   PIECE_TYPE_NB = 1 << PIECE_TYPE_BITS,
+  PIECE_TYPE_USED = KING + 1, // Dense bound used to size per-type tables
   
   // Aliases for Betza notation compatibility
   CUSTOM_PIECES = CUSTOM_PIECE_1,
@@ -18,15 +18,20 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
 
+#include "batch.h"
+#include "cluster.h"
 #include "evaluate.h"
 #include "movegen.h"
 #include "position.h"
 #include "search.h"
+#include "stats.h"
 #include "thread.h"
 #include "timeman.h"
 #include "tt.h"
@@ -36,7 +41,8 @@
 
 using namespace std;
 
-extern vector<string> setup_bench(const Position&, istream&);
+extern vector<string> setup_bench(const Position&, istream&, string&);
+extern void key_bench(const Position&, istream&);
 
 namespace {
 
@@ -44,6 +50,19 @@ namespace {
   const char* StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 
 
+  // The last position set up by position(), so that when the next command
+  // only extends its move list, as GUIs resend the whole game at every move,
+  // just the new moves are made on the board. Loading new Betza pieces may
+  // change the hash keys, so it forces a full set up.
+  struct {
+    string fen;
+    bool chess960;
+    vector<string> moves;
+    Key key = 0;
+    uint64_t betzaVersion;
+  } lastPosition;
+
+
   // position() is called when engine receives the "position" UCI command.
   // The function sets up the position described in the given FEN string ("fen")
   // or the starting position ("startpos") and then makes the moves given in the
@@ -53,6 +72,7 @@ namespace {
 
     Move m;
     string token, fen;
+    vector<string> moves;
 
     is >> token;
 
@@ -67,15 +87,43 @@ namespace {
     else
         return;
 
-    states = StateListPtr(new std::deque<StateInfo>(1)); // Drop old and create a new one
-    pos.set(fen, Options["UCI_Chess960"], &states->back(), Threads.main());
+    while (is >> token)
+        moves.push_back(token);
+
+    // Take back the states of the last search, to reuse their storage
+    Threads.main()->wait_for_search_finished();
+
+    if (!states.get())
+        states = std::move(Threads.setupStates);
+
+    const auto& last = lastPosition;
+    bool chess960 = Options["UCI_Chess960"];
+    size_t ply = 0;
+
+    if (   fen == last.fen
+        && chess960 == last.chess960
+        && betzaManager.version() == last.betzaVersion
+        && pos.key() == last.key
+        && pos.state() == &states->back()
+        && states->size() == last.moves.size() + 1
+        && moves.size() >= last.moves.size()
+        && std::equal(last.moves.begin(), last.moves.end(), moves.begin()))
+        ply = last.moves.size();
+    else
+    {
+        states->clear();
+        pos.set(fen, chess960, &states->back(), Threads.main());
+    }
 
     // Parse move list (if any)
-    while (is >> token && (m = UCI::to_move(pos, token)) != MOVE_NONE)
+    for ( ; ply < moves.size() && (m = UCI::to_move(pos, moves[ply])) != MOVE_NONE; ++ply)
     {
         states->emplace_back();
         pos.do_move(m, states->back());
     }
+
+    moves.resize(ply);
+    lastPosition = { fen, chess960, moves, pos.key(), betzaManager.version() };
   }
 
 
@@ -130,9 +178,23 @@ namespace {
         else if (token == "movetime")  is >> limits.movetime;
         else if (token == "mate")      is >> limits.mate;
         else if (token == "perft")     is >> limits.perft;
+        else if (token == "divide")    is >> limits.perft, limits.divide = 1;
         else if (token == "infinite")  limits.infinite = 1;
         else if (token == "ponder")    ponderMode = true;
 
+    // The other nodes of a cluster search until this one stops them, see
+    // MainThread::search(). Perft stays local.
+    string clusterGo;
+    if (!limits.perft)
+    {
+        clusterGo = "go infinite";
+        if (!limits.searchmoves.empty())
+            clusterGo += " searchmoves";
+        for (Move m : limits.searchmoves)
+            clusterGo += " " + UCI::move(m, pos);
+    }
+
+    Cluster::start_search(clusterGo);
     Threads.start_thinking(pos, states, limits, ponderMode);
   }
 
@@ -143,13 +205,17 @@ namespace {
 
   void bench(Position& pos, istream& args, StateListPtr& states) {
 
-    string token;
+    string token, format;
     uint64_t num, nodes = 0, cnt = 1;
+    stringstream json;
 
-    vector<string> list = setup_bench(pos, args);
+    vector<string> list = setup_bench(pos, args, format);
     num = count_if(list.begin(), list.end(), [](string s) { return s.find("go ") == 0; });
 
     TimePoint elapsed = now();
+    uint64_t startCycles = SearchStats::now_cycles();
+
+    SearchStats::clear();
 
     for (const auto& cmd : list)
     {
@@ -159,9 +225,33 @@ namespace {
         if (token == "go")
         {
             cerr << "\nPosition: " << cnt++ << '/' << num << endl;
+            const string fen = pos.fen();
+            const TimePoint start = now();
+
             go(pos, is, states);
             Threads.main()->wait_for_search_finished();
             nodes += Threads.nodes_searched();
+
+            if (format == "json")
+            {
+                const TimePoint time = now() - start + 1;
+                const MainThread* mainThread = Threads.main();
+
+                json << (cnt > 2 ? "," : "")
+                     << "{\"fen\":\"" << fen << "\",\"go\":\"" << cmd.substr(3) << "\""
+                     << ",\"nodes\":" << Threads.nodes_searched()
+                     << ",\"time\":" << time
+                     << ",\"nps\":" << 1000 * Threads.nodes_searched() / time
+                     << ",\"depth\":" << mainThread->completedDepth / ONE_PLY
+                     << ",\"hashfull\":" << TT.hashfull()
+                     << ",\"tbhits\":" << Threads.tb_hits()
+                     << ",\"depthTimes\":[";
+
+                for (size_t i = 0; i < mainThread->iterationTimes.size(); ++i)
+                    json << (i ? "," : "") << mainThread->iterationTimes[i];
+
+                json << "]}";
+            }
         }
         else if (token == "setoption")  setoption(is);
         else if (token == "position")   position(pos, is, states);
@@ -176,6 +266,19 @@ namespace {
          << "\nTotal time (ms) : " << elapsed
          << "\nNodes searched  : " << nodes
          << "\nNodes/second    : " << 1000 * nodes / elapsed << endl;
+
+    // Cycle breakdown by search phase, only in builds with stats=yes
+    const uint64_t cycles = SearchStats::now_cycles() - startCycles;
+    cerr << SearchStats::phases(cycles * Threads.size());
+
+    if (format == "json")
+        sync_cout << "{\"engine\":\"" << engine_info() << "\""
+                  << ",\"threads\":" << size_t(Options["Threads"])
+                  << ",\"hash\":" << size_t(Options["Hash"])
+                  << ",\"nodes\":" << nodes
+                  << ",\"time\":" << elapsed
+                  << ",\"nps\":" << 1000 * nodes / elapsed
+                  << ",\"positions\":[" << json.str() << "]}" << sync_endl;
   }
 
 } // namespace
@@ -191,7 +294,7 @@ void UCI::loop(int argc, char* argv[]) {
 
   Position pos;
   string token, cmd;
-  StateListPtr states(new std::deque<StateInfo>(1));
+  StateListPtr states(new StateList);
   auto uiThread = std::make_shared<Thread>(0);
 
   pos.set(StartFEN, false, &states->back(), uiThread.get());
@@ -203,7 +306,7 @@ void UCI::loop(int argc, char* argv[]) {
   XBoard::StateMachine xboardStateMachine;
 
   do {
-      if (argc == 1 && !getline(cin, cmd)) // Block here waiting for input or EOF
+      if (argc == 1 && !Cluster::getline(cin, cmd)) // Block here waiting for input or EOF
           cmd = "quit";
 
       istringstream is(cmd);
@@ -211,6 +314,12 @@ void UCI::loop(int argc, char* argv[]) {
       token.clear(); // Avoid a stale if getline() returns empty or blank line
       is >> skipws >> token;
 
+      // The other nodes of a cluster follow the position and the settings,
+      // and stop at once with this one.
+      if (   token == "position" || token == "setoption" || token == "ucinewgame"
+          || token == "stop"     || token == "ponderhit")
+          Cluster::broadcast(cmd);
+
       // The GUI sends 'ponderhit' to tell us the user has played the expected move.
       // So 'ponderhit' will be sent if we were told to ponder on the same move the
       // user has played. We should continue searching but switch from pondering to
@@ -250,8 +359,39 @@ void UCI::loop(int argc, char* argv[]) {
       // Additional custom non-UCI commands, mainly for debugging
       else if (token == "flip")  pos.flip();
       else if (token == "bench") bench(pos, is, states);
+      else if (token == "keybench") key_bench(pos, is);
+      else if (token == "batch") Batch::analyse(is);
+      else if (token == "gensfen") Batch::gensfen(is);
       else if (token == "d")     sync_cout << pos << sync_endl;
       else if (token == "eval")  sync_cout << Eval::trace(pos) << sync_endl;
+      else if (token == "stats")
+      {
+          Threads.main()->wait_for_search_finished();
+
+          if (is >> token && token == "reset")
+              SearchStats::clear();
+          else
+              sync_cout << SearchStats::report() << "\n\n" << Time.report()
+                        << "\n\nMemory"
+                        << "\nHash                 : " << TT.memory()
+                        << "\nHistories            : " << Threads.historyReport << sync_endl;
+      }
+      else if (token == "bitbases")
+      {
+          string dir;
+          getline(is >> std::ws, dir);
+          Bitbases::generate(dir.empty() ? "." : dir);
+      }
+      else if (token == "savehash" || token == "loadhash")
+      {
+          string path;
+          getline(is >> std::ws, path);
+          Threads.main()->wait_for_search_finished();
+
+          if (token == "savehash" ? TT.save(path) : TT.load(path))
+              sync_cout << "info string Hash " << (token == "savehash" ? "saved to " : "loaded from ")
+                        << path << sync_endl;
+      }
       else
           sync_cout << "Unknown command: " << cmd << sync_endl;
 
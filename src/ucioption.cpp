@@ -23,7 +23,11 @@
 #include <ostream>
 #include <iostream>
 
+#include "betza.h"
+#include "cluster.h"
 #include "misc.h"
+#include "nnue.h"
+#include "perft.h"
 #include "search.h"
 #include "thread.h"
 #include "tt.h"
@@ -38,11 +42,50 @@ UCI::OptionsMap Options; // Global object
 namespace UCI {
 
 /// 'On change' actions, triggered by an option's value change
-void on_clear_hash(const Option&) { Search::clear(); }
+void on_clear_hash(const Option&) { Search::clear(); Perft::clear(); }
 void on_hash_size(const Option& o) { TT.resize(o); }
+void on_hash_memory(const Option&) { TT.resize(Options["Hash"]); }
+void on_hash_format(const Option& o) { TT.set_wide(std::string(o) == "wide"); TT.resize(Options["Hash"]); }
+void on_perft_hash_size(const Option& o) { Perft::resize(o); }
 void on_logger(const Option& o) { start_logger(o); }
+void on_info_interval(const Option& o) { set_info_interval(o); }
 void on_threads(const Option& o) { Threads.set(o); }
+void on_pawn_hash(const Option& o) {
+  Threads.main()->wait_for_search_finished();
+  for (Thread* th : Threads)
+      th->pawnsTable.resize(o);
+}
+void on_material_hash(const Option& o) {
+  Threads.main()->wait_for_search_finished();
+  for (Thread* th : Threads)
+      th->materialTable.resize(o);
+}
+void on_eval_cache(const Option& o) {
+  Threads.main()->wait_for_search_finished();
+  for (Thread* th : Threads)
+      th->evalCache.resize(o);
+}
 void on_tb_path(const Option& o) { Tablebases::init(o); }
+void on_bitbase_path(const Option& o) {
+  Threads.main()->wait_for_search_finished();
+  Bitbases::load(o);
+  Search::clear();
+}
+void on_eval_file(const Option& o) {
+  Threads.main()->wait_for_search_finished();
+  Eval::NNUE::init(o);
+  Search::clear();
+}
+void on_betza_file(const Option& o) {
+  Threads.main()->wait_for_search_finished();
+  betzaManager.load(o);
+}
+#ifdef USE_CLUSTER
+void on_cluster_hosts(const Option& o) {
+  Threads.main()->wait_for_search_finished();
+  Cluster::connect(o);
+}
+#endif
 void on_variant(const Option& o) {
     if (Options["Protocol"] == "xboard")
     {
@@ -93,17 +136,30 @@ void init(OptionsMap& o) {
 
   o["Protocol"]              << Option("uci", {"uci", "xboard"});
   o["Debug Log File"]        << Option("", on_logger);
+  o["Info Interval"]         << Option(0, 0, 5000, on_info_interval);
   o["Contempt"]              << Option(21, -100, 100);
   o["Analysis Contempt"]     << Option("Both", {"Both", "Off", "White", "Black"});
   o["Threads"]               << Option(1, 1, 512, on_threads);
+  o["ABDADA"]                << Option(false);
   o["Hash"]                  << Option(16, 1, MaxHashMB, on_hash_size);
+  o["Hash Format"]           << Option("compact", {"compact", "wide"}, on_hash_format);
+  o["Hash NUMA"]             << Option("first-touch", {"first-touch", "interleave"}, on_hash_memory);
+  o["Large Pages"]           << Option(true, on_hash_memory);
+  o["Hash Shared"]           << Option("<empty>", on_hash_memory);
   o["Clear Hash"]            << Option(on_clear_hash);
+  o["Perft Hash"]            << Option(16, 0, MaxHashMB, on_perft_hash_size);
+  o["Pawn Hash"]             << Option(2, 1, 1024, on_pawn_hash);
+  o["Material Hash"]         << Option(1, 1, 1024, on_material_hash);
+  o["Eval Cache"]            << Option(0, 0, 1024, on_eval_cache);
+  o["EvalFile"]              << Option("<empty>", on_eval_file);
   o["Ponder"]                << Option(false);
   o["MultiPV"]               << Option(1, 1, 500);
+  o["MultiPV Mode"]          << Option("separate", {"separate", "shared"});
   o["Skill Level"]           << Option(20, 0, 20);
   o["Move Overhead"]         << Option(30, 0, 5000);
   o["Minimum Thinking Time"] << Option(20, 0, 5000);
   o["Slow Mover"]            << Option(84, 10, 1000);
+  o["Adaptive Time"]         << Option(false);
   o["nodestime"]             << Option(0, 0, 10000);
   o["UCI_Variant"]           << Option("musketeer", {"musketeer"}, on_variant);
   o["UCI_Chess960"]          << Option(false);
@@ -112,6 +168,11 @@ void init(OptionsMap& o) {
   o["SyzygyProbeDepth"]      << Option(1, 1, 100);
   o["Syzygy50MoveRule"]      << Option(true);
   o["SyzygyProbeLimit"]      << Option(6, 0, 6);
+  o["BitbasePath"]           << Option("<empty>", on_bitbase_path);
+  o["BetzaFile"]             << Option("<empty>", on_betza_file);
+#ifdef USE_CLUSTER
+  o["ClusterHosts"]          << Option("<empty>", on_cluster_hosts);
+#endif
 }
 
 
@@ -22,6 +22,7 @@
 #include "evaluate.h"
 #include "search.h"
 #include "thread.h"
+#include "timeman.h"
 #include "types.h"
 #include "uci.h"
 #include "xboard.h"
@@ -34,13 +35,17 @@ namespace {
     return limits;
   }();
 
+  constexpr size_t MaxAnalyses = 4096;        // Positions whose analysis is kept
+  constexpr Depth ResumeMargin = 4 * ONE_PLY; // Iterations redone when resuming
+
   // go() starts the search for game play, analysis, or perft.
 
-  void go(Position& pos, Search::LimitsType limits, StateListPtr& states) {
+  void go(Position& pos, Search::LimitsType limits, StateListPtr& states,
+          const Search::RootMoves* previous = nullptr, Depth resumeDepth = DEPTH_ZERO) {
 
     limits.startTime = now(); // As early as possible!
 
-    Threads.start_thinking(pos, states, limits, false);
+    Threads.start_thinking(pos, states, limits, false, previous, resumeDepth);
   }
 
   // setboard() is called when engine receives the "setboard" XBoard command.
@@ -50,7 +55,7 @@ namespace {
     if (fen.empty())
         fen = XBoard::StartFEN;
 
-    states = StateListPtr(new std::deque<StateInfo>(1)); // Drop old and create a new one
+    states = StateListPtr(new StateList); // Drop old and create a new one
     pos.set(fen, Options["UCI_Chess960"], &states->back(), Threads.main());
   }
 
@@ -88,6 +93,66 @@ namespace XBoard {
 
 const char* StartFEN = "lc******/rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR/LC****** w KQBCDFGkqbcdfg - 0 1";
 
+
+/// StateMachine::start_analysis() starts an infinite search of the position.
+/// A position analysed before keeps its root moves, whose PV is reported at
+/// once, and the iterations resume a few plies below the depth it reached,
+/// with aspiration windows around the scores found then. The transposition
+/// table still holds most of the tree, so the plies redone are quick.
+
+void StateMachine::start_analysis(Position& pos, StateListPtr& states) {
+
+  auto it = analyses.find(pos.key());
+
+  if (it == analyses.end())
+      go(pos, analysisLimits, states);
+  else
+      go(pos, analysisLimits, states, &it->second.rootMoves,
+         std::max(it->second.depth - ResumeMargin, DEPTH_ZERO));
+}
+
+
+/// StateMachine::stop_analysis() stops the search and keeps its results
+
+void StateMachine::stop_analysis() {
+
+  Threads.stop = true;
+  Threads.main()->wait_for_search_finished();
+
+  const Thread* th = Threads.main()->bestThread;
+
+  if (th->completedDepth > DEPTH_ZERO && th->rootMoves[0].pv[0] != MOVE_NONE)
+  {
+      if (analyses.size() >= MaxAnalyses)
+          analyses.clear();
+
+      analyses[th->rootPos.key()] = { th->rootMoves, th->completedDepth };
+  }
+}
+
+
+/// StateMachine::follow_pv() gives a position reached by a move of the PV the
+/// rest of that PV, when it has no analysis of its own.
+
+void StateMachine::follow_pv(Key from, Move m, Key to) {
+
+  auto it = analyses.find(from);
+
+  if (   it == analyses.end()
+      || analyses.count(to)
+      || it->second.rootMoves[0].pv[0] != m
+      || it->second.rootMoves[0].pv.size() < 2)
+      return;
+
+  const Search::RootMove& rm = it->second.rootMoves[0];
+  Search::RootMove next(rm.pv[1]);
+  next.pv.assign(rm.pv.begin() + 1, rm.pv.end());
+  next.score = -rm.score;
+
+  analyses[to] = { Search::RootMoves(1, next), it->second.depth - ONE_PLY };
+}
+
+
 /// StateMachine::process_command() processes commands of the XBoard protocol.
 
 void StateMachine::process_command(Position& pos, std::string token, std::istringstream& is, StateListPtr& states) {
@@ -114,6 +179,13 @@ void StateMachine::process_command(Position& pos, std::string token, std::istrin
   }
   else if (token == "new")
   {
+      // A new game leaves analyze mode
+      if (Options["UCI_AnalyseMode"])
+      {
+          stop_analysis();
+          Options["UCI_AnalyseMode"] = std::string("false");
+      }
+      analyses.clear();
       Search::clear();
       setboard(pos, states);
       // play second by default
@@ -177,7 +249,11 @@ void StateMachine::process_command(Position& pos, std::string token, std::istrin
   {
       std::string fen;
       std::getline(is >> std::ws, fen);
+      if (Options["UCI_AnalyseMode"])
+          stop_analysis();
       setboard(pos, states, fen);
+      if (Options["UCI_AnalyseMode"])
+          start_analysis(pos, states);
   }
   else if (token == "cores")
   {
@@ -206,13 +282,15 @@ void StateMachine::process_command(Position& pos, std::string token, std::istrin
   }
   else if (token == "analyze")
   {
+      if (Options["UCI_AnalyseMode"])
+          stop_analysis();
       Options["UCI_AnalyseMode"] = std::string("true");
-      go(pos, analysisLimits, states);
+      start_analysis(pos, states);
   }
   else if (token == "exit")
   {
-      Threads.stop = true;
-      Threads.main()->wait_for_search_finished();
+      if (Options["UCI_AnalyseMode"])
+          stop_analysis();
       Options["UCI_AnalyseMode"] = std::string("false");
   }
   else if (token == "undo")
@@ -220,20 +298,29 @@ void StateMachine::process_command(Position& pos, std::string token, std::istrin
       if (moveList.size())
       {
           if (Options["UCI_AnalyseMode"])
-          {
-              Threads.stop = true;
-              Threads.main()->wait_for_search_finished();
-          }
+              stop_analysis();
           undo_move(pos, moveList, states);
           if (Options["UCI_AnalyseMode"])
-              go(pos, analysisLimits, states);
+              start_analysis(pos, states);
+      }
+  }
+  // Periodic status request in analyze mode
+  else if (token == ".")
+  {
+      if (Options["UCI_AnalyseMode"])
+      {
+          IterationResult r = Threads.main()->published();
+          sync_cout << "stat01: " << Time.elapsed() / 10 << " " << Threads.nodes_searched()
+                    << " " << r.depth / ONE_PLY << " 0 " << Threads.main()->rootMoves.size()
+                    << " " << UCI::move(r.move, pos) << sync_endl;
       }
   }
   // Additional custom non-XBoard commands
-  else if (token == "perft")
+  else if (token == "perft" || token == "divide")
   {
       Search::LimitsType perft_limits;
       is >> perft_limits.perft;
+      perft_limits.divide = (token == "divide");
       go(pos, perft_limits, states);
   }
   else if (token == "d")
@@ -247,17 +334,19 @@ void StateMachine::process_command(Position& pos, std::string token, std::istrin
       if (token == "usermove")
           is >> token;
       if (Options["UCI_AnalyseMode"])
-      {
-          Threads.stop = true;
-          Threads.main()->wait_for_search_finished();
-      }
+          stop_analysis();
       Move m;
       if ((m = UCI::to_move(pos, token)) != MOVE_NONE)
+      {
+          Key key = pos.key();
           do_move(pos, moveList, states, m);
+          if (Options["UCI_AnalyseMode"])
+              follow_pv(key, m, pos.key());
+      }
       else
           sync_cout << "Error (unkown command): " << token << sync_endl;
       if (Options["UCI_AnalyseMode"])
-          go(pos, analysisLimits, states);
+          start_analysis(pos, states);
       else if (pos.side_to_move() == playColor)
       {
           go(pos, limits, states);
@@ -19,9 +19,12 @@
 #ifndef XBOARD_H_INCLUDED
 #define XBOARD_H_INCLUDED
 
+#include <deque>
+#include <map>
 #include <sstream>
 #include <string>
 
+#include "search.h"
 #include "types.h"
 
 class Position;
@@ -30,7 +33,10 @@ namespace XBoard {
 
 extern const char* StartFEN;
 
-/// StateMachine class maintains the states required by XBoard protocol
+/// StateMachine class maintains the states required by XBoard protocol. In
+/// analyze mode it keeps the results of the positions analysed, so that the
+/// analysis of a position the GUI returns to, or reaches along the PV, resumes
+/// from them instead of starting over.
 
 class StateMachine {
 public:
@@ -42,7 +48,17 @@ public:
   void process_command(Position& pos, std::string token, std::istringstream& is, StateListPtr& states);
 
 private:
+  struct Analysis {
+    Search::RootMoves rootMoves;
+    Depth depth;
+  };
+
+  void start_analysis(Position& pos, StateListPtr& states);
+  void stop_analysis();
+  void follow_pv(Key from, Move m, Key to);
+
   std::deque<Move> moveList;
+  std::map<Key, Analysis> analyses;
   Search::LimitsType limits;
   bool moveAfterSearch;
   Color playColor;